@@ -0,0 +1,41 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ */
+#include <glib.h>
+
+#include "allocs.h"
+
+// The fs workers allocate on other threads, hence the atomics.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+static gint allocs;
+
+void *
+malloc(size_t size)
+{
+    g_atomic_int_inc(&allocs);
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+    g_atomic_int_inc(&allocs);
+    return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *p, size_t size)
+{
+    g_atomic_int_inc(&allocs);
+    return __libc_realloc(p, size);
+}
+
+int
+allocs_get(void)
+{
+    return g_atomic_int_get(&allocs);
+}
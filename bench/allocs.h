@@ -0,0 +1,14 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ */
+#ifndef MANITOR_BENCH_ALLOCS_H
+#define MANITOR_BENCH_ALLOCS_H
+
+// Linking with allocs.c wraps malloc() and friends, which GLib, Pango and
+// cairo use too, to count the allocations the program makes.
+
+// Returns the number of allocations so far, on all the threads.
+int allocs_get(void);
+
+#endif // #ifndef MANITOR_BENCH_ALLOCS_H
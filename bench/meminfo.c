@@ -0,0 +1,213 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ *
+ * Compares the single-pass /proc/meminfo parser in info.c with the old one,
+ * which scanned the whole buffer once for each value it wanted.
+ *
+ * Usage: meminfo-bench FILE...
+ * Each FILE is a captured copy of /proc/meminfo.
+ */
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../info.h"
+
+#define ITERATIONS 200000
+
+static char *
+skip_space(const char *s)
+{
+    while (*s == ' ' || *s == '\t' || *s == '\a' || *s == '\v') s++;
+    return (char *) s;
+}
+
+static char *
+skip_line(const char *s)
+{
+    const char *end = strchr(s, '\n');
+    return (char *) (end ? end + 1 : s + strlen(s));
+}
+
+static char *
+skip_token(const char *s)
+{
+    while (*s && *s != ' ' && *s != '\t' && *s != '\a' && *s != '\v') s++;
+    return (char *) s;
+}
+
+// The parser info.c used before info_parse_meminfo(), kept as the baseline.
+static inline guint64
+parse_meminfo_value(const char *meminfo, const char *name)
+{
+    guint64 val = 0;
+    const char *start = meminfo;
+    char *s = NULL;
+
+    while (TRUE) {
+        s = strstr(start, name);
+        if (G_UNLIKELY(!s)) {
+            return val;
+        }
+        if (s == start || s[-1] == '\n') {
+            break;
+        }
+        start = skip_line(s);
+        if (!*start) {
+            return val;
+        }
+    }
+
+    s = skip_token(s);
+    s = skip_space(s);
+    val = g_ascii_strtoull(s, &s, 10);
+    s = skip_space(s);
+    switch (*s) {
+    case 'k': val *= 1024; break;
+    case 'M': val *= 1024 * 1024; break;
+    }
+
+    return val;
+}
+
+// The eight values info_update_mem_swap() used to look up.
+static void
+parse_old(InfoMeminfo *mi, const char *buf)
+{
+    mi->mem_total = parse_meminfo_value(buf, "MemTotal:");
+    mi->mem_free = parse_meminfo_value(buf, "MemFree:");
+    mi->shmem = parse_meminfo_value(buf, "Shmem:");
+    mi->sreclaimable = parse_meminfo_value(buf, "SReclaimable:");
+    mi->buffers = parse_meminfo_value(buf, "Buffers:");
+    mi->cached = parse_meminfo_value(buf, "Cached:");
+    mi->swap_total = parse_meminfo_value(buf, "SwapTotal:");
+    mi->swap_free = parse_meminfo_value(buf, "SwapFree:");
+}
+
+// The old parser, asked for every field that info_parse_meminfo() fills in.
+static void
+parse_old_all(InfoMeminfo *mi, const char *buf)
+{
+    static const struct {
+        const char *name;
+        gsize offset;
+    } fields[] = {
+#define FIELD(name, field) { name ":", G_STRUCT_OFFSET(InfoMeminfo, field) }
+        FIELD("MemTotal", mem_total),
+        FIELD("MemFree", mem_free),
+        FIELD("MemAvailable", mem_available),
+        FIELD("Buffers", buffers),
+        FIELD("Cached", cached),
+        FIELD("SwapCached", swap_cached),
+        FIELD("Active", active),
+        FIELD("Inactive", inactive),
+        FIELD("Unevictable", unevictable),
+        FIELD("Mlocked", mlocked),
+        FIELD("SwapTotal", swap_total),
+        FIELD("SwapFree", swap_free),
+        FIELD("Dirty", dirty),
+        FIELD("Writeback", writeback),
+        FIELD("AnonPages", anon_pages),
+        FIELD("Mapped", mapped),
+        FIELD("Shmem", shmem),
+        FIELD("KReclaimable", kreclaimable),
+        FIELD("Slab", slab),
+        FIELD("SReclaimable", sreclaimable),
+        FIELD("SUnreclaim", sunreclaim),
+        FIELD("KernelStack", kernel_stack),
+        FIELD("PageTables", page_tables),
+        FIELD("CommitLimit", commit_limit),
+        FIELD("Committed_AS", committed_as),
+        FIELD("AnonHugePages", anon_huge_pages),
+        FIELD("HugePages_Total", huge_pages_total),
+        FIELD("HugePages_Free", huge_pages_free),
+        FIELD("HugePages_Rsvd", huge_pages_rsvd),
+        FIELD("HugePages_Surp", huge_pages_surp),
+        FIELD("Hugepagesize", hugepagesize),
+        FIELD("Hugetlb", hugetlb),
+#undef FIELD
+    };
+
+    for (guint i = 0; i < G_N_ELEMENTS(fields); i++) {
+        G_STRUCT_MEMBER(guint64, mi, fields[i].offset) =
+            parse_meminfo_value(buf, fields[i].name);
+    }
+}
+
+static gboolean
+same_values(const InfoMeminfo *a, const InfoMeminfo *b)
+{
+    return a->mem_total == b->mem_total &&
+           a->mem_free == b->mem_free &&
+           a->shmem == b->shmem &&
+           a->sreclaimable == b->sreclaimable &&
+           a->buffers == b->buffers &&
+           a->cached == b->cached &&
+           a->swap_total == b->swap_total &&
+           a->swap_free == b->swap_free;
+}
+
+// Returns the average time of one parse in nanoseconds.
+static double
+time_parser(void (*parse)(InfoMeminfo *, const char *), const char *buf)
+{
+    static volatile guint64 sink;
+    InfoMeminfo mi;
+
+    gint64 start = g_get_monotonic_time();
+    for (int i = 0; i < ITERATIONS; i++) {
+        parse(&mi, buf);
+        sink += mi.mem_free;
+    }
+    gint64 elapsed = g_get_monotonic_time() - start;
+
+    return 1e3 * (double) elapsed / ITERATIONS;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 2) {
+        g_printerr("Usage: %s FILE...\n", argv[0]);
+        return 2;
+    }
+
+    int status = 0;
+    // "old" is the old parser with the eight values manitor used to read,
+    // "old/all" is the old parser with all the values in InfoMeminfo.
+    // The speedup compares "old/all" and "new", which do the same work.
+    g_print("%-32s %8s %12s %12s %12s %9s\n",
+            "sample", "bytes", "old ns", "old/all ns", "new ns", "speedup");
+
+    for (int i = 1; i < argc; i++) {
+        char *buf = NULL;
+        gsize len = 0;
+        GError *error = NULL;
+        if (!g_file_get_contents(argv[i], &buf, &len, &error)) {
+            g_printerr("%s\n", error->message);
+            g_error_free(error);
+            status = 1;
+            continue;
+        }
+
+        InfoMeminfo old_mi = { 0 }, all_mi, new_mi;
+        parse_old(&old_mi, buf);
+        parse_old_all(&all_mi, buf);
+        info_parse_meminfo(&new_mi, buf);
+        if (!same_values(&old_mi, &new_mi) || memcmp(&all_mi, &new_mi, sizeof(new_mi)) != 0) {
+            g_printerr("%s: the parsers disagree\n", argv[i]);
+            status = 1;
+        }
+
+        double old_ns = time_parser(parse_old, buf);
+        double all_ns = time_parser(parse_old_all, buf);
+        double new_ns = time_parser(info_parse_meminfo, buf);
+        g_print("%-32s %8" G_GSIZE_FORMAT " %12.1f %12.1f %12.1f %8.1fx\n",
+                argv[i], len, old_ns, all_ns, new_ns, all_ns / new_ns);
+
+        g_free(buf);
+    }
+
+    return status;
+}
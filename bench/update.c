@@ -0,0 +1,359 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ *
+ * Times info_update() over copies of /proc, and counts the allocations it
+ * makes, so that regressions in the collectors show up. After the first few
+ * updates, an update must not allocate at all: the exit status is 1 if one
+ * does. Each root is done twice: reading the files with io_uring (if the
+ * kernel allows it) and with pread(), and the system calls are counted too.
+ *
+ * Usage: update-bench [-v] [--synthetic] ROOT...
+ * Each ROOT is a directory with proc/stat, proc/meminfo, proc/uptime,
+ * proc/diskstats, proc/pressure/* and proc/self/mountinfo in it (see
+ * bench/data/root-*). --synthetic adds trees
+ * made up on the spot: a 1024-CPU /proc/stat, a huge /proc/meminfo and a lot
+ * of mounts. -v prints the time of each collector too.
+ */
+#define _GNU_SOURCE // For RTLD_NEXT etc. with -std=c99.
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../prof.h"
+#include "../info.h"
+#include "allocs.h"
+
+#define ITERATIONS 2000
+#define WARMUP 10       // Updates that may still allocate (buffers grow).
+
+// The system calls are counted by wrapping the libc functions that info.c
+// (and GLib, for futexes) makes them through. Calls that libc makes
+// internally, e.g. for fopen(), are not seen.
+static gint syscalls;
+
+int
+open(const char *path, int flags, ...)
+{
+    static int (*real)(const char *, int, ...);
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = (flags & O_CREAT) ? va_arg(ap, mode_t) : 0;
+    va_end(ap);
+    g_atomic_int_inc(&syscalls);
+    if (!real) {
+        *(void **) &real = dlsym(RTLD_NEXT, "open");
+    }
+    return real(path, flags, mode);
+}
+
+int
+openat(int dir, const char *path, int flags, ...)
+{
+    static int (*real)(int, const char *, int, ...);
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = (flags & O_CREAT) ? va_arg(ap, mode_t) : 0;
+    va_end(ap);
+    g_atomic_int_inc(&syscalls);
+    if (!real) {
+        *(void **) &real = dlsym(RTLD_NEXT, "openat");
+    }
+    return real(dir, path, flags, mode);
+}
+
+int
+close(int fd)
+{
+    static int (*real)(int);
+    g_atomic_int_inc(&syscalls);
+    if (!real) {
+        *(void **) &real = dlsym(RTLD_NEXT, "close");
+    }
+    return real(fd);
+}
+
+ssize_t
+read(int fd, void *buf, size_t count)
+{
+    static ssize_t (*real)(int, void *, size_t);
+    g_atomic_int_inc(&syscalls);
+    if (!real) {
+        *(void **) &real = dlsym(RTLD_NEXT, "read");
+    }
+    return real(fd, buf, count);
+}
+
+ssize_t
+pread(int fd, void *buf, size_t count, off_t offset)
+{
+    static ssize_t (*real)(int, void *, size_t, off_t);
+    g_atomic_int_inc(&syscalls);
+    if (!real) {
+        *(void **) &real = dlsym(RTLD_NEXT, "pread");
+    }
+    return real(fd, buf, count, offset);
+}
+
+ssize_t
+sendto(int fd, const void *buf, size_t len, int flags,
+       const struct sockaddr *addr, socklen_t addrlen)
+{
+    static ssize_t (*real)(int, const void *, size_t, int, const struct sockaddr *, socklen_t);
+    g_atomic_int_inc(&syscalls);
+    if (!real) {
+        *(void **) &real = dlsym(RTLD_NEXT, "sendto");
+    }
+    return real(fd, buf, len, flags, addr, addrlen);
+}
+
+ssize_t
+recv(int fd, void *buf, size_t len, int flags)
+{
+    static ssize_t (*real)(int, void *, size_t, int);
+    g_atomic_int_inc(&syscalls);
+    if (!real) {
+        *(void **) &real = dlsym(RTLD_NEXT, "recv");
+    }
+    return real(fd, buf, len, flags);
+}
+
+int
+poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    static int (*real)(struct pollfd *, nfds_t, int);
+    g_atomic_int_inc(&syscalls);
+    if (!real) {
+        *(void **) &real = dlsym(RTLD_NEXT, "poll");
+    }
+    return real(fds, nfds, timeout);
+}
+
+// io_uring, and the futexes of GLib. No system call takes more than six
+// arguments, and passing unused ones is harmless.
+long
+syscall(long number, ...)
+{
+    static long (*real)(long, ...);
+    va_list ap;
+    va_start(ap, number);
+    long a[6];
+    for (int i = 0; i < 6; i++) {
+        a[i] = va_arg(ap, long);
+    }
+    va_end(ap);
+    g_atomic_int_inc(&syscalls);
+    if (!real) {
+        *(void **) &real = dlsym(RTLD_NEXT, "syscall");
+    }
+    return real(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+// Writes contents to file under root, creating the directories on the way.
+static void
+write_file(const char *root, const char *file, const GString *contents)
+{
+    char *path = g_build_filename(root, file, NULL);
+    char *dir = g_path_get_dirname(path);
+    GError *error = NULL;
+
+    g_mkdir_with_parents(dir, 0755);
+    if (!g_file_set_contents(path, contents->str, contents->len, &error)) {
+        g_error("%s", error->message);
+    }
+    g_free(dir);
+    g_free(path);
+}
+
+// Removes path, and everything in it if it is a directory.
+static void
+remove_tree(const char *path)
+{
+    GDir *dir = g_dir_open(path, 0, NULL);
+    if (dir) {
+        const char *name;
+        while ((name = g_dir_read_name(dir))) {
+            char *child = g_build_filename(path, name, NULL);
+            remove_tree(child);
+            g_free(child);
+        }
+        g_dir_close(dir);
+    }
+    g_remove(path);
+}
+
+// Makes up a tree under dir/name with ncpu CPUs, extra lines in meminfo on
+// top of the usual ones, and nmounts ext4 mounts. Returns the root.
+static char *
+make_tree(const char *dir, const char *name, int ncpu, int extra, int nmounts)
+{
+    char *root = g_build_filename(dir, name, NULL);
+    GString *s = g_string_new(NULL);
+
+    g_string_append(s, "cpu  1000000 2000 300000 40000000 5000 0 6000 0 0 0\n");
+    for (int i = 0; i < ncpu; i++) {
+        g_string_append_printf(s, "cpu%d %d 20 %d %d 50 0 60 0 0 0\n",
+                               i, 10000 + 37 * i, 3000 + 11 * i, 400000 + 101 * i);
+    }
+    g_string_append(s, "intr 123456789 0 9 0 0 0 0 0 0 1 0 0 0 156 0 0 0\n"
+                       "ctxt 987654321\nbtime 1700000000\nprocesses 123456\n"
+                       "procs_running 3\nprocs_blocked 0\nsoftirq 1234 0 1 2 3 4 5 6 7 8 9\n");
+    write_file(root, "proc/stat", s);
+
+    g_string_assign(s, "MemTotal:       32768000 kB\nMemFree:         1234567 kB\n"
+                       "MemAvailable:   20000000 kB\nBuffers:          456789 kB\n"
+                       "Cached:         12345678 kB\nSwapCached:          1234 kB\n"
+                       "Shmem:            567890 kB\nSReclaimable:     678901 kB\n"
+                       "SwapTotal:       8388604 kB\nSwapFree:        8000000 kB\n");
+    for (int i = 0; i < extra; i++) {
+        g_string_append_printf(s, "Extra%d_%s: %15d kB\n", i, (i % 3) ? "Pages" : "Cache", 7 * i);
+    }
+    g_string_append(s, "HugePages_Total:       0\nHugepagesize:       2048 kB\n");
+    write_file(root, "proc/meminfo", s);
+
+    g_string_assign(s, "123456.78 987654.32\n");
+    write_file(root, "proc/uptime", s);
+
+    g_string_assign(s, "22 1 8:1 / / rw,relatime shared:1 - ext4 /dev/sda1 rw\n");
+    for (int i = 0; i < nmounts; i++) {
+        g_string_append_printf(s, "%d 22 8:%d / /srv/vol%d rw,relatime shared:%d - ext4 "
+                               "/dev/sd%c%d rw\n", 100 + i, 16 + i, i, 2 + i,
+                               'b' + i / 100 % 24, i % 100);
+    }
+    write_file(root, "proc/self/mountinfo", s);
+
+    g_string_assign(s, "   8       1 sda1 412087 121735 38451228 84120 1987456 1203442 "
+                       "96127864 2011873 0 1023580 2291017 0 0 0 0 120114 195023\n");
+    for (int i = 0; i < nmounts; i++) {
+        g_string_append_printf(s, "   8 %7d sd%c%d %d 0 %d 20 %d 0 %d 30 0 40 50 0 0 0 0 0 0\n",
+                               16 + i, 'b' + i / 100 % 24, i % 100,
+                               100 + i, 800 + 8 * i, 200 + i, 1600 + 8 * i);
+    }
+    write_file(root, "proc/diskstats", s);
+
+    static const char *pressure[] = { "proc/pressure/cpu", "proc/pressure/memory",
+                                      "proc/pressure/io" };
+    for (guint i = 0; i < G_N_ELEMENTS(pressure); i++) {
+        g_string_assign(s, "some avg10=1.23 avg60=0.45 avg300=0.06 total=12345678\n"
+                           "full avg10=0.00 avg60=0.12 avg300=0.03 total=2345678\n");
+        write_file(root, pressure[i], s);
+    }
+
+    g_string_free(s, TRUE);
+    return root;
+}
+
+// Runs the updates on root, reading with io_uring or not, and prints the
+// results. Returns FALSE if the updates after the warmup allocated.
+static gboolean
+bench_root(const char *root, gboolean uring, gboolean verbose)
+{
+    Info *info = info_new("lo", root);
+    if (info_set_io_uring(info, uring) != uring) {
+        g_print("%-32s %-8s (not available)\n", root, "io_uring");
+        info_free(info);
+        return TRUE;
+    }
+    Prof *prof = verbose ? info_enable_prof(info) : NULL;
+
+    // The first update reads the mount table and sets everything up.
+    gint64 start = g_get_monotonic_time();
+    int a = allocs_get();
+    info_update(info);
+    double first_ns = 1e3 * (g_get_monotonic_time() - start);
+    int first_allocs = allocs_get() - a;
+    for (int i = 1; i < WARMUP; i++) {
+        info_update(info);
+    }
+
+    start = g_get_monotonic_time();
+    a = allocs_get();
+    int s = g_atomic_int_get(&syscalls);
+    for (int i = 0; i < ITERATIONS; i++) {
+        info_update(info);
+    }
+    double ns = 1e3 * (g_get_monotonic_time() - start) / ITERATIONS;
+    int steady_allocs = allocs_get() - a;
+    double per_update = (double) (g_atomic_int_get(&syscalls) - s) / ITERATIONS;
+
+    InfoSnapshot *snap = info_acquire(info);
+    GPtrArray *mounts = info_get_mounts(snap);
+    g_print("%-32s %-8s %5d %6u %12.0f %8d %12.0f %10.1f %9.1f\n",
+            root, uring ? "io_uring" : "pread", info_get_cpu_count(snap),
+            mounts ? mounts->len : 0, first_ns, first_allocs, ns,
+            (double) steady_allocs / ITERATIONS, per_update);
+
+    if (prof) {
+        GString *str = g_string_new(NULL);
+        prof_format(prof, str, FALSE);
+        g_print("%s\n", str->str);
+        g_string_free(str, TRUE);
+    }
+    info_free(info);
+
+    if (steady_allocs > 0) {
+        g_printerr("%s: %d allocations in %d updates, expected none\n",
+                   root, steady_allocs, ITERATIONS);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+int
+main(int argc, char **argv)
+{
+    gboolean verbose = FALSE;
+    gboolean synthetic = FALSE;
+    GPtrArray *roots = g_ptr_array_new_with_free_func(g_free);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            verbose = TRUE;
+        } else if (strcmp(argv[i], "--synthetic") == 0) {
+            synthetic = TRUE;
+        } else {
+            g_ptr_array_add(roots, g_strdup(argv[i]));
+        }
+    }
+
+    char *tmp = NULL;
+    if (synthetic) {
+        GError *error = NULL;
+        tmp = g_dir_make_tmp("manitor-bench-XXXXXX", &error);
+        if (!tmp) {
+            g_error("%s", error->message);
+        }
+        g_ptr_array_add(roots, make_tree(tmp, "cpu-1024", 1024, 0, 8));
+        g_ptr_array_add(roots, make_tree(tmp, "meminfo-huge", 8, 20000, 8));
+        g_ptr_array_add(roots, make_tree(tmp, "mounts-2000", 8, 0, 2000));
+    }
+
+    if (roots->len == 0) {
+        g_printerr("Usage: %s [-v] [--synthetic] ROOT...\n", argv[0]);
+        return 2;
+    }
+
+    // "first" is the first update, the rest are per update after the warmup.
+    g_print("%-32s %-8s %5s %6s %12s %8s %12s %10s %9s\n", "root", "reads",
+            "cpus", "mounts", "first ns", "allocs", "ns/update", "allocs/upd", "sys/upd");
+    gboolean ok = TRUE;
+    for (guint i = 0; i < roots->len; i++) {
+        ok &= bench_root(roots->pdata[i], TRUE, verbose);
+        ok &= bench_root(roots->pdata[i], FALSE, verbose);
+    }
+
+    if (tmp) {
+        remove_tree(tmp);
+        g_free(tmp);
+    }
+    g_ptr_array_free(roots, TRUE);
+    return ok ? 0 : 1;
+}
@@ -17,8 +17,8 @@
 // The default font to use (a Pango font specification).
 #define CONF_FONT "Roboto Condensed, 16px"
 
-// How to format the time? See g_date_time_format(), which uses a format
-// similar to strftime(3). The string must be a Pango marked-up text.
+// How to format the time? See strftime(3). The string must be a Pango
+// marked-up text.
 #define CONF_CLOCK_FORMAT "<span font='Roboto ultralight 120px'>%-H:%M</span>"
 
 // The default foreground color.
@@ -27,6 +27,10 @@
 // Alarm color -- see Alarms below for an explanation.
 #define CONF_ALARM_COLOR "#dc322f"
 
+// The color of the time stolen by the hypervisor, at the end of the CPU
+// rings.
+#define CONF_STEAL_COLOR "#b58900"
+
 // Background color -- only used by the clock right now.
 #define CONF_SHADE_COLOR "rgba(0, 0, 0, 0.25)"
 
@@ -37,7 +41,57 @@
 #define CONF_MEM_ALARM 0.67
 #define CONF_SWAP_ALARM 0.05
 
-// The update interval, in integer seconds.
-#define CONF_INTERVAL 1
+// Pressure -- how much of the time tasks stall waiting for the CPU, memory
+// or I/O, as the kernel tracks it (see /proc/pressure). A resource is shown
+// in the alarm color, and so is its ring, when some tasks have stalled for
+// CONF_PRESSURE_STALL ms within CONF_PRESSURE_WINDOW ms, which the kernel
+// reports right away (0 disables this), or when the 10 s average of the
+// stalls reaches CONF_PRESSURE_ALARM (a fraction, 0 to disable).
+// CONF_PRESSURE_CGROUP is a cgroup to watch rather than the whole system (a
+// path under /sys/fs/cgroup, e.g. "user.slice"), or NULL.
+#define CONF_PRESSURE_STALL 150
+#define CONF_PRESSURE_WINDOW 1000
+#define CONF_PRESSURE_ALARM 0.10
+#define CONF_PRESSURE_CGROUP NULL
+
+// How far back the history graphs (above the rings and the network speeds,
+// and under each mount) go, in seconds.
+// 0 disables them.
+#define CONF_HISTORY 600
+
+// How many of the busiest processes to show. 0 disables the list.
+#define CONF_TOP_PROCS 5
+
+// How many of the busiest cgroups to show, and the subtree to look for them
+// in (a path under /sys/fs/cgroup, e.g. "system.slice", or "" for all of
+// them; "unified" on systems that still mount cgroup v1). 0 disables the
+// list.
+#define CONF_TOP_CGROUPS 3
+#define CONF_CGROUPS_SUBTREE ""
+
+// The socket that manitor --headless serves the values on, in
+// $XDG_RUNTIME_DIR (see export.h).
+#define CONF_SOCKET "manitor.sock"
+
+// Where to record the samples, in $XDG_DATA_HOME (see record.h). "" does
+// not record them.
+#define CONF_RECORD_DIR "manitor/recordings"
+
+// How many segments of recording (an hour each, at most) to keep.
+#define CONF_RECORD_SEGMENTS 168
+
+// How often to sample each metric, in milliseconds. Metrics that fall due
+// at the same time are sampled together, and the display is updated after
+// every sample.
+#define CONF_CPU_PERIOD 250
+#define CONF_NET_PERIOD 250
+#define CONF_PROCS_PERIOD 1000
+#define CONF_MEM_PERIOD 1000
+#define CONF_MOUNTS_PERIOD 30000    // Changes to the list of mounts.
+#define CONF_FS_PERIOD 30000        // The free space.
+#define CONF_UPTIME_PERIOD 60000
+#define CONF_DISKS_PERIOD 1000      // The I/O of the disks of the mounts.
+#define CONF_PRESSURE_PERIOD 1000   // The averages (triggers fire right away).
+#define CONF_CGROUPS_PERIOD 2000
 
 #endif // #ifndef MANITOR_CONF_H
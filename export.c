@@ -0,0 +1,751 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ */
+#include <gio/gio.h>
+#include <gio/gunixmounts.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "prof.h"
+#include "info.h"
+#include "export.h"
+
+// The longest request taken (the request line and the headers).
+#define REQUEST_SIZE 2048
+
+// Drop clients that do not send or receive anything for this long (s).
+#define CLIENT_TIMEOUT 10
+
+#define TEXT_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+#define FRAME_CONTENT_TYPE "application/octet-stream"
+
+#define HTTP_RESPONSE(status) \
+    "HTTP/1.1 " status "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+
+struct Exporter {
+    char *path;                 // The socket.
+    GSocketService *service;    // Accepts the clients.
+    GCancellable *cancellable;  // Cancelled by exporter_free().
+    GString *text;              // For formatting the metrics.
+    GByteArray *frame;          // For formatting the frame.
+    struct Reply *text_reply;   // The responses, with the HTTP headers
+    struct Reply *frame_reply;  // (NULL: no snapshot yet).
+};
+
+// A response with its HTTP headers. The clients sending it hold references,
+// and exporter_update() formats the next one in place when nobody else does.
+// Only used on the main context.
+struct Reply {
+    int ref_count;
+    GString *data;
+};
+
+// A connection being served.
+struct Client {
+    GSocketConnection *conn;
+    GCancellable *cancellable;  // The one of the Exporter.
+    char request[REQUEST_SIZE]; // What has been read of the request.
+    gsize len;                  //
+    struct Reply *reply;        // What is being sent (NULL: a static reply).
+};
+
+// The fields of InfoMeminfo, in order.
+static const struct {
+    const char *name;   // The name in /proc/meminfo.
+    gboolean pages;     // A page count rather than bytes?
+} meminfo_fields[] = {
+    { "MemTotal" }, { "MemFree" }, { "MemAvailable" }, { "Buffers" },
+    { "Cached" }, { "SwapCached" }, { "Active" }, { "Inactive" },
+    { "Unevictable" }, { "Mlocked" }, { "SwapTotal" }, { "SwapFree" },
+    { "Dirty" }, { "Writeback" }, { "AnonPages" }, { "Mapped" },
+    { "Shmem" }, { "KReclaimable" }, { "Slab" }, { "SReclaimable" },
+    { "SUnreclaim" }, { "KernelStack" }, { "PageTables" }, { "CommitLimit" },
+    { "Committed_AS" }, { "AnonHugePages" }, { "HugePages_Total", TRUE },
+    { "HugePages_Free", TRUE }, { "HugePages_Rsvd", TRUE }, { "HugePages_Surp", TRUE },
+    { "Hugepagesize" }, { "Hugetlb" },
+};
+G_STATIC_ASSERT(G_N_ELEMENTS(meminfo_fields) * sizeof(guint64) == sizeof(InfoMeminfo));
+
+static const char *cpu_states[INFO_CPU_STATES] = {
+    "user", "nice", "system", "idle", "iowait",
+    "irq", "softirq", "steal", "guest", "guest_nice",
+};
+
+// The Prometheus text format. This runs on every update, so it does not
+// allocate once out has grown (g_string_append_printf() would).
+
+// Appends the HELP and TYPE lines of a metric.
+static void
+append_family(GString *out, const char *name, const char *type, const char *help)
+{
+    g_string_append(out, "# HELP ");
+    g_string_append(out, name);
+    g_string_append_c(out, ' ');
+    g_string_append(out, help);
+    g_string_append(out, "\n# TYPE ");
+    g_string_append(out, name);
+    g_string_append_c(out, ' ');
+    g_string_append(out, type);
+    g_string_append_c(out, '\n');
+}
+
+// Appends a label value, escaped.
+static void
+append_label_value(GString *out, const char *value)
+{
+    for (const char *p = value; *p; p++) {
+        switch (*p) {
+        case '\\': g_string_append(out, "\\\\"); break;
+        case '"':  g_string_append(out, "\\\""); break;
+        case '\n': g_string_append(out, "\\n"); break;
+        default:   g_string_append_c(out, *p);
+        }
+    }
+}
+
+// Appends the name of a sample with up to two labels (k1, k2 NULL: none),
+// and the space before the value.
+static void
+append_name(GString *out, const char *name,
+            const char *k1, const char *v1, const char *k2, const char *v2)
+{
+    g_string_append(out, name);
+    if (k1) {
+        g_string_append_c(out, '{');
+        g_string_append(out, k1);
+        g_string_append(out, "=\"");
+        append_label_value(out, v1);
+        if (k2) {
+            g_string_append(out, "\",");
+            g_string_append(out, k2);
+            g_string_append(out, "=\"");
+            append_label_value(out, v2);
+        }
+        g_string_append(out, "\"}");
+    }
+    g_string_append_c(out, ' ');
+}
+
+static void
+append_sample(GString *out, const char *name,
+              const char *k1, const char *v1, const char *k2, const char *v2, double value)
+{
+    append_name(out, name, k1, v1, k2, v2);
+    if (isnan(value)) {
+        g_string_append(out, "NaN\n");
+    } else if (isinf(value)) {
+        g_string_append(out, value > 0 ? "+Inf\n" : "-Inf\n");
+    } else {
+        // Not printf(): the locale could use a decimal comma.
+        char buf[G_ASCII_DTOSTR_BUF_SIZE];
+        g_string_append(out, g_ascii_formatd(buf, sizeof(buf), "%.15g", value));
+        g_string_append_c(out, '\n');
+    }
+}
+
+static void
+append_sample_u64(GString *out, const char *name,
+                  const char *k1, const char *v1, const char *k2, const char *v2, guint64 value)
+{
+    char buf[32];
+    append_name(out, name, k1, v1, k2, v2);
+    g_snprintf(buf, sizeof(buf), "%" G_GUINT64_FORMAT "\n", value);
+    g_string_append(out, buf);
+}
+
+void
+exporter_format_text(GString *out, InfoSnapshot *snap)
+{
+    char name[64];
+    char label[32];
+
+    gint64 time = info_get_time(snap);
+    if (time) {
+        append_family(out, "manitor_sample_time_seconds", "gauge",
+                      "When the latest sample was taken (seconds since the epoch).");
+        append_sample(out, "manitor_sample_time_seconds", NULL, NULL, NULL, NULL,
+                      time / 1e6);
+    }
+    append_family(out, "manitor_uptime_seconds", "gauge", "The system uptime.");
+    append_sample_u64(out, "manitor_uptime_seconds", NULL, NULL, NULL, NULL,
+                      info_get_uptime(snap));
+
+    // CPU
+    int ncpu = info_get_cpu_count(snap);
+    append_family(out, "manitor_cpu_usage_ratio", "gauge",
+                  "The part of the time a CPU was not idle or waiting for I/O.");
+    for (int i = 0; i < ncpu; i++) {
+        g_snprintf(label, sizeof(label), "%d", i);
+        append_sample(out, "manitor_cpu_usage_ratio", "cpu", label, NULL, NULL,
+                      info_get_cpu_usage(snap, i));
+    }
+    double times[INFO_CPU_STATES];
+    if (info_get_cpu_times(snap, -1, times)) {
+        append_family(out, "manitor_cpu_time_ratio", "gauge",
+                      "Where the time of all the CPUs together went.");
+        for (int i = 0; i < INFO_CPU_STATES; i++) {
+            append_sample(out, "manitor_cpu_time_ratio", "state", cpu_states[i], NULL, NULL,
+                          times[i]);
+        }
+    }
+    append_family(out, "manitor_context_switches_per_second", "gauge",
+                  "The context switch rate.");
+    append_sample(out, "manitor_context_switches_per_second", NULL, NULL, NULL, NULL,
+                  info_get_ctxt_rate(snap));
+    append_family(out, "manitor_interrupts_per_second", "gauge", "The interrupt rate.");
+    append_sample(out, "manitor_interrupts_per_second", NULL, NULL, NULL, NULL,
+                  info_get_intr_rate(snap));
+    append_family(out, "manitor_procs_running", "gauge", "The number of runnable tasks.");
+    append_sample_u64(out, "manitor_procs_running", NULL, NULL, NULL, NULL,
+                      info_get_procs_running(snap));
+    append_family(out, "manitor_procs_blocked", "gauge",
+                  "The number of tasks blocked waiting for I/O.");
+    append_sample_u64(out, "manitor_procs_blocked", NULL, NULL, NULL, NULL,
+                      info_get_procs_blocked(snap));
+
+    // Memory
+    append_family(out, "manitor_memory_usage_ratio", "gauge", "The part of the memory used.");
+    append_sample(out, "manitor_memory_usage_ratio", NULL, NULL, NULL, NULL,
+                  info_get_mem(snap));
+    append_family(out, "manitor_swap_usage_ratio", "gauge", "The part of the swap used.");
+    append_sample(out, "manitor_swap_usage_ratio", NULL, NULL, NULL, NULL,
+                  info_get_swap(snap));
+    const guint64 *meminfo = (const guint64 *) info_get_meminfo(snap);
+    for (guint i = 0; i < G_N_ELEMENTS(meminfo_fields); i++) {
+        g_snprintf(name, sizeof(name), "manitor_memory_%s%s", meminfo_fields[i].name,
+                   meminfo_fields[i].pages ? "" : "_bytes");
+        append_family(out, name, "gauge", "From /proc/meminfo.");
+        append_sample_u64(out, name, NULL, NULL, NULL, NULL, meminfo[i]);
+    }
+
+    // Pressure
+    static const char *resources[INFO_PRESSURES] = { "cpu", "memory", "io" };
+    InfoPressure pressure[INFO_PRESSURES];
+    gboolean known[INFO_PRESSURES];
+    for (int i = 0; i < INFO_PRESSURES; i++) {
+        known[i] = info_get_pressure(snap, i, &pressure[i]);
+    }
+    append_family(out, "manitor_pressure_some_ratio", "gauge",
+                  "The part of the last 10 s some tasks stalled waiting for a resource.");
+    for (int i = 0; i < INFO_PRESSURES; i++) {
+        if (known[i]) {
+            append_sample(out, "manitor_pressure_some_ratio", "resource", resources[i],
+                          NULL, NULL, pressure[i].some);
+        }
+    }
+    append_family(out, "manitor_pressure_full_ratio", "gauge",
+                  "The part of the last 10 s all non-idle tasks stalled at once.");
+    for (int i = 0; i < INFO_PRESSURES; i++) {
+        if (known[i]) {
+            append_sample(out, "manitor_pressure_full_ratio", "resource", resources[i],
+                          NULL, NULL, pressure[i].full);
+        }
+    }
+    append_family(out, "manitor_pressure_stalled", "gauge",
+                  "1 if the PSI trigger of a resource fired within its window.");
+    for (int i = 0; i < INFO_PRESSURES; i++) {
+        if (known[i]) {
+            append_sample_u64(out, "manitor_pressure_stalled", "resource", resources[i],
+                              NULL, NULL, pressure[i].stalled);
+        }
+    }
+
+    // Network
+    static const struct {
+        const char *name;
+        const char *help;
+        gsize offset;
+    } net_counters[] = {
+#define COUNTER(name, field, help) \
+        { "manitor_network_" name "_total", help, G_STRUCT_OFFSET(InfoNetIface, field) }
+        COUNTER("receive_bytes", rx_bytes, "The bytes received."),
+        COUNTER("transmit_bytes", tx_bytes, "The bytes sent."),
+        COUNTER("receive_packets", rx_packets, "The packets received."),
+        COUNTER("transmit_packets", tx_packets, "The packets sent."),
+        COUNTER("receive_errors", rx_errors, "The bad packets received."),
+        COUNTER("transmit_errors", tx_errors, "The packets that could not be sent."),
+        COUNTER("receive_dropped", rx_dropped, "The packets received and dropped."),
+        COUNTER("transmit_dropped", tx_dropped, "The packets dropped before sending."),
+#undef COUNTER
+    };
+    guint nnet = info_get_net_count(snap);
+    for (guint i = 0; i < G_N_ELEMENTS(net_counters); i++) {
+        append_family(out, net_counters[i].name, "counter", net_counters[i].help);
+        for (guint j = 0; j < nnet; j++) {
+            const InfoNetIface *iface = info_get_net_iface(snap, j);
+            append_sample_u64(out, net_counters[i].name, "device", iface->name, NULL, NULL,
+                              G_STRUCT_MEMBER(guint64, iface, net_counters[i].offset));
+        }
+    }
+    append_family(out, "manitor_network_receive_bytes_per_second", "gauge",
+                  "The receive speed.");
+    for (guint i = 0; i < nnet; i++) {
+        const InfoNetIface *iface = info_get_net_iface(snap, i);
+        append_sample(out, "manitor_network_receive_bytes_per_second",
+                      "device", iface->name, NULL, NULL, iface->rxspeed);
+    }
+    append_family(out, "manitor_network_transmit_bytes_per_second", "gauge",
+                  "The transmit speed.");
+    for (guint i = 0; i < nnet; i++) {
+        const InfoNetIface *iface = info_get_net_iface(snap, i);
+        append_sample(out, "manitor_network_transmit_bytes_per_second",
+                      "device", iface->name, NULL, NULL, iface->txspeed);
+    }
+
+    // Filesystems
+    GPtrArray *mounts = info_get_mounts(snap);
+    if (mounts) {
+        append_family(out, "manitor_filesystem_free_bytes", "gauge",
+                      "The free space, as of the last successful sample.");
+        for (guint i = 0; i < mounts->len; i++) {
+            const char *path = g_unix_mount_get_mount_path(mounts->pdata[i]);
+            append_sample_u64(out, "manitor_filesystem_free_bytes", "mountpoint", path,
+                              NULL, NULL, info_get_fs_free(snap, path));
+        }
+        append_family(out, "manitor_filesystem_stale", "gauge",
+                      "1 if the free space is not known or out of date.");
+        for (guint i = 0; i < mounts->len; i++) {
+            const char *path = g_unix_mount_get_mount_path(mounts->pdata[i]);
+            append_sample_u64(out, "manitor_filesystem_stale", "mountpoint", path,
+                              NULL, NULL, info_get_fs_stale(snap, path));
+        }
+
+        // The I/O of the device under each mount, where it is known.
+        static const struct {
+            const char *name;
+            const char *help;
+            gsize offset;
+        } disk_rates[] = {
+#define RATE(name, field, help) \
+            { "manitor_filesystem_" name, help, G_STRUCT_OFFSET(InfoDiskIO, field) }
+            RATE("read_bytes_per_second", read_bytes, "The bytes read from the device."),
+            RATE("written_bytes_per_second", write_bytes, "The bytes written to the device."),
+            RATE("reads_per_second", read_iops, "The reads completed by the device."),
+            RATE("writes_per_second", write_iops, "The writes completed by the device."),
+            RATE("disk_busy_ratio", util, "The part of the time the busiest disk was busy."),
+            RATE("await_milliseconds", await, "The average time a read or write took."),
+#undef RATE
+        };
+        for (guint i = 0; i < G_N_ELEMENTS(disk_rates); i++) {
+            append_family(out, disk_rates[i].name, "gauge", disk_rates[i].help);
+            for (guint j = 0; j < mounts->len; j++) {
+                const char *path = g_unix_mount_get_mount_path(mounts->pdata[j]);
+                InfoDiskIO io;
+                if (info_get_disk_io(snap, path, &io)) {
+                    append_sample(out, disk_rates[i].name, "mountpoint", path, NULL, NULL,
+                                  G_STRUCT_MEMBER(double, &io, disk_rates[i].offset));
+                }
+            }
+        }
+    }
+
+    // Processes
+    append_family(out, "manitor_processes", "gauge", "The number of processes.");
+    append_sample_u64(out, "manitor_processes", NULL, NULL, NULL, NULL,
+                      info_get_proc_count(snap));
+    guint ntop = info_get_top_count(snap);
+    append_family(out, "manitor_process_cpu_usage", "gauge",
+                  "The CPU usage of the busiest processes, in CPUs.");
+    for (guint i = 0; i < ntop; i++) {
+        const InfoProc *proc = info_get_top_proc(snap, i);
+        g_snprintf(label, sizeof(label), "%d", proc->pid);
+        append_sample(out, "manitor_process_cpu_usage", "pid", label, "name", proc->name,
+                      proc->cpu);
+    }
+    append_family(out, "manitor_process_resident_bytes", "gauge",
+                  "The resident memory of the busiest processes.");
+    for (guint i = 0; i < ntop; i++) {
+        const InfoProc *proc = info_get_top_proc(snap, i);
+        g_snprintf(label, sizeof(label), "%d", proc->pid);
+        append_sample_u64(out, "manitor_process_resident_bytes", "pid", label,
+                          "name", proc->name, proc->rss);
+    }
+
+    // Cgroups
+    append_family(out, "manitor_cgroups", "gauge", "The number of cgroups watched.");
+    append_sample_u64(out, "manitor_cgroups", NULL, NULL, NULL, NULL,
+                      info_get_cgroup_count(snap));
+    static const struct {
+        const char *name;
+        const char *help;
+        gsize offset;
+    } cgroup_rates[] = {
+#define RATE(name, field, help) \
+        { "manitor_cgroup_" name, help, G_STRUCT_OFFSET(InfoCgroup, field) }
+        RATE("cpu_usage", cpu, "The CPU usage of the busiest cgroups, in CPUs."),
+        RATE("read_bytes_per_second", read_bytes, "The bytes the busiest cgroups read."),
+        RATE("written_bytes_per_second", write_bytes, "The bytes the busiest cgroups wrote."),
+#undef RATE
+    };
+    guint ncgroups = info_get_top_cgroup_count(snap);
+    for (guint i = 0; i < G_N_ELEMENTS(cgroup_rates); i++) {
+        append_family(out, cgroup_rates[i].name, "gauge", cgroup_rates[i].help);
+        for (guint j = 0; j < ncgroups; j++) {
+            const InfoCgroup *cg = info_get_top_cgroup(snap, j);
+            append_sample(out, cgroup_rates[i].name, "cgroup", cg->path, NULL, NULL,
+                          G_STRUCT_MEMBER(double, cg, cgroup_rates[i].offset));
+        }
+    }
+    append_family(out, "manitor_cgroup_memory_bytes", "gauge",
+                  "The memory the busiest cgroups use.");
+    for (guint i = 0; i < ncgroups; i++) {
+        const InfoCgroup *cg = info_get_top_cgroup(snap, i);
+        append_sample_u64(out, "manitor_cgroup_memory_bytes", "cgroup", cg->path,
+                          NULL, NULL, cg->memory);
+    }
+    append_family(out, "manitor_cgroup_memory_max_bytes", "gauge",
+                  "The memory limit of the busiest cgroups (+Inf: none).");
+    for (guint i = 0; i < ncgroups; i++) {
+        const InfoCgroup *cg = info_get_top_cgroup(snap, i);
+        append_sample(out, "manitor_cgroup_memory_max_bytes", "cgroup", cg->path, NULL, NULL,
+                      cg->memory_max == G_MAXUINT64 ? INFINITY : (double) cg->memory_max);
+    }
+}
+
+// The binary frame
+
+static void
+put_u32(GByteArray *out, guint32 value)
+{
+    value = GUINT32_TO_LE(value);
+    g_byte_array_append(out, (const guint8 *) &value, sizeof(value));
+}
+
+static void
+put_u64(GByteArray *out, guint64 value)
+{
+    value = GUINT64_TO_LE(value);
+    g_byte_array_append(out, (const guint8 *) &value, sizeof(value));
+}
+
+static void
+put_f64(GByteArray *out, double value)
+{
+    guint64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_u64(out, bits);
+}
+
+// Appends name, NUL-padded to 16 bytes.
+static void
+put_name(GByteArray *out, const char *name)
+{
+    char buf[16] = { 0 };
+    g_strlcpy(buf, name, sizeof(buf));
+    g_byte_array_append(out, (const guint8 *) buf, sizeof(buf));
+}
+
+void
+exporter_format_frame(GByteArray *out, InfoSnapshot *snap)
+{
+    guint start = out->len;
+
+    put_u32(out, EXPORT_FRAME_MAGIC);
+    put_u32(out, EXPORT_FRAME_VERSION);
+    put_u32(out, 0);    // The length, see below.
+    put_u32(out, 0);
+
+    put_u64(out, info_get_time(snap));
+    put_u64(out, info_get_uptime(snap));
+
+    const guint64 *meminfo = (const guint64 *) info_get_meminfo(snap);
+    for (guint i = 0; i < G_N_ELEMENTS(meminfo_fields); i++) {
+        put_u64(out, meminfo[i]);
+    }
+    put_f64(out, info_get_mem(snap));
+    put_f64(out, info_get_swap(snap));
+
+    double times[INFO_CPU_STATES] = { 0 };
+    info_get_cpu_times(snap, -1, times);
+    for (int i = 0; i < INFO_CPU_STATES; i++) {
+        put_f64(out, times[i]);
+    }
+    put_f64(out, info_get_ctxt_rate(snap));
+    put_f64(out, info_get_intr_rate(snap));
+    put_u32(out, info_get_procs_running(snap));
+    put_u32(out, info_get_procs_blocked(snap));
+    put_u32(out, info_get_proc_count(snap));
+
+    int ncpu = info_get_cpu_count(snap);
+    put_u32(out, ncpu);
+    for (int i = 0; i < ncpu; i++) {
+        put_f64(out, info_get_cpu_usage(snap, i));
+    }
+
+    guint nnet = info_get_net_count(snap);
+    put_u32(out, nnet);
+    for (guint i = 0; i < nnet; i++) {
+        const InfoNetIface *iface = info_get_net_iface(snap, i);
+        put_name(out, iface->name);
+        put_u32(out, iface->index);
+        put_u64(out, iface->rx_bytes);
+        put_u64(out, iface->tx_bytes);
+        put_u64(out, iface->rx_packets);
+        put_u64(out, iface->tx_packets);
+        put_u64(out, iface->rx_errors);
+        put_u64(out, iface->tx_errors);
+        put_u64(out, iface->rx_dropped);
+        put_u64(out, iface->tx_dropped);
+        put_f64(out, iface->rxspeed);
+        put_f64(out, iface->txspeed);
+    }
+
+    GPtrArray *mounts = info_get_mounts(snap);
+    guint nfs = mounts ? mounts->len : 0;
+    put_u32(out, nfs);
+    for (guint i = 0; i < nfs; i++) {
+        const char *path = g_unix_mount_get_mount_path(mounts->pdata[i]);
+        guint32 len = strlen(path);
+        put_u64(out, info_get_fs_free(snap, path));
+        put_u32(out, info_get_fs_stale(snap, path));
+        put_u32(out, len);
+        g_byte_array_append(out, (const guint8 *) path, len);
+    }
+
+    guint ntop = info_get_top_count(snap);
+    put_u32(out, ntop);
+    for (guint i = 0; i < ntop; i++) {
+        const InfoProc *proc = info_get_top_proc(snap, i);
+        put_u32(out, proc->pid);
+        put_name(out, proc->name);
+        put_f64(out, proc->cpu);
+        put_u64(out, proc->rss);
+    }
+
+    guint32 len = GUINT32_TO_LE(out->len - start);
+    memcpy(out->data + start + 8, &len, sizeof(len));
+}
+
+// Serving
+
+static struct Reply *
+reply_ref(struct Reply *reply)
+{
+    reply->ref_count++;
+    return reply;
+}
+
+static void
+reply_unref(struct Reply *reply)
+{
+    if (reply && --reply->ref_count == 0) {
+        g_string_free(reply->data, TRUE);
+        g_free(reply);
+    }
+}
+
+// Makes *reply a response with body, and the HTTP headers before it. The
+// reply is reused if no client is sending it, so the steady state does not
+// allocate.
+static void
+set_reply(struct Reply **reply, const char *content_type, const void *body, gsize len)
+{
+    if (!*reply || (*reply)->ref_count > 1) {
+        reply_unref(*reply);
+        *reply = g_new0(struct Reply, 1);
+        (*reply)->ref_count = 1;
+        (*reply)->data = g_string_sized_new(len + 128);
+    }
+
+    char headers[256];
+    g_snprintf(headers, sizeof(headers), "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n"
+               "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+               "Connection: close\r\n\r\n", content_type, len);
+    GString *s = (*reply)->data;
+    g_string_assign(s, headers);
+    g_string_append_len(s, body, len);
+}
+
+void
+exporter_update(Exporter *exp, InfoSnapshot *snap)
+{
+    g_string_truncate(exp->text, 0);
+    exporter_format_text(exp->text, snap);
+    set_reply(&exp->text_reply, TEXT_CONTENT_TYPE, exp->text->str, exp->text->len);
+
+    g_byte_array_set_size(exp->frame, 0);
+    exporter_format_frame(exp->frame, snap);
+    set_reply(&exp->frame_reply, FRAME_CONTENT_TYPE, exp->frame->data, exp->frame->len);
+}
+
+static void
+client_free(struct Client *client)
+{
+    g_object_unref(client->conn);
+    g_object_unref(client->cancellable);
+    reply_unref(client->reply);
+    g_free(client);
+}
+
+static void
+on_written(GObject *stream, GAsyncResult *result, gpointer data)
+{
+    struct Client *client = data;
+    g_output_stream_write_all_finish(G_OUTPUT_STREAM(stream), result, NULL, NULL);
+    client_free(client);
+}
+
+// Returns the response to request (a NUL-terminated request line), and sets
+// client->reply to it if it is not a static one.
+static const char *
+exporter_route(Exporter *exp, struct Client *client, const char *request)
+{
+    static const char not_found[] = HTTP_RESPONSE("404 Not Found");
+    static const char not_allowed[] = HTTP_RESPONSE("405 Method Not Allowed");
+    static const char unavailable[] = HTTP_RESPONSE("503 Service Unavailable");
+
+    struct Reply *reply;
+    if (g_str_has_prefix(request, "GET /metrics ")) {
+        reply = exp->text_reply;
+    } else if (g_str_has_prefix(request, "GET /frame ")) {
+        reply = exp->frame_reply;
+    } else if (g_str_has_prefix(request, "GET ")) {
+        return not_found;
+    } else {
+        return not_allowed;
+    }
+    if (!reply) {
+        return unavailable;
+    }
+    client->reply = reply_ref(reply);
+    return reply->data->str;
+}
+
+static void
+on_read(GObject *stream, GAsyncResult *result, gpointer data)
+{
+    Exporter *exp;
+    struct Client *client = data;
+    gssize n = g_input_stream_read_finish(G_INPUT_STREAM(stream), result, NULL);
+
+    // Cancelled (exp is gone), failed, timed out, or closed early.
+    if (n <= 0) {
+        client_free(client);
+        return;
+    }
+    client->len += n;
+    client->request[client->len] = '\0';
+
+    // Read all the headers before replying, even though only the request
+    // line matters, so the client is not cut off while sending them.
+    if (!strstr(client->request, "\r\n\r\n")) {
+        if (client->len + 1 >= sizeof(client->request)) {
+            client_free(client);
+            return;
+        }
+        g_input_stream_read_async(G_INPUT_STREAM(stream), client->request + client->len,
+                                  sizeof(client->request) - client->len - 1,
+                                  G_PRIORITY_DEFAULT, client->cancellable, on_read, client);
+        return;
+    }
+
+    exp = g_object_get_data(G_OBJECT(client->cancellable), "exporter");
+    if (!exp) {
+        client_free(client);
+        return;
+    }
+    *strchr(client->request, '\r') = '\0';
+    const char *reply = exporter_route(exp, client, client->request);
+    gsize len = client->reply ? client->reply->data->len : strlen(reply);
+
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(client->conn));
+    g_output_stream_write_all_async(out, reply, len, G_PRIORITY_DEFAULT,
+                                    client->cancellable, on_written, client);
+}
+
+static gboolean
+on_incoming(GSocketService *service, GSocketConnection *conn,
+            GObject *source, Exporter *exp)
+{
+    struct Client *client = g_new0(struct Client, 1);
+    client->conn = g_object_ref(conn);
+    client->cancellable = g_object_ref(exp->cancellable);
+    g_socket_set_timeout(g_socket_connection_get_socket(conn), CLIENT_TIMEOUT);
+
+    GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(conn));
+    g_input_stream_read_async(in, client->request, sizeof(client->request) - 1,
+                              G_PRIORITY_DEFAULT, client->cancellable, on_read, client);
+    return TRUE;
+}
+
+// Returns TRUE if something answers on the socket at path.
+static gboolean
+socket_in_use(GSocketAddress *address)
+{
+    GSocketClient *client = g_socket_client_new();
+    GSocketConnection *conn = g_socket_client_connect(client, G_SOCKET_CONNECTABLE(address),
+                                                      NULL, NULL);
+    if (conn) {
+        g_object_unref(conn);
+    }
+    g_object_unref(client);
+    return conn != NULL;
+}
+
+Exporter *
+exporter_new(const char *path, GError **error)
+{
+    GSocketService *service = g_socket_service_new();
+    GSocketAddress *address = g_unix_socket_address_new(path);
+    GError *err = NULL;
+
+    gboolean ok = g_socket_listener_add_address(G_SOCKET_LISTENER(service), address,
+                                                G_SOCKET_TYPE_STREAM,
+                                                G_SOCKET_PROTOCOL_DEFAULT,
+                                                NULL, NULL, &err);
+    // Replace the socket of a manitor that did not get to remove it.
+    if (!ok && g_error_matches(err, G_IO_ERROR, G_IO_ERROR_ADDRESS_IN_USE) &&
+        !socket_in_use(address)) {
+        g_clear_error(&err);
+        g_unlink(path);
+        ok = g_socket_listener_add_address(G_SOCKET_LISTENER(service), address,
+                                           G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+                                           NULL, NULL, &err);
+    }
+    g_object_unref(address);
+    if (!ok) {
+        g_propagate_error(error, err);
+        g_object_unref(service);
+        return NULL;
+    }
+
+    Exporter *exp = g_new0(Exporter, 1);
+    exp->path = g_strdup(path);
+    exp->service = service;
+    exp->cancellable = g_cancellable_new();
+    exp->text = g_string_sized_new(16384);
+    exp->frame = g_byte_array_sized_new(4096);
+
+    // The clients find exp through their cancellable, so they do not touch
+    // it once it is cancelled.
+    g_object_set_data(G_OBJECT(exp->cancellable), "exporter", exp);
+    g_signal_connect(service, "incoming", G_CALLBACK(on_incoming), exp);
+    g_socket_service_start(service);
+    return exp;
+}
+
+void
+exporter_free(Exporter *exp)
+{
+    if (!exp) {
+        return;
+    }
+
+    g_cancellable_cancel(exp->cancellable);
+    g_object_set_data(G_OBJECT(exp->cancellable), "exporter", NULL);
+    g_socket_service_stop(exp->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(exp->service));
+    g_object_unref(exp->service);
+    g_object_unref(exp->cancellable);
+    g_unlink(exp->path);
+
+    g_free(exp->path);
+    g_string_free(exp->text, TRUE);
+    g_byte_array_free(exp->frame, TRUE);
+    reply_unref(exp->text_reply);
+    reply_unref(exp->frame_reply);
+    g_free(exp);
+}
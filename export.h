@@ -0,0 +1,78 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ */
+#ifndef MANITOR_EXPORT_H
+#define MANITOR_EXPORT_H
+
+// An Exporter serves the latest snapshot of an Info over HTTP on a Unix
+// domain socket, e.g.
+//
+//     curl --unix-socket $XDG_RUNTIME_DIR/manitor.sock http://localhost/metrics
+//
+// GET /metrics returns the Prometheus text format (version 0.0.4), and
+// GET /frame the binary frame described below. The responses are formatted
+// once per snapshot by exporter_update(), so requests never read /proc, and
+// any number of them cost the same as one. It runs on the main context.
+//
+// The frame is little-endian, with doubles in IEEE 754 binary64:
+//
+//     u32 magic               EXPORT_FRAME_MAGIC ("MNTR")
+//     u32 version             EXPORT_FRAME_VERSION
+//     u32 length              Of the whole frame, in bytes.
+//     u32 reserved            0.
+//     u64 time                Of the sample (microseconds since the epoch).
+//     u64 uptime              Seconds.
+//     u64 meminfo[32]         The InfoMeminfo fields, in order.
+//     f64 mem, swap           Usage, as fractions.
+//     f64 cpu_times[10]       All the CPUs together, by InfoCpuState.
+//     f64 ctxt_rate           Context switches per second.
+//     f64 intr_rate           Interrupts per second.
+//     u32 procs_running, procs_blocked, nprocs
+//     u32 ncpu
+//     f64 usage[ncpu]
+//     u32 nnet
+//     nnet times:
+//         char name[16]       NUL-padded.
+//         u32 index
+//         u64 rx_bytes, tx_bytes, rx_packets, tx_packets,
+//             rx_errors, tx_errors, rx_dropped, tx_dropped
+//         f64 rxspeed, txspeed
+//     u32 nfs
+//     nfs times:
+//         u64 free            Bytes.
+//         u32 stale           1 if free is not known or out of date.
+//         u32 len
+//         char path[len]      Not NUL-terminated.
+//     u32 ntop
+//     ntop times:
+//         u32 pid
+//         char name[16]       NUL-padded.
+//         f64 cpu             In CPUs.
+//         u64 rss             Bytes.
+//
+// New fields are only added at the end of the frame, and other changes bump
+// the version.
+typedef struct Exporter Exporter;
+
+#define EXPORT_FRAME_MAGIC 0x52544e4du     // "MNTR"
+#define EXPORT_FRAME_VERSION 1
+
+// Creates a new Exporter listening on the socket at path. A socket left
+// behind by a process that is gone is replaced. Returns NULL (and sets
+// error) if the socket cannot be created, e.g. because another manitor
+// serves it.
+Exporter * exporter_new(const char *path, GError **error);
+
+// Stops serving, removes the socket and frees the Exporter.
+void exporter_free(Exporter *exp);
+
+// Formats the responses for snap. Call this whenever a new snapshot is
+// published. Until the first call, requests get 503 Service Unavailable.
+void exporter_update(Exporter *exp, InfoSnapshot *snap);
+
+// Appends snap to out in the Prometheus text format, and as a binary frame.
+void exporter_format_text(GString *out, InfoSnapshot *snap);
+void exporter_format_frame(GByteArray *out, InfoSnapshot *snap);
+
+#endif // #ifndef MANITOR_EXPORT_H
@@ -2,467 +2,3297 @@
  * manitor -- Display system information on the desktop.
  * See LICENSE for copyright.
  */
+#define _GNU_SOURCE // For pread(), O_CLOEXEC and prctl() with -std=c99.
+
 #include <glib.h>
 #include <gio/gunixmounts.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <math.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <sys/sysmacros.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "prof.h"
 #include "info.h"
+#include "uring.h"
+
+// Free space is sampled by up to this many threads at a time.
+#define FS_THREADS 4
+
+// A mount is stale if sampling its free space takes longer than this (us).
+#define FS_TIMEOUT (2 * G_TIME_SPAN_SECOND)
+
+// Collectors that fall due within this time of each other run together (us).
+// This is also the timer slack of the sampler thread, so the kernel can
+// line its wakeups up with others.
+#define SAMPLER_SLACK (5 * G_TIME_SPAN_MILLISECOND)
+
+// The mask of all the InfoCollectors (see info_collect()).
+#define ALL_COLLECTORS ((1u << INFO_COLLECTORS) - 1)
+
+// The initial buffer size for a Source. Buffers grow as needed.
+#define SOURCE_BUF_SIZE 4096
+
+// A scan of the processes stops for the next update after this long (us), and
+// carries on from there. On hosts with many processes, a scan is then spread
+// over several updates.
+#define PROCS_SCAN_BUDGET G_TIME_SPAN_MILLISECOND
+
+// The length of a block device name, with the NUL (DISK_NAME_LEN).
+#define DISK_NAME_SIZE 32
+
+// How deep dm and md devices are followed down to the disks.
+#define DISK_MAX_DEPTH 8
+
+// Windows of PSI triggers that are not multiples of this (us) need
+// privileges (see pressure_arm()).
+#define PRESSURE_WINDOW_STEP (2 * G_TIME_SPAN_SECOND)
+
+// The size of the netlink receive buffer. The kernel does not put more than
+// this into one datagram of a dump.
+#define NETLINK_BUF_SIZE 32768
+
+// While some cgroups cannot be watched, the tree is walked again after this
+// long (us) to try again, and then twice as long each time, up to
+// CGROUPS_RETRY_MAX.
+#define CGROUPS_RETRY_MIN G_TIME_SPAN_SECOND
+#define CGROUPS_RETRY_MAX G_TIME_SPAN_MINUTE
+
+// A file (in /proc or /sys) that is kept open and re-read on every update.
+struct Source {
+    char *path;     // The file name.
+    int fd;         // The open file (<0: not open).
+    char *buf;      // The contents read last time, NUL-terminated.
+    gsize size;     // The allocated size of buf.
+    InfoCollector collector;    // The collector that reads it.
+    gssize batched; // What the batch read into buf, or -errno (see
+                    // info_read_batch()).
+};
+
+// The free space of a mounted filesystem.
+// statvfs() can hang (think network filesystems), so it is called on a worker
+// thread, and the last good value is cached here. An FsStat is shared by the
+// Info and a pending sample, hence the reference count.
+struct FsStat {
+    gint ref;           // Reference count (atomic).
+    char *path;         // The mount point.
+
+    GMutex lock;        // Protects the fields below.
+    guint64 free;       // The number of free bytes (if time > 0).
+    gint64 time;        // The monotonic time of the last good sample (0: none).
+    gint64 started;     // When the pending sample started (0: none pending).
+    gboolean failed;    // Did the last sample fail?
+    gint64 took;        // How long the last sample took (0: reported).
+
+    float *history;     // The free space history (see struct History).
+    GList link;         // In FsQueue.jobs while a sample is pending.
+};
 
-#define MAX_CPUS 16
+// The samples for the fs workers to take. This is a queue of FsStat.links
+// rather than a GThreadPool, so queueing a sample does not allocate. It is
+// shared by the workers and the Info, as workers stuck on a hung filesystem
+// can outlive the Info.
+struct FsQueue {
+    gint ref;           // The workers and the Info hold one each (atomic).
+    GMutex lock;        // Protects the fields below.
+    GCond cond;         // Signalled when there is a job, or on quit.
+    GQueue jobs;        // The FsStats to sample, each with a reference.
+    gboolean quit;      // Exit when the jobs are done.
+};
+
+// The local time, broken down (see clock_set()).
+struct Clock {
+    struct tm tm;       // The local time at...
+    gint64 sec;         // ...this second since the epoch...
+    gint64 until;       // ...which holds until this one (excluded).
+};
 
+// The per-CPU values are kept in separate arrays, indexed by CPU number.
+// CPUs that are offline have a total of 0 (and a usage of 0).
 struct Cpu {
-    int n; // Number of CPUs.
+    int n;      // Number of CPUs (the highest CPU number seen + 1).
+    int size;   // The allocated length of the arrays.
+
+    double *usage;      // Usage as a fraction (0..1).
+    double *times;      // The InfoCpuStates of each CPU, a row per CPU.
+    guint64 *ticks;     // The counters of each CPU read last time, and
+    guint64 *new_ticks; // during the current update (rows like times).
+
+    // All the CPUs together (the "cpu" line).
+    double all_times[INFO_CPU_STATES];
+    guint64 all_ticks[INFO_CPU_STATES];
+
+    // The system counters.
+    guint64 ctxt;       // Context switches since boot.
+    guint64 intr;       // Interrupts since boot.
+    gint64 time;        // When they were read (monotonic, 0: never).
+    double ctxt_rate;   // Context switches per second.
+    double intr_rate;   // Interrupts per second.
+    guint procs_running;    // Runnable tasks (the run queue length).
+    guint procs_blocked;    // Tasks blocked on I/O.
+};
 
-    double usage[MAX_CPUS];     // Usage as a fraction (0..1).
-    guint64 used[MAX_CPUS];     // }-- These two are used to calculate
-    guint64 total[MAX_CPUS];    // }   the usage.
+// A network interface, as seen in the last dump.
+struct NetLink {
+    InfoNetIface pub;   // What is published.
+    gint64 time;        // When the counters were read (0: not yet).
+    guint64 dump;       // The number of the last dump that listed it.
 };
 
+// The counters of every network interface come from a single RTM_GETLINK
+// dump per update. The socket is also subscribed to RTNLGRP_LINK, so links
+// that are added, renamed or removed between updates are noticed; the
+// notifications queue up until the next dump reads them.
 struct Net {
     char *iface;        // The network interface to monitor.
-    double rxspeed;     // Receive speed (bytes/s).
-    double txspeed;     // Transmit speed (bytes/s).
-
-    // These are used to calculate the speeds.
-    guint64 rx;         // Received bytes.
-    guint64 tx;         // Transmitted bytes.
-    gint64 rx_time;     // The last time rx was updated (<0: rx is invalid).
-    gint64 tx_time;     // The last time tx was updated (<0: tx is invalid).
+    double rxspeed;     // Receive speed of iface (bytes/s).
+    double txspeed;     // Transmit speed of iface (bytes/s).
+
+    int fd;             // The netlink socket (<0: not available).
+    guint32 seq;        // The sequence number of the last dump.
+    guint64 dump;       // The number of dumps done.
+    char *buf;          // The receive buffer (NETLINK_BUF_SIZE bytes).
+    GArray *links;      // The struct NetLinks, by interface index.
+};
+
+// A process, as last read from /proc/PID/stat. Processes are told apart by
+// their pid and start time, as pids get reused.
+struct Proc {
+    int pid;            // The process ID.
+    guint64 start;      // The start time (clock ticks after boot).
+    guint64 pass;       // The last pass of the scan that saw it.
+    guint64 ticks;      // The CPU time used so far (user + system, clock ticks).
+    gint64 time;        // When ticks was read (monotonic).
+    InfoProc pub;       // What is published.
+};
+
+// The busiest processes. The scan walks /proc a few hundred entries at a
+// time (see PROCS_SCAN_BUDGET), reading only the stat file of each process,
+// and diffs the values against the last ones read. A pass is a walk through
+// the whole directory; the processes not seen during a pass have exited.
+// As a pass can take many updates, the busiest processes are read again on
+// every update before the scan goes on, so the ones shown are up to date.
+struct Procs {
+    guint top_size;     // The number of processes to publish (0: none).
+    DIR *dir;           // /proc, kept open (NULL: not available).
+    GHashTable *table;  // The struct Procs (keys and values).
+    guint64 pass;       // The number of the current pass.
+    gint64 update;      // When the current update started (monotonic).
+    long clock_ticks;   // Clock ticks per second.
+    long page_size;     // The size of a page, in bytes.
+    char buf[1024];     // For reading the stat files.
+    guint ntop;         // The number of processes in top.
+    struct Proc **top;  // The busiest processes, the busiest first.
+    guint count;        // The number of processes seen by the last pass.
+};
+
+// A cgroup, as last read. Its directory is kept open, and the files in it are
+// opened from there.
+struct Cgroup {
+    char *path;         // Under /sys/fs/cgroup ("" for the root).
+    int dirfd;          // The directory.
+    int wd;             // Its inotify watch (<0: none).
+    guint children;     // The number of cgroups right under it.
+    guint64 pass;       // The last walk that saw it.
+    guint64 usage;      // The CPU time used so far (us, cpu.stat).
+    guint64 rbytes;     // The bytes read and written so far (io.stat, all
+    guint64 wbytes;     // the devices together).
+    gint64 time;        // When they were read (monotonic, 0: never).
+    InfoCgroup pub;     // What is published.
+};
+
+// The cgroups of a subtree of /sys/fs/cgroup. The tree is walked once, and
+// then kept up to date with inotify: each cgroup is watched for the cgroups
+// created and removed under it.
+// The tree is only walked again if events were lost or a cgroup was renamed,
+// or on every update without inotify, or now and then while some cgroups
+// cannot be watched (e.g. past fs.inotify.max_user_watches).
+struct Cgroups {
+    guint top_size;     // The number of cgroups to publish (0: none).
+    char *dir;          // /sys/fs/cgroup.
+    char *subtree;      // The path of the subtree under dir.
+    int inotify_fd;     // Non-blocking (<0: not available).
+    gboolean walk;      // Must the tree be walked?
+    guint unwatched;    // The cgroups that could not be watched since.
+    gboolean warned;    // Has that been logged?
+    gint64 retry_time;  // When to walk again for them (monotonic, 0: now).
+    gint64 retry_delay; // How long after the last such walk (0: none yet).
+    guint64 pass;       // The number of walks so far.
+    GHashTable *paths;  // Path => struct Cgroup (owned).
+    GHashTable *wds;    // Watch descriptor => struct Cgroup.
+    union {
+        struct inotify_event event;     // (For the alignment.)
+        char buf[4096]; // For reading the events and the files.
+    } u;
+    guint ntop;         // The number of cgroups in top.
+    InfoCgroup *top;    // The busiest cgroups, the busiest first.
+};
+
+// The recent values of the metrics, in ring buffers of size values that all
+// advance together: value number i of every ring is at position i % size.
+// The sampler pushes the values of every snapshot it publishes; readers copy
+// them out. Both hold the lock, which is only ever held briefly.
+//
+// The per-CPU values are stored a row per update, so a push writes one
+// contiguous row whatever the number of CPUs. The free space of each mount is
+// a ring in its FsStat, so it survives changes to the mount table.
+struct History {
+    GMutex lock;        // Protects everything below.
+    guint size;         // The number of values kept (0: no history).
+    guint64 count;      // The number of values pushed so far.
+    float *metrics;     // A ring per InfoMetric, one after the other.
+    int ncpu;           // The length of the rows of cpu.
+    float *cpu;         // size rows of ncpu CPU usages.
+};
+
+// The counters of /proc/diskstats the I/O is computed from...
+enum {
+    DISK_READS,         // Reads completed.
+    DISK_READ_SECTORS,  // Sectors read (512 bytes, whatever the device).
+    DISK_READ_MS,       // Time spent reading (ms).
+    DISK_WRITES,        // Writes completed.
+    DISK_WRITE_SECTORS, // Sectors written.
+    DISK_WRITE_MS,      // Time spent writing (ms).
+    DISK_IO_MS,         // Time spent with I/O in flight (ms).
+    DISK_COUNTERS
+};
+
+// ...and where they are among the fields after the device name.
+#define DISK_FIELDS 10
+static const int disk_fields[DISK_COUNTERS] = { 0, 2, 3, 4, 6, 7, 9 };
+
+// A block device, as last read from /proc/diskstats.
+struct DiskDevice {
+    char name[DISK_NAME_SIZE];  // The kernel name (e.g. "sda1", "dm-0").
+    guint64 counters[DISK_COUNTERS];
+    guint64 pass;       // The last read that listed it.
+    gboolean known;     // Is io known (was it listed by the read before)?
+    InfoDiskIO io;      // The I/O between those two reads.
+};
+
+// The devices of a mount.
+struct DiskMount {
+    struct DiskDevice *dev;     // The device it is on.
+    GPtrArray *disks;   // The whole disks under dev (struct DiskDevice).
+    gboolean known;     // Is io known?
+    InfoDiskIO io;      // The I/O of dev, with the utilization of the
+                        // busiest disk.
+};
+
+// The I/O of the devices the mounts are on. Working out the devices (the
+// disk of a partition, the disks under a dm or md device) takes a walk
+// through /sys, so it is done when the mount table changes; an update only
+// reads /proc/diskstats, and looks up the devices of interest by name.
+struct Disks {
+    struct Source src;      // /proc/diskstats
+    GHashTable *devices;    // Name => struct DiskDevice, for every device
+                            // in mounts.
+    GArray *mounts;         // The struct DiskMount of each of Info.mounts.
+    guint64 pass;           // The number of reads so far.
+    gint64 time;            // When src was read last (monotonic, 0: never).
+};
+
+// The names of the pressure files, by InfoPressureResource.
+static const char *pressure_names[INFO_PRESSURES] = { "cpu", "memory", "io" };
+
+// Pressure stall information, from /proc/pressure or the files of a cgroup.
+// The averages are read at the period of the collector, and the triggers
+// (which are the same files, opened again) are polled by the sampler.
+struct Pressure {
+    struct Source src[INFO_PRESSURES];  // The pressure files.
+    gint64 stall;           // The triggers: some stall this long (us)...
+    gint64 window;          // ...within this window (us, 0: no triggers).
+    int trigger_fd[INFO_PRESSURES];     // The files with a trigger (<0: none)
+    gint64 trigger_window[INFO_PRESSURES];  // and the windows they got.
+    gint64 fired[INFO_PRESSURES];       // When each one last fired
+                                        // (monotonic, 0: never).
+    gboolean known[INFO_PRESSURES];     // Could the files be read?
+    InfoPressure values[INFO_PRESSURES];
+};
+
+// The free space of a mount, as published in a snapshot.
+struct FsValue {
+    guint64 free;       // The number of free bytes.
+    gboolean stale;     // Is free out of date?
+    gboolean io_known;  // Is io known?
+    InfoDiskIO io;      // The I/O of its device.
+};
+
+// The values published by an update. A snapshot is never changed while a
+// reader holds it. The arrays belong to the snapshot and are reused by later
+// updates; mounts and mount_index are shared by snapshots and the Info.
+struct InfoSnapshot {
+    gint64 time;            // The time of the update (us since the epoch).
+    struct tm local_time;   // The same, local and broken down.
+    guint64 uptime;         // Uptime, in seconds.
+    int ncpu;               // The number of CPUs.
+    int cpu_size;           // The allocated length of cpu_usage.
+    double *cpu_usage;      // The usage of each CPU (0..1).
+    double *cpu_times;      // The InfoCpuStates of each CPU, a row per CPU.
+    double cpu_all_times[INFO_CPU_STATES];  // The same for all of them.
+    double ctxt_rate;       // Context switches per second.
+    double intr_rate;       // Interrupts per second.
+    guint procs_running;    // Runnable tasks.
+    guint procs_blocked;    // Tasks blocked on I/O.
+    gboolean pressure_known[INFO_PRESSURES];    // Is pressure known?
+    InfoPressure pressure[INFO_PRESSURES];      // The pressure stalls.
+    InfoMeminfo meminfo;    // The contents of /proc/meminfo.
+    double mem;             // Memory used, as a fraction.
+    double swap;            // Swap used, as a fraction.
+    double rxspeed;         // Receive speed (bytes/s).
+    double txspeed;         // Transmit speed (bytes/s).
+    guint nnet;             // The number of network interfaces.
+    guint net_size;         // The allocated length of net.
+    InfoNetIface *net;      // The network interfaces, by index.
+    guint nprocs;           // The number of processes.
+    guint ntop;             // The number of processes in top.
+    guint top_size;         // The allocated length of top.
+    InfoProc *top;          // The busiest processes.
+    guint ncgroups;         // The number of cgroups.
+    guint cgroup_ntop;      // The number of cgroups in cgroup_top.
+    guint cgroup_top_size;  // The allocated length of cgroup_top.
+    InfoCgroup *cgroup_top; // The busiest cgroups.
+    GPtrArray *mounts;      // The mounts (GUnixMountEntry) of interest.
+    GHashTable *mount_index;    // Mount point => index in mounts + 1.
+    guint fs_size;          // The allocated length of fs.
+    struct FsValue *fs;     // The free space for each mount.
+    GPtrArray *fs_stats;    // The FsStat of each mount (shared).
+    struct History *history;    // The Info's history.
+    guint64 history_count;  // The history includes this many values.
 };
 
+// Snapshots are passed from the sampler to the reader through a triple
+// buffer: the sampler fills the back buffer and swaps it with the middle one,
+// and the reader swaps the middle buffer with its front one when the middle
+// one is fresh. Neither side ever waits for the other, and a snapshot stays
+// intact for as long as the reader uses it.
+#define SNAPSHOT_INDEX 3    // The index of the middle buffer...
+#define SNAPSHOT_FRESH 4    // ...and whether it is newer than the front one.
+
 struct Info {
-    GDateTime *time;    // The current time.
+    char *root;         // Where /proc is ("" for the real one).
+    gint64 time;        // The current time (us since the epoch, 0: none).
+    struct Clock clock; // The same, local and broken down.
     guint64 uptime;     // Uptime, in seconds.
     struct Cpu cpu;     // CPU usage.
+    InfoMeminfo meminfo;    // The contents of /proc/meminfo.
     double mem;         // Memory used, as a fraction.
     double swap;        // Swap used, as a fraction.
     struct Net net;     // Network interface speeds.
+    struct Procs procs; // The busiest processes.
+    struct Cgroups cgroups; // The busiest cgroups.
+    struct History history; // The recent values.
+
+    struct Source stat_src;     // /proc/stat
+    struct Source meminfo_src;  // /proc/meminfo
+    struct Source uptime_src;   // /proc/uptime
+    GPtrArray *sources;         // All the Sources, to read them in batches...
+    Uring *uring;               // ...with this (NULL: one at a time).
+    UringRead *reads;           // The reads of a batch.
+    struct iovec *iovs;         // The buffers of the sources, as registered.
+    gboolean fixed;             // Are they registered?
 
     GPtrArray *mounts;      // An array of unix mounts.
-    guint64 mounts_time;    // Mount timestamp.
+    GHashTable *fs_types;   // The filesystem types we show mounts for.
+    char *mountinfo_path;   // /proc/self/mountinfo...
+    int mountinfo_fd;       // ...polled for changes.
+
+    GHashTable *mount_index;    // Mount point => index in mounts + 1.
+    GPtrArray *fs;          // The struct FsStat for each mount.
+    struct FsQueue *fs_queue;   // Samples the free space.
+    struct Disks disks;     // The I/O of the mounts.
+    struct Pressure pressure;   // Pressure stall information.
+
+    InfoSnapshot snaps[3];  // The triple buffer.
+    int back;               // The snapshot being filled by the sampler.
+    int middle;             // The last one published, plus SNAPSHOT_FRESH.
+    int front;              // The snapshot given to the reader.
+    GSource *watch;         // Dispatched when a snapshot is published.
+    InfoSnapshotFunc snapshot_func; // Called with every snapshot published
+    gpointer snapshot_data;         // (NULL: none),
+    guint snapshot_collectors;      // with the collectors it needs (mask).
+
+    Prof *prof;             // Times the stages of info_update() (NULL: off).
+
+    GThread *sampler;       // The sampler thread (NULL: not started).
+    int control_fd;         // An eventfd that wakes up the sampler to check:
+    gint stopping;          // - if it should stop, and
+    gint paused;            // - if it should pause (both atomic).
+    int timer_fd;           // A timerfd that wakes it up to sample.
+    gint64 period[INFO_COLLECTORS]; // How often each collector runs (us).
+    gint64 due[INFO_COLLECTORS];    // When each one runs next (real time).
+};
+
+// The stages of an update, as timed by Info.prof. The collectors come
+// first, timed as stage INFO_CPU etc.
+enum {
+    PROF_STATVFS = INFO_COLLECTORS, // On a worker thread, reported by
+                                    // info_update_fs().
+    PROF_READ,
+    PROF_TIME,
+    PROF_PUBLISH,
+    PROF_STAGES
+};
+
+static const char *prof_stages[PROF_STAGES] = {
+    "cpu", "mem_swap", "mounts", "fs", "net", "procs", "uptime",
+    "disks", "pressure", "cgroups",
+    "statvfs", "read", "time", "publish",
+};
+
+// Mounts of these filesystem types are shown.
+static const char *fs_types[] = {
+    "ext2", "ext3", "ext4", "vfat", "ntfs", "ntfs-3g", "reiserfs",
 };
 
 static char *
 skip_line(const char *s)
 {
-    while (*s && *s != '\n') s++;   // Skip to the end of line.
-    return (char *) ((*s == '\n') ? s + 1 : s);
+    // strchr() looks at a word at a time, which matters for long lines
+    // (e.g. "intr" in /proc/stat).
+    const char *end = strchr(s, '\n');
+    return (char *) (end ? end + 1 : s + strlen(s));
 }
 
-static char *
-skip_token(const char *s)
+// Parses the decimal number at s, after any spaces, and sets *end to the
+// character after it. Returns 0, and does not move past the end of the line,
+// if there is no number. The digit loop has a single comparison per digit.
+static inline guint64
+parse_number(const char *s, const char **end)
 {
-    while (*s && *s != ' ' && *s != '\t' && *s != '\a' && *s != '\v') s++;
-    return (char *) s;
+    while (*s == ' ') s++;
+    guint64 v = 0;
+    for (unsigned d; (d = (guchar) *s - '0') < 10; s++) {
+        v = 10 * v + d;
+    }
+    *end = s;
+    return v;
 }
 
-static char *
-skip_space(const char *s)
+// Initializes src to read path (which is owned by src from now on).
+// The file is opened right away, but it does not have to exist yet.
+static void
+source_init(struct Source *src, char *path)
 {
-    while (*s == ' ' || *s == '\t' || *s == '\a' || *s == '\v') s++;
-    return (char *) s;
+    src->path = path;
+    src->fd = open(path, O_RDONLY | O_CLOEXEC);
+    src->size = SOURCE_BUF_SIZE;
+    src->buf = g_malloc(src->size);
+    src->buf[0] = '\0';
+    src->batched = -1;
 }
 
-static char *
-read_file(const char *filename)
+static void
+source_close(struct Source *src)
 {
-    char *buf = NULL;
-    g_file_get_contents(filename, &buf, NULL, NULL);
-    return buf;
+    if (src->fd >= 0) {
+        close(src->fd);
+        src->fd = -1;
+    }
 }
 
-Info *
-info_new(const char *iface)
+static void
+source_clear(struct Source *src)
 {
-    Info *info = g_new0(Info, 1);
-    info->net.iface = g_strdup(iface);
-    info->net.rx_time = -1; // -1 to indicate that we don't have valid values.
-    info->net.tx_time = -1; //
-    return info;
+    source_close(src);
+    src->path = (g_free(src->path), NULL);
+    src->buf = (g_free(src->buf), NULL);
+    src->size = 0;
 }
 
-void
-info_free(Info *info)
+// Reads the whole file from the start into src->buf.
+// The file is (re)opened if necessary, e.g. when it has disappeared since the
+// last read. The buffer is only reallocated when the contents do not fit.
+// Returns src->buf, or NULL if the file cannot be read.
+static char *
+source_read(struct Source *src)
 {
-    if (info) {
-        if (info->time) {
-            info->time = (g_date_time_unref(info->time), NULL);
+    // The batch read it already, unless it did not fit.
+    gssize batched = src->batched;
+    src->batched = -1;
+    if (batched >= 0 && (gsize) batched < src->size - 1) {
+        src->buf[batched] = '\0';
+        return src->buf;
+    }
+
+    // Two attempts: the second one with a freshly opened file.
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (src->fd < 0) {
+            src->fd = open(src->path, O_RDONLY | O_CLOEXEC);
+            if (src->fd < 0) {
+                return NULL;
+            }
         }
-        if (info->mounts) {
-            info->mounts = (g_ptr_array_free(info->mounts, TRUE), NULL);
+
+        ssize_t n;
+        while (TRUE) {
+            n = pread(src->fd, src->buf, src->size - 1, 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            // Procfs and sysfs return everything in a single read, as long as
+            // it fits. If the buffer is full, grow it and read again to get
+            // a consistent copy rather than stitching two reads together.
+            if (n >= 0 && (gsize) n == src->size - 1) {
+                src->size *= 2;
+                src->buf = g_realloc(src->buf, src->size);
+                continue;
+            }
+            break;
         }
-        info->net.iface = (g_free(info->net.iface), NULL);
-        g_free(info);
+
+        if (G_LIKELY(n >= 0)) {
+            src->buf[n] = '\0';
+            return src->buf;
+        }
+
+        // The file is gone (ENODEV etc.). Try to open it again.
+        source_close(src);
     }
+
+    src->buf[0] = '\0';
+    return NULL;
 }
 
-// Parses a CPU line in /proc/stat.
-// lineptr is the address of a pointer to the current line, and will be updated
-// on success.
-// n is the CPU number.
-// Returns TRUE on success (filling cpu), FALSE otherwise.
-static inline gboolean
-parse_cpu_line(struct Cpu *cpu, char **lineptr, int n)
+// Grows the CPU arrays to hold at least size CPUs. New entries are zeroed.
+static void
+cpu_resize(struct Cpu *cpu, int size)
 {
-    char *s = *lineptr;
-
-    // Expect "cpuN".
-    if (G_UNLIKELY(s[0] != 'c' || s[1] != 'p' || s[2] != 'u' || !g_ascii_isdigit(s[3])))
-        return FALSE;
-
-    s += 3; // Skip "cpu".
+    if (size <= cpu->size) {
+        return;
+    }
 
-    // Look for a matching N in "cpuN".
-    {
-        char *end = NULL;
-        guint64 i = g_ascii_strtoull(s, &end, 10);
-        if (n != i || s == end || errno == ERANGE || errno == EINVAL) { 
-            return FALSE;
-        }
-        s = end;
+    gsize old_len = (gsize) cpu->size * INFO_CPU_STATES;
+    gsize len = (gsize) size * INFO_CPU_STATES;
+    guint64 **arrays[] = { &cpu->ticks, &cpu->new_ticks };
+    for (guint i = 0; i < G_N_ELEMENTS(arrays); i++) {
+        *arrays[i] = g_renew(guint64, *arrays[i], len);
+        memset(*arrays[i] + old_len, 0, (len - old_len) * sizeof(guint64));
     }
+    cpu->times = g_renew(double, cpu->times, len);
+    memset(cpu->times + old_len, 0, (len - old_len) * sizeof(double));
+    cpu->usage = g_renew(double, cpu->usage, size);
+    memset(cpu->usage + cpu->size, 0, (size - cpu->size) * sizeof(double));
 
-    // strtoull eats leading whitespace, including '\n'!
-    // We don't want to cross lines, so we skip whitespace ourselves.
-    guint64 user = (s = skip_space(s), g_ascii_strtoull(s, &s, 10));
-    guint64 nice = (s = skip_space(s), g_ascii_strtoull(s, &s, 10));
-    guint64 sys = (s = skip_space(s), g_ascii_strtoull(s, &s, 10));
-    guint64 idle = (s = skip_space(s), g_ascii_strtoull(s, &s, 10));
-    guint64 iowait = (s = skip_space(s), g_ascii_strtoull(s, &s, 10));
+    cpu->size = size;
+}
 
-    // Skip the rest of the line.
-    s = skip_line(s);
+static void
+cpu_clear(struct Cpu *cpu)
+{
+    cpu->usage = (g_free(cpu->usage), NULL);
+    cpu->times = (g_free(cpu->times), NULL);
+    cpu->ticks = (g_free(cpu->ticks), NULL);
+    cpu->new_ticks = (g_free(cpu->new_ticks), NULL);
+    cpu->n = cpu->size = 0;
+}
 
-    guint64 total = user + nice + sys + idle + iowait;
-    guint64 used = total - idle - iowait;
-    double usage = 0;
+static struct FsStat *
+fs_stat_new(const char *path)
+{
+    struct FsStat *fs = g_new0(struct FsStat, 1);
+    fs->ref = 1;
+    fs->path = g_strdup(path);
+    fs->link.data = fs;
+    g_mutex_init(&fs->lock);
+    return fs;
+}
 
-    // Have we seen this CPU? Then we have valid stats.
-    if (cpu->n > n) {
-        // Handle overflow
-        if (used < cpu->used[n])
-            cpu->used[n] = used;
-        if (total < cpu->total[n])
-            cpu->total[n] = total;
+static struct FsStat *
+fs_stat_ref(struct FsStat *fs)
+{
+    g_atomic_int_inc(&fs->ref);
+    return fs;
+}
 
-        guint64 diff_total = total - cpu->total[n];
-        if (diff_total > 0) {
-            guint64 diff_used = used - cpu->used[n];
-            usage = (double) diff_used / (double) diff_total;
-        }
+static void
+fs_stat_unref(struct FsStat *fs)
+{
+    if (g_atomic_int_dec_and_test(&fs->ref)) {
+        g_mutex_clear(&fs->lock);
+        g_free(fs->path);
+        g_free(fs->history);
+        g_free(fs);
     }
-
-    cpu->usage[n] = usage;
-    cpu->total[n] = total;
-    cpu->used[n] = used;
-
-    *lineptr = s;
-    return TRUE;
 }
 
+// Runs on a worker thread. Takes over the reference to fs.
 static void
-info_update_cpu(Info *info)
+fs_stat_sample(struct FsStat *fs)
 {
-    char *buf = read_file("/proc/stat");
-    char *s = buf ? buf : "";
+    struct statvfs st;
 
-    // Skip the global "cpu" line.
-    if (g_str_has_prefix(s, "cpu") && g_ascii_isspace(s[3])) {
-        s = skip_line(s);
+    gint64 start = g_get_monotonic_time();
+    gboolean ok = (statvfs(fs->path, &st) == 0);
+    gint64 end = g_get_monotonic_time();
+
+    g_mutex_lock(&fs->lock);
+    if (ok) {
+        // NOTE: f_bavail = number of free blocks for unpriviliged users
+        //       f_bfree  = number of free blocks
+        fs->free = st.f_bavail * st.f_frsize;
+        fs->time = end;
     }
+    fs->took = MAX(1, end - start);
+    fs->failed = !ok;
+    fs->started = 0;
+    g_mutex_unlock(&fs->lock);
 
-    // The number of CPUs handled during this update.
-    int cpu_n = 0;
+    fs_stat_unref(fs);
+}
 
-    for (int i = 0; i < MAX_CPUS; i++) {
-        if (parse_cpu_line(&info->cpu, &s, i)) {
-            cpu_n++;
-        } else {
+static void
+fs_queue_unref(struct FsQueue *q)
+{
+    if (g_atomic_int_dec_and_test(&q->ref)) {
+        g_mutex_clear(&q->lock);
+        g_cond_clear(&q->cond);
+        g_free(q);
+    }
+}
+
+// Takes the samples in q until told to quit.
+static gpointer
+fs_worker(gpointer data)
+{
+    struct FsQueue *q = data;
+
+    g_mutex_lock(&q->lock);
+    for (;;) {
+        GList *link = g_queue_pop_head_link(&q->jobs);
+        if (link) {
+            g_mutex_unlock(&q->lock);
+            fs_stat_sample(link->data);
+            g_mutex_lock(&q->lock);
+        } else if (q->quit) {
             break;
+        } else {
+            g_cond_wait(&q->cond, &q->lock);
         }
     }
+    g_mutex_unlock(&q->lock);
 
-    g_free(buf);
-    info->cpu.n = cpu_n;
+    fs_queue_unref(q);
+    return NULL;
+}
+
+// Creates the queue, and FS_THREADS workers for it.
+static struct FsQueue *
+fs_queue_new(void)
+{
+    struct FsQueue *q = g_new0(struct FsQueue, 1);
+    q->ref = 1 + FS_THREADS;
+    g_mutex_init(&q->lock);
+    g_cond_init(&q->cond);
+    g_queue_init(&q->jobs);
+    for (int i = 0; i < FS_THREADS; i++) {
+        g_thread_unref(g_thread_new("info-fs", fs_worker, q));
+    }
+    return q;
 }
 
+// Queues a sample of fs, which must not have one pending. The workers that
+// sleep only see it after fs_queue_wake(), so that a batch costs one wakeup.
 static void
-update_iface_speed(const char *iface, const char *filename,
-                   double *speed, guint64 *bytes, gint64 *time)
+fs_queue_push(struct FsQueue *q, struct FsStat *fs)
 {
-    char *name = g_strdup_printf("/sys/class/net/%s/statistics/%s", iface, filename);
-    char *buf = read_file(name);
-    gint64 now = g_get_monotonic_time();
+    g_mutex_lock(&q->lock);
+    g_queue_push_tail_link(&q->jobs, &fs_stat_ref(fs)->link);
+    g_mutex_unlock(&q->lock);
+}
 
-    if (buf) {
-        guint64 value = g_ascii_strtoull(buf, NULL, 10);
-        if (*time >= 0) { // Previous byte count is valid.
-            double delta_seconds = ((double) now - (double) *time) / 1e6;
-            // Make sure some time has elapsed.
-            if (delta_seconds > 1e-3) {
-                // Handle overflow.
-                if (value < *bytes) {
-                    *bytes = value;
-                }
-                *speed = (value - *bytes) / delta_seconds;
-                *bytes = value;
-                *time = now;
-            } else { // No time has elapsed
-                *speed = 0;
-                *bytes = value;
-                *time = now;
-            }
-        } else { // Previous byte count is NOT valid.
-            *speed = 0;
-            *bytes = value;
-            *time = now;
-        }
-    } else { // Coult not read the byte count.
-        *speed = 0;
-        *time = -1;
-        *bytes = 0;
-    }
+static void
+fs_queue_wake(struct FsQueue *q)
+{
+    g_mutex_lock(&q->lock);
+    g_cond_broadcast(&q->cond);
+    g_mutex_unlock(&q->lock);
+}
 
-    g_free(buf);
-    g_free(name);
+// Tells the workers to exit once the queued samples are taken, and drops the
+// reference of the caller. Does not wait for them.
+static void
+fs_queue_quit(struct FsQueue *q)
+{
+    g_mutex_lock(&q->lock);
+    q->quit = TRUE;
+    g_cond_broadcast(&q->cond);
+    g_mutex_unlock(&q->lock);
+    fs_queue_unref(q);
 }
 
-static inline guint64
-parse_meminfo_value(const char *meminfo, const char *name)
+// Opens a netlink socket for the link dumps and notifications.
+// Returns the socket, or -1 if there is none (network speeds are then 0).
+static int
+net_open(void)
 {
-    guint64 val = 0;
-    const char *start = meminfo;
-    char *s = NULL;
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        g_warning("Cannot open a netlink socket: %s", g_strerror(errno));
+        return -1;
+    }
 
-    // Find name at the beginning of a line.
-    // It would be wrong, for example, to find "SwapCached:" for "Cached:".
-    while (TRUE) {
-        s = strstr(start, name);
-        if (G_UNLIKELY(!s)) {
-            return val;
-        }
-        // Is it at the beginning of the line?
-        if (s == start || s[-1] == '\n') {
-            break; // Got it!
+    struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = RTMGRP_LINK };
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        g_warning("Cannot bind the netlink socket: %s", g_strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Returns the link with interface index ifindex, adding it if add is TRUE.
+// Returns NULL if there is no such link.
+static struct NetLink *
+net_find(struct Net *net, int ifindex, gboolean add)
+{
+    // Binary search. Dumps list the links by index, so new ones usually go
+    // at the end.
+    guint lo = 0, hi = net->links->len;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        int i = g_array_index(net->links, struct NetLink, mid).pub.index;
+        if (i == ifindex) {
+            return &g_array_index(net->links, struct NetLink, mid);
         }
-        // Keep searching until the buffer is processed.
-        start = skip_line(s);
-        if (!*start) {
-            return val;
+        if (i < ifindex) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
-
-    s = skip_token(s); // Skip the "Name:".
-    s = skip_space(s); // Skip to the number.
-    val = g_ascii_strtoull(s, &s, 10);
-    s = skip_space(s); // Skip to the unit.
-    switch (*s) {
-    case 'k': val *= 1024; break;
-    case 'M': val *= 1024 * 1024; break;
+    if (!add) {
+        return NULL;
     }
 
-    return val;
+    struct NetLink link = { .pub = { .index = ifindex } };
+    g_array_insert_val(net->links, lo, link);
+    return &g_array_index(net->links, struct NetLink, lo);
 }
 
+// Handles an RTM_NEWLINK or RTM_DELLINK message. dump: TRUE if it is part of
+// our dump (read at now), FALSE if it is a notification.
 static void
-info_update_mem_swap(Info *info)
+net_handle_link(struct Net *net, struct nlmsghdr *nh, gboolean dump, gint64 now)
 {
-    info->mem = 0;
-    info->swap = 0;
-
-    char *buf = read_file("/proc/meminfo");
-    if (G_UNLIKELY(!buf)) {
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg))) {
         return;
     }
+    struct ifinfomsg *ifi = NLMSG_DATA(nh);
 
-    guint64 memtotal = parse_meminfo_value(buf, "MemTotal:");
-    guint64 memfree = parse_meminfo_value(buf, "MemFree:");
-    guint64 shmem = parse_meminfo_value(buf, "Shmem:");
-    guint64 srec = parse_meminfo_value(buf, "SReclaimable:");
-    guint64 buffers = parse_meminfo_value(buf, "Buffers:");
-    guint64 cached = parse_meminfo_value(buf, "Cached:");
-
-    // Do what Conky does (memused - membuf = really used memory).
-    // https://github.com/brndnmtthws/conky/blob/v1.10.3/src/linux.cc#L166
-    guint64 memused = memtotal - memfree;
-    guint64 membuf = (cached - shmem) + buffers + srec;
+    if (nh->nlmsg_type == RTM_DELLINK) {
+        struct NetLink *link = net_find(net, ifi->ifi_index, FALSE);
+        if (link) {
+            g_array_remove_index(net->links, link - (struct NetLink *) net->links->data);
+        }
+        return;
+    }
 
-    if (memtotal && memused >= membuf) {
-        info->mem = ((double) (memused - membuf)) / ((double) memtotal);
+    const char *name = NULL;
+    struct rtnl_link_stats64 stats = { 0 };
+    gboolean have_stats = FALSE;
+    int len = IFLA_PAYLOAD(nh);
+    for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        switch (rta->rta_type) {
+        case IFLA_IFNAME:
+            name = RTA_DATA(rta);
+            break;
+        case IFLA_STATS64:
+            // Older kernels send fewer fields. The attribute is not aligned
+            // for 64 bits.
+            memcpy(&stats, RTA_DATA(rta), MIN(RTA_PAYLOAD(rta), sizeof(stats)));
+            have_stats = TRUE;
+            break;
+        }
     }
 
-    guint64 swaptotal = parse_meminfo_value(buf, "SwapTotal:");
-    guint64 swapfree = parse_meminfo_value(buf, "SwapFree:");
-    guint64 swapused = swaptotal - swapfree;
-    if (swaptotal) {
-        info->swap = (double) swapused / (double) swaptotal;
+    struct NetLink *link = net_find(net, ifi->ifi_index, TRUE);
+    InfoNetIface *pub = &link->pub;
+    if (name) {
+        g_strlcpy(pub->name, name, sizeof(pub->name));
+    }
+    // Notifications only tell us about the link. The counters are all read
+    // at the same time by the dump, so the speeds are comparable.
+    if (!dump) {
+        return;
+    }
+    link->dump = net->dump;
+    if (!have_stats) {
+        return;
     }
 
-    g_free(buf);
+    // The speeds are only valid if we have read the counters before, and
+    // they have not gone back (e.g. the driver was reloaded).
+    double seconds = (now - link->time) / 1e6;
+    gboolean valid = link->time > 0 && seconds > 1e-3 &&
+                     stats.rx_bytes >= pub->rx_bytes && stats.tx_bytes >= pub->tx_bytes;
+    pub->rxspeed = valid ? (stats.rx_bytes - pub->rx_bytes) / seconds : 0;
+    pub->txspeed = valid ? (stats.tx_bytes - pub->tx_bytes) / seconds : 0;
+    pub->rx_bytes = stats.rx_bytes;
+    pub->tx_bytes = stats.tx_bytes;
+    pub->rx_packets = stats.rx_packets;
+    pub->tx_packets = stats.tx_packets;
+    pub->rx_errors = stats.rx_errors;
+    pub->tx_errors = stats.tx_errors;
+    pub->rx_dropped = stats.rx_dropped;
+    pub->tx_dropped = stats.tx_dropped;
+    link->time = now;
 }
 
-static void
-info_update_mounts(Info *info)
+// Dumps the links, handling the notifications queued before the dump too.
+// Returns FALSE if the dump failed.
+static gboolean
+net_dump(struct Net *net)
 {
-    if (info->mounts) {
-        // Looks like I can't rely on this. What a surprise.
-        /*
-        if (!g_unix_mounts_changed_since(info->mounts_time)) {
-            //g_print("Mounts have NOT CHANGED since %lu\n", info->mounts_time);
-            return info->mounts;
-        }
-        */
-        g_ptr_array_set_size(info->mounts, 0);
-    } else {
-        info->mounts = g_ptr_array_new_full(10, (GDestroyNotify) g_unix_mount_free);
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi;
+    } req = {
+        .nh = {
+            .nlmsg_len = sizeof(req),
+            .nlmsg_type = RTM_GETLINK,
+            .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+            .nlmsg_seq = ++net->seq,
+        },
+        .ifi = { .ifi_family = AF_UNSPEC },
+    };
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    if (sendto(net->fd, &req, sizeof(req), 0, (struct sockaddr *) &kernel, sizeof(kernel)) < 0) {
+        return FALSE;
     }
 
-    GList *mounts = g_unix_mounts_get(&info->mounts_time);
- 
-    for (GList *m = mounts; m != NULL; m = m->next) {
-        GUnixMountEntry *entry = m->data;
-
-        // Only interested in devices...
-        const char *dev = g_unix_mount_get_device_path(entry);
-        if (strncmp(dev, "/dev/", 5) != 0) {
-            continue;
+    net->dump++;
+    gint64 now = g_get_monotonic_time();
+    while (TRUE) {
+        ssize_t n = recv(net->fd, net->buf, NETLINK_BUF_SIZE, 0);
+        if (n < 0) {
+            // ENOBUFS: notifications were lost. The dump covers for them.
+            if (errno == EINTR || errno == ENOBUFS) {
+                continue;
+            }
+            return FALSE;
         }
 
-        // ...and certain filesystems.
-        const char *type = g_unix_mount_get_fs_type(entry);
-        if ((strcmp(type, "ext2") != 0) &&
-            (strcmp(type, "ext3") != 0) &&
-            (strcmp(type, "ext4") != 0) &&
-            (strcmp(type, "vfat") != 0) &&
-            (strcmp(type, "ntfs") != 0) &&
-            (strcmp(type, "ntfs-3g") != 0) &&
-            (strcmp(type, "reiserfs") != 0)
-        ) {
-            continue;
+        int len = n;
+        for (struct nlmsghdr *nh = (struct nlmsghdr *) net->buf; NLMSG_OK(nh, len);
+             nh = NLMSG_NEXT(nh, len)) {
+            gboolean dump = (nh->nlmsg_seq == net->seq);
+            if (dump && (nh->nlmsg_type == NLMSG_DONE || nh->nlmsg_type == NLMSG_ERROR)) {
+                return nh->nlmsg_type == NLMSG_DONE;
+            }
+            if (nh->nlmsg_type == RTM_NEWLINK || nh->nlmsg_type == RTM_DELLINK) {
+                net_handle_link(net, nh, dump, now);
+            }
         }
-
-        g_ptr_array_add(info->mounts, g_unix_mount_copy(entry));
     }
+}
+
+static guint
+proc_hash(gconstpointer p)
+{
+    const struct Proc *proc = p;
+    return proc->pid ^ (guint) (proc->start * 2654435761u);
+}
 
-    g_list_free_full(mounts, (GDestroyNotify) g_unix_mount_free);
+static gboolean
+proc_equal(gconstpointer a, gconstpointer b)
+{
+    const struct Proc *pa = a;
+    const struct Proc *pb = b;
+    return pa->pid == pb->pid && pa->start == pb->start;
 }
 
 static void
-info_update_net(Info *info)
+disk_mount_clear(gpointer data)
 {
-    update_iface_speed(info->net.iface, "rx_bytes",
-                       &info->net.rxspeed,
-                       &info->net.rx,
-                       &info->net.rx_time);
-    update_iface_speed(info->net.iface, "tx_bytes",
-                       &info->net.txspeed,
-                       &info->net.tx,
-                       &info->net.tx_time);
+    struct DiskMount *m = data;
+    if (m->disks) m->disks = (g_ptr_array_unref(m->disks), NULL);
 }
 
 static void
-info_update_time(Info *info)
+cgroup_free(gpointer data)
 {
-    if (info->time) {
-        g_date_time_unref(info->time);
-    }
-    // This may be NULL...
-    info->time = g_date_time_new_now_local();
+    struct Cgroup *cg = data;
+    close(cg->dirfd);
+    g_free(cg->path);
+    g_free(cg);
 }
 
 static void
-info_update_uptime(Info *info)
+snapshot_clear(InfoSnapshot *snap)
 {
-    char *buf = read_file("/proc/uptime");
-    if (G_UNLIKELY(!buf)) {
-        info->uptime = 0;
-        return;
+    if (snap->mounts) {
+        snap->mount_index = (g_hash_table_unref(snap->mount_index), NULL);
+        snap->mounts = (g_ptr_array_unref(snap->mounts), NULL);
+        snap->fs_stats = (g_ptr_array_unref(snap->fs_stats), NULL);
     }
-
-    // Uptime has fractional seconds, but we are not interested in that.
-    info->uptime = g_ascii_strtoull(buf, NULL, 10);
-    g_free(buf);
+    snap->cpu_usage = (g_free(snap->cpu_usage), NULL);
+    snap->cpu_times = (g_free(snap->cpu_times), NULL);
+    snap->fs = (g_free(snap->fs), NULL);
+    snap->net = (g_free(snap->net), NULL);
+    snap->top = (g_free(snap->top), NULL);
+    snap->cgroup_top = (g_free(snap->cgroup_top), NULL);
+    snap->cgroup_top_size = snap->cgroup_ntop = 0;
+    snap->cpu_size = snap->fs_size = snap->net_size = snap->nnet = 0;
+    snap->top_size = snap->ntop = 0;
 }
 
-void
-info_update(Info *info)
+// Wakes up the sampler thread to check Info.stopping and Info.paused.
+static void
+sampler_wake(Info *info)
 {
-    info_update_cpu(info);
-    info_update_mem_swap(info);
-    info_update_mounts(info);
-    info_update_net(info);
-    info_update_time(info);
-    info_update_uptime(info);
+    guint64 one = 1;
+    while (write(info->control_fd, &one, sizeof(one)) < 0 && errno == EINTR);
 }
 
-int
-info_get_cpu_count(Info *info)
+// Returns the path of file (an absolute path) under the root of info.
+static char *
+info_path(Info *info, const char *file)
 {
-    return info->cpu.n;
+    return g_strconcat(info->root, file, NULL);
 }
 
-double
-info_get_cpu_usage(Info *info, int n)
+// Sets up src to read file (under the root) for collector, and adds it to the
+// Sources read in batches.
+static void
+info_add_source(Info *info, struct Source *src, InfoCollector collector, const char *file)
 {
-    return (0 <= n && n < info->cpu.n) ? info->cpu.usage[n] : 0;
+    source_init(src, info_path(info, file));
+    src->collector = collector;
+    g_ptr_array_add(info->sources, src);
 }
 
-guint64
-info_get_fs_free(Info *info, const char *path)
+Info *
+info_new(const char *iface, const char *root)
 {
-    struct statvfs st;
+    Info *info = g_new0(Info, 1);
+    // Without a trailing '/', so that paths can be appended.
+    info->root = g_strdup(root ? root : "");
+    for (gsize n = strlen(info->root); n > 0 && info->root[n - 1] == '/'; n--) {
+        info->root[n - 1] = '\0';
+    }
 
-    if (statvfs(path, &st) == 0) {
-        // NOTE: f_bavail = number of free blocks for unpriviliged users
-        //       f_bfree  = number of free blocks
-        //return st.f_bfree * st.f_frsize;
-        return st.f_bavail * st.f_frsize;
+    cpu_resize(&info->cpu, MAX(1, sysconf(_SC_NPROCESSORS_CONF)));
+    info->sources = g_ptr_array_new();
+    info_add_source(info, &info->stat_src, INFO_CPU, "/proc/stat");
+    info_add_source(info, &info->meminfo_src, INFO_MEM, "/proc/meminfo");
+    info_add_source(info, &info->uptime_src, INFO_UPTIME, "/proc/uptime");
+    info_add_source(info, &info->disks.src, INFO_DISKS, "/proc/diskstats");
+    for (int i = 0; i < INFO_PRESSURES; i++) {
+        char *file = g_strconcat("/proc/pressure/", pressure_names[i], NULL);
+        info_add_source(info, &info->pressure.src[i], INFO_PRESSURE, file);
+        info->pressure.trigger_fd[i] = -1;
+        g_free(file);
     }
+    info_set_io_uring(info, TRUE);
 
-    return 0;
-}
+    info->net.iface = g_strdup(iface);
+    info->net.fd = net_open();
+    info->net.buf = g_malloc(NETLINK_BUF_SIZE);
+    info->net.links = g_array_new(FALSE, FALSE, sizeof(struct NetLink));
+
+    char *proc = info_path(info, "/proc");
+    info->procs.dir = opendir(proc);
+    g_free(proc);
+    info->procs.table = g_hash_table_new_full(proc_hash, proc_equal, g_free, NULL);
+    info->procs.pass = 1;
+    info->procs.clock_ticks = MAX(1, sysconf(_SC_CLK_TCK));
+    info->procs.page_size = MAX(1, sysconf(_SC_PAGESIZE));
+
+    info->cgroups.dir = info_path(info, "/sys/fs/cgroup");
+    info->cgroups.inotify_fd = -1;
+    info->cgroups.paths = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, cgroup_free);
+    info->cgroups.wds = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    info->fs_types = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint i = 0; i < G_N_ELEMENTS(fs_types); i++) {
+        g_hash_table_add(info->fs_types, (gpointer) fs_types[i]);
+    }
+    // The kernel flags this file with POLLPRI|POLLERR when the mount table
+    // changes. If we cannot open it, mounts are read on every update.
+    info->mountinfo_path = info_path(info, "/proc/self/mountinfo");
+    info->mountinfo_fd = open(info->mountinfo_path, O_RDONLY | O_CLOEXEC);
+
+    info->fs = g_ptr_array_new_with_free_func((GDestroyNotify) fs_stat_unref);
+    info->fs_queue = fs_queue_new();
+    info->disks.devices = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+    info->disks.mounts = g_array_new(FALSE, TRUE, sizeof(struct DiskMount));
+    g_array_set_clear_func(info->disks.mounts, disk_mount_clear);
+    info->disks.pass = 1;
+
+    for (int i = 0; i < INFO_COLLECTORS; i++) {
+        info->period[i] = G_TIME_SPAN_SECOND;
+    }
 
-double
-info_get_mem(Info *info)
-{
-    return info->mem;
+    g_mutex_init(&info->history.lock);
+    for (guint i = 0; i < G_N_ELEMENTS(info->snaps); i++) {
+        info->snaps[i].history = &info->history;
+    }
+
+    info->front = 0;
+    info->middle = 1;
+    info->back = 2;
+    info->control_fd = -1;
+    info->timer_fd = -1;
+    return info;
 }
 
-GPtrArray *
-info_get_mounts(Info *info)
+void
+info_free(Info *info)
 {
-    return info->mounts;
+    if (info) {
+        if (info->sampler) {
+            g_atomic_int_set(&info->stopping, TRUE);
+            sampler_wake(info);
+            info->sampler = (g_thread_join(info->sampler), NULL);
+        }
+        if (info->control_fd >= 0) {
+            info->control_fd = (close(info->control_fd), -1);
+        }
+        if (info->timer_fd >= 0) {
+            info->timer_fd = (close(info->timer_fd), -1);
+        }
+        if (info->watch) {
+            g_source_destroy(info->watch);
+            info->watch = (g_source_unref(info->watch), NULL);
+        }
+        for (guint i = 0; i < G_N_ELEMENTS(info->snaps); i++) {
+            snapshot_clear(&info->snaps[i]);
+        }
+
+        if (info->mounts) {
+            info->mount_index = (g_hash_table_unref(info->mount_index), NULL);
+            info->mounts = (g_ptr_array_unref(info->mounts), NULL);
+        }
+        info->fs_types = (g_hash_table_destroy(info->fs_types), NULL);
+        // Do not wait for samples that hang. They hold their own references.
+        info->fs_queue = (fs_queue_quit(info->fs_queue), NULL);
+        info->fs = (g_ptr_array_unref(info->fs), NULL);
+        if (info->mountinfo_fd >= 0) {
+            info->mountinfo_fd = (close(info->mountinfo_fd), -1);
+        }
+        info->mountinfo_path = (g_free(info->mountinfo_path), NULL);
+        cpu_clear(&info->cpu);
+        source_clear(&info->stat_src);
+        source_clear(&info->meminfo_src);
+        source_clear(&info->uptime_src);
+        source_clear(&info->disks.src);
+        for (int i = 0; i < INFO_PRESSURES; i++) {
+            source_clear(&info->pressure.src[i]);
+            if (info->pressure.trigger_fd[i] >= 0) {
+                info->pressure.trigger_fd[i] = (close(info->pressure.trigger_fd[i]), -1);
+            }
+        }
+        info->disks.devices = (g_hash_table_destroy(info->disks.devices), NULL);
+        info->disks.mounts = (g_array_unref(info->disks.mounts), NULL);
+        info->uring = (uring_free(info->uring), NULL);
+        info->reads = (g_free(info->reads), NULL);
+        info->iovs = (g_free(info->iovs), NULL);
+        info->sources = (g_ptr_array_unref(info->sources), NULL);
+        if (info->net.fd >= 0) {
+            info->net.fd = (close(info->net.fd), -1);
+        }
+        info->net.buf = (g_free(info->net.buf), NULL);
+        info->net.links = (g_array_free(info->net.links, TRUE), NULL);
+        info->net.iface = (g_free(info->net.iface), NULL);
+        if (info->procs.dir) {
+            info->procs.dir = (closedir(info->procs.dir), NULL);
+        }
+        info->procs.table = (g_hash_table_destroy(info->procs.table), NULL);
+        info->procs.top = (g_free(info->procs.top), NULL);
+        info->cgroups.wds = (g_hash_table_destroy(info->cgroups.wds), NULL);
+        info->cgroups.paths = (g_hash_table_destroy(info->cgroups.paths), NULL);
+        if (info->cgroups.inotify_fd >= 0) {
+            info->cgroups.inotify_fd = (close(info->cgroups.inotify_fd), -1);
+        }
+        info->cgroups.dir = (g_free(info->cgroups.dir), NULL);
+        info->cgroups.subtree = (g_free(info->cgroups.subtree), NULL);
+        info->cgroups.top = (g_free(info->cgroups.top), NULL);
+        info->prof = (prof_free(info->prof), NULL);
+        info->root = (g_free(info->root), NULL);
+        g_mutex_clear(&info->history.lock);
+        info->history.metrics = (g_free(info->history.metrics), NULL);
+        info->history.cpu = (g_free(info->history.cpu), NULL);
+        g_free(info);
+    }
 }
 
-double
-info_get_swap(Info *info)
+// Parses the counters of a CPU line in /proc/stat (after "cpu" or "cpuN")
+// into ticks. Counters that an older kernel does not have are 0.
+static inline void
+parse_cpu_ticks(const char *s, guint64 *ticks)
 {
-    return info->swap;
+    for (int j = 0; j < INFO_CPU_STATES; j++) {
+        ticks[j] = parse_number(s, &s);
+    }
 }
 
-GDateTime *
-info_get_time(Info *info)
+// Parses a "cpuN" line in /proc/stat into the row of cpu->new_ticks for
+// CPU N, growing the arrays if necessary.
+// Returns N on success, -1 otherwise.
+static inline int
+parse_cpu_line(struct Cpu *cpu, const char *s)
 {
-    return info->time;
+    // Get N in "cpuN". CPUs that are offline are missing, so N can skip.
+    const char *end;
+    guint64 n = parse_number(s + 3, &end);
+    if (G_UNLIKELY(end == s + 3 || n > (1 << 20))) {
+        return -1;
+    }
+
+    if (G_UNLIKELY(n >= (guint64) cpu->size)) {
+        // A CPU was hotplugged.
+        cpu_resize(cpu, MAX(n + 1, 2 * (guint64) cpu->size));
+    }
+    parse_cpu_ticks(end, cpu->new_ticks + n * INFO_CPU_STATES);
+    return n;
 }
 
-guint64
-info_get_uptime(Info *info)
+// Works out the share of each state of the time between the counters old
+// and new into times, and returns the usage: the share of everything but
+// idle and iowait. Everything is 0 if the counters are not valid (e.g. the
+// CPU was offline). There are no branches, so that the loop over the CPUs
+// can be vectorized.
+static inline double
+cpu_times(const guint64 *old, const guint64 *new, double *times)
 {
-    return info->uptime;
+    // guest and guest_nice are already counted in user and nice.
+    guint64 old_total = 0, new_total = 0;
+    for (int j = 0; j < INFO_CPU_GUEST; j++) {
+        old_total += old[j];
+        new_total += new[j];
+    }
+
+    gboolean valid = (old_total != 0) & (new_total > old_total);
+    double scale = valid ? 1.0 / (double) (new_total - old_total) : 0;
+    for (int j = 0; j < INFO_CPU_STATES; j++) {
+        // iowait can go back a little.
+        times[j] = (new[j] >= old[j]) ? (double) (new[j] - old[j]) * scale : 0;
+    }
+    double usage = 1.0 - times[INFO_CPU_IDLE] - times[INFO_CPU_IOWAIT];
+    return valid ? CLAMP(usage, 0, 1) : 0;
 }
 
-double
-info_get_net_rxspeed(Info *info)
+// Returns the rate of a counter that went from old (at time, 0: never read)
+// to new (at now).
+static inline double
+counter_rate(guint64 old, guint64 new, gint64 time, gint64 now)
 {
-    return info->net.rxspeed;
+    return (time > 0 && now > time && new >= old) ? (new - old) * 1e6 / (now - time) : 0;
 }
 
-double
-info_get_net_txspeed(Info *info)
+static void
+info_update_cpu(Info *info)
 {
-    return info->net.txspeed;
+    struct Cpu *cpu = &info->cpu;
+    char *buf = source_read(&info->stat_src);
+    const char *s = buf ? buf : "";
+    gint64 now = g_get_monotonic_time();
+
+    guint64 all[INFO_CPU_STATES] = { 0 };
+    guint64 ctxt = 0, intr = 0;
+    cpu->procs_running = 0;
+    cpu->procs_blocked = 0;
+
+    // CPUs that are not listed this time are offline.
+    memset(cpu->new_ticks, 0, (gsize) cpu->size * INFO_CPU_STATES * sizeof(guint64));
+
+    // A single pass over the file. The lines we want mostly start with
+    // different letters.
+    int n = 0;
+    for (; *s; s = skip_line(s)) {
+        switch (*s) {
+        case 'c':
+            if (s[1] == 'p' && s[2] == 'u') {
+                if (s[3] == ' ') {
+                    parse_cpu_ticks(s + 3, all);
+                } else {
+                    int i = parse_cpu_line(cpu, s);
+                    n = MAX(n, i + 1);
+                }
+            } else if (g_str_has_prefix(s, "ctxt ")) {
+                ctxt = parse_number(s + 5, &s);
+            }
+            break;
+        case 'i':
+            // The total, then a number for each interrupt.
+            if (g_str_has_prefix(s, "intr ")) {
+                intr = parse_number(s + 5, &s);
+            }
+            break;
+        case 'p':
+            if (g_str_has_prefix(s, "procs_running ")) {
+                cpu->procs_running = parse_number(s + 14, &s);
+            } else if (g_str_has_prefix(s, "procs_blocked ")) {
+                cpu->procs_blocked = parse_number(s + 14, &s);
+            }
+            break;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        gsize row = (gsize) i * INFO_CPU_STATES;
+        cpu->usage[i] = cpu_times(cpu->ticks + row, cpu->new_ticks + row, cpu->times + row);
+    }
+    cpu_times(cpu->all_ticks, all, cpu->all_times);
+    memcpy(cpu->all_ticks, all, sizeof(all));
+
+    cpu->ctxt_rate = counter_rate(cpu->ctxt, ctxt, cpu->time, now);
+    cpu->intr_rate = counter_rate(cpu->intr, intr, cpu->time, now);
+    cpu->ctxt = ctxt;
+    cpu->intr = intr;
+    cpu->time = now;
+
+    // The new values become the old ones.
+    guint64 *tmp = cpu->ticks;
+    cpu->ticks = cpu->new_ticks;
+    cpu->new_ticks = tmp;
+
+    cpu->n = n;
+}
+
+// Returns the InfoMeminfo field for the /proc/meminfo key (of length len),
+// or NULL if we are not interested in the key.
+static inline guint64 *
+meminfo_field(InfoMeminfo *mi, const char *key, gsize len)
+{
+#define KEY(name, field) \
+    if (len == sizeof(name) - 1 && memcmp(key, name, sizeof(name) - 1) == 0) return &mi->field
+
+    // Dispatch on the first character, then compare the length before the
+    // contents. Most keys are rejected without looking at them at all.
+    switch (key[0]) {
+    case 'A':
+        KEY("Active", active);
+        KEY("AnonPages", anon_pages);
+        KEY("AnonHugePages", anon_huge_pages);
+        break;
+    case 'B':
+        KEY("Buffers", buffers);
+        break;
+    case 'C':
+        KEY("Cached", cached);
+        KEY("CommitLimit", commit_limit);
+        KEY("Committed_AS", committed_as);
+        break;
+    case 'D':
+        KEY("Dirty", dirty);
+        break;
+    case 'H':
+        KEY("HugePages_Total", huge_pages_total);
+        KEY("HugePages_Free", huge_pages_free);
+        KEY("HugePages_Rsvd", huge_pages_rsvd);
+        KEY("HugePages_Surp", huge_pages_surp);
+        KEY("Hugepagesize", hugepagesize);
+        KEY("Hugetlb", hugetlb);
+        break;
+    case 'I':
+        KEY("Inactive", inactive);
+        break;
+    case 'K':
+        KEY("KReclaimable", kreclaimable);
+        KEY("KernelStack", kernel_stack);
+        break;
+    case 'M':
+        KEY("MemTotal", mem_total);
+        KEY("MemFree", mem_free);
+        KEY("MemAvailable", mem_available);
+        KEY("Mapped", mapped);
+        KEY("Mlocked", mlocked);
+        break;
+    case 'P':
+        KEY("PageTables", page_tables);
+        break;
+    case 'S':
+        KEY("SwapCached", swap_cached);
+        KEY("SwapTotal", swap_total);
+        KEY("SwapFree", swap_free);
+        KEY("Shmem", shmem);
+        KEY("Slab", slab);
+        KEY("SReclaimable", sreclaimable);
+        KEY("SUnreclaim", sunreclaim);
+        break;
+    case 'U':
+        KEY("Unevictable", unevictable);
+        break;
+    case 'W':
+        KEY("Writeback", writeback);
+        break;
+    }
+
+    return NULL;
+#undef KEY
+}
+
+// Parses the contents of /proc/meminfo into mi in a single pass.
+void
+info_parse_meminfo(InfoMeminfo *mi, const char *s)
+{
+    memset(mi, 0, sizeof(*mi));
+
+    while (*s) {
+        // Lines look like "Name:   1234 kB". Walking through the number is
+        // how we get to the end of the line anyway, so always parse it.
+        // Letters sort after ':', which makes the common case one comparison.
+        const char *key = s;
+        while ((guchar) *s > ':' || (*s != ':' && *s != '\n' && *s)) s++;
+        guint64 *field = (*s == ':') ? meminfo_field(mi, key, s - key) : NULL;
+
+        if (*s == ':') s++;
+        while (*s == ' ') s++;
+        guint64 val = 0;
+        while (g_ascii_isdigit(*s)) {
+            val = 10 * val + (*s++ - '0');
+        }
+        while (*s == ' ') s++;
+        switch (*s) {
+        case 'k': val *= 1024; break;
+        case 'M': val *= 1024 * 1024; break;
+        }
+        if (field) {
+            *field = val;
+        }
+
+        while (*s != '\n' && *s) s++;
+        if (*s) s++;
+    }
+}
+
+static void
+info_update_mem_swap(Info *info)
+{
+    InfoMeminfo *mi = &info->meminfo;
+    info->mem = 0;
+    info->swap = 0;
+
+    char *buf = source_read(&info->meminfo_src);
+    info_parse_meminfo(mi, buf ? buf : "");
+
+    // Do what Conky does (memused - membuf = really used memory).
+    // https://github.com/brndnmtthws/conky/blob/v1.10.3/src/linux.cc#L166
+    guint64 memused = mi->mem_total - mi->mem_free;
+    guint64 membuf = (mi->cached - mi->shmem) + mi->buffers + mi->sreclaimable;
+
+    if (mi->mem_total && memused >= membuf) {
+        info->mem = ((double) (memused - membuf)) / ((double) mi->mem_total);
+    }
+
+    guint64 swapused = mi->swap_total - mi->swap_free;
+    if (mi->swap_total) {
+        info->swap = (double) swapused / (double) mi->swap_total;
+    }
+}
+
+// Returns TRUE if the mount table has changed since the last call.
+static gboolean
+mounts_changed(Info *info)
+{
+    if (G_UNLIKELY(info->mountinfo_fd < 0)) {
+        return TRUE;
+    }
+
+    // Polling also resets the event, so the next poll reports new changes
+    // only. We do not need to read the file.
+    struct pollfd pfd = { .fd = info->mountinfo_fd, .events = POLLPRI };
+    int n;
+    do {
+        n = poll(&pfd, 1, 0);
+    } while (n < 0 && errno == EINTR);
+
+    return n != 0 && (n < 0 || (pfd.revents & (POLLPRI | POLLERR)));
+}
+
+// Returns the kernel name of the block device at dev (e.g. "/dev/mapper/root"
+// => "dm-0"). The name is the last part of the device path if the device
+// cannot be found, e.g. in a copy of /dev under the root.
+static char *
+disk_name(Info *info, const char *dev)
+{
+    char *path = info_path(info, dev);
+    char *name = NULL;
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISBLK(st.st_mode)) {
+        // /sys/dev/block/8:1 links to .../block/sda/sda1.
+        char *sys = g_strdup_printf("%s/sys/dev/block/%u:%u", info->root,
+                                    major(st.st_rdev), minor(st.st_rdev));
+        char *real = realpath(sys, NULL);
+        if (real) name = g_path_get_basename(real);
+        free(real);
+        g_free(sys);
+    }
+    if (!name) {
+        char *real = realpath(path, NULL);
+        name = g_path_get_basename(real ? real : path);
+        free(real);
+    }
+    g_free(path);
+    return name;
+}
+
+// Adds the names of the whole disks under block device name to names: the
+// disk of a partition, the devices under a dm or md device, and so on down.
+// A device /sys knows nothing about is taken to be a disk.
+static void
+disk_add_leaves(Info *info, const char *name, GPtrArray *names, int depth)
+{
+    char *sys = g_strconcat(info->root, "/sys/class/block/", name, NULL);
+    gboolean stacked = FALSE;
+    if (depth < DISK_MAX_DEPTH) {
+        char *slaves = g_build_filename(sys, "slaves", NULL);
+        GDir *dir = g_dir_open(slaves, 0, NULL);
+        if (dir) {
+            const char *slave;
+            while ((slave = g_dir_read_name(dir)) != NULL) {
+                disk_add_leaves(info, slave, names, depth + 1);
+                stacked = TRUE;
+            }
+            g_dir_close(dir);
+        }
+        g_free(slaves);
+    }
+
+    if (!stacked) {
+        char *disk = NULL;
+        char *partition = g_build_filename(sys, "partition", NULL);
+        if (g_file_test(partition, G_FILE_TEST_EXISTS)) {
+            // /sys/class/block/sda1 links to .../block/sda/sda1.
+            char *real = realpath(sys, NULL);
+            char *parent = real ? g_path_get_dirname(real) : NULL;
+            if (parent) disk = g_path_get_basename(parent);
+            g_free(parent);
+            free(real);
+        }
+        g_free(partition);
+        if (!disk) disk = g_strdup(name);
+
+        for (guint i = 0; disk && i < names->len; i++) {
+            if (strcmp(names->pdata[i], disk) == 0) {
+                disk = (g_free(disk), NULL);
+            }
+        }
+        if (disk) g_ptr_array_add(names, disk);
+    }
+    g_free(sys);
+}
+
+// Returns the device called name in Disks.devices, taking it from old (the
+// devices before) or adding it.
+static struct DiskDevice *
+disks_get(struct Disks *disks, GHashTable *old, const char *name)
+{
+    struct DiskDevice *dev = g_hash_table_lookup(disks->devices, name);
+    if (dev) {
+        return dev;
+    }
+    dev = g_hash_table_lookup(old, name);
+    if (dev) {
+        g_hash_table_steal(old, name);
+    } else {
+        dev = g_new0(struct DiskDevice, 1);
+        g_strlcpy(dev->name, name, sizeof(dev->name));
+    }
+    g_hash_table_insert(disks->devices, dev->name, dev);
+    return dev;
+}
+
+// Works out the devices of the mounts. The counters of the devices that are
+// still in use are kept, so their I/O stays known.
+static void
+disks_map(Info *info)
+{
+    struct Disks *disks = &info->disks;
+    GHashTable *old = disks->devices;
+    disks->devices = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+    g_array_set_size(disks->mounts, 0);
+
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    for (guint i = 0; i < info->mounts->len; i++) {
+        char *name = disk_name(info, g_unix_mount_get_device_path(info->mounts->pdata[i]));
+        g_ptr_array_set_size(names, 0);
+        disk_add_leaves(info, name, names, 0);
+
+        struct DiskMount m = { .disks = g_ptr_array_new() };
+        m.dev = disks_get(disks, old, name);
+        for (guint j = 0; j < names->len; j++) {
+            g_ptr_array_add(m.disks, disks_get(disks, old, names->pdata[j]));
+        }
+        g_array_append_val(disks->mounts, m);
+        g_free(name);
+    }
+    g_ptr_array_unref(names);
+    g_hash_table_destroy(old);
+}
+
+// Returns a list of the mounts (GUnixMountEntry) in the mount table.
+static GList *
+get_unix_mounts(Info *info)
+{
+#if GLIB_CHECK_VERSION(2, 82, 0)
+    // Read the table under the root. Older GLibs can only read the real one.
+    if (*info->root) {
+        gsize n = 0;
+        GUnixMountEntry **entries = g_unix_mounts_get_from_file(info->mountinfo_path, NULL, &n);
+        GList *list = NULL;
+        for (gsize i = n; i-- > 0; ) {
+            list = g_list_prepend(list, entries[i]);
+        }
+        g_free(entries);
+        return list;
+    }
+#endif
+    return g_unix_mounts_get(NULL);
+}
+
+static void
+info_update_mounts(Info *info)
+{
+    // g_unix_mounts_changed_since() cannot be relied on, so ask the kernel
+    // instead.
+    if (info->mounts && !mounts_changed(info)) {
+        return;
+    }
+
+    // Snapshots may still use the old array, so build a new one.
+    GPtrArray *array = g_ptr_array_new_full(10, (GDestroyNotify) g_unix_mount_free);
+    GList *mounts = get_unix_mounts(info);
+
+    for (GList *m = mounts; m != NULL; m = m->next) {
+        GUnixMountEntry *entry = m->data;
+
+        // Only interested in devices and certain filesystems.
+        const char *dev = g_unix_mount_get_device_path(entry);
+        const char *type = g_unix_mount_get_fs_type(entry);
+        if (strncmp(dev, "/dev/", 5) == 0 &&
+            g_hash_table_contains(info->fs_types, type)) {
+            // The array takes ownership; no need for a copy.
+            g_ptr_array_add(array, entry);
+        } else {
+            g_unix_mount_free(entry);
+        }
+    }
+
+    g_list_free(mounts);
+
+    // Index the new mounts, and keep the FsStats (and the cached values) of
+    // the mounts that are still there.
+    GHashTable *index = g_hash_table_new(g_str_hash, g_str_equal);
+    GPtrArray *fs = g_ptr_array_new_full(array->len, (GDestroyNotify) fs_stat_unref);
+    for (guint i = 0; i < array->len; i++) {
+        const char *path = g_unix_mount_get_mount_path(array->pdata[i]);
+        guint old = info->mount_index ?
+            GPOINTER_TO_UINT(g_hash_table_lookup(info->mount_index, path)) : 0;
+        g_ptr_array_add(fs, old ? fs_stat_ref(info->fs->pdata[old - 1]) : fs_stat_new(path));
+        g_hash_table_insert(index, (gpointer) path, GUINT_TO_POINTER(i + 1));
+    }
+
+    // The index refers to the strings in the mount entries.
+    if (info->mounts) {
+        g_hash_table_unref(info->mount_index);
+        g_ptr_array_unref(info->mounts);
+    }
+    g_ptr_array_unref(info->fs);
+    info->mounts = array;
+    info->mount_index = index;
+    info->fs = fs;
+    disks_map(info);
+}
+
+// Starts sampling the free space of the mounts. Whether they are stale is
+// worked out when they are published, so a sample that finishes or hangs
+// shows before the next one is due.
+static void
+info_update_fs(Info *info)
+{
+    gint64 now = g_get_monotonic_time();
+    guint queued = 0;
+
+    for (guint i = 0; i < info->fs->len; i++) {
+        struct FsStat *fs = info->fs->pdata[i];
+        gboolean start = FALSE;
+        gint64 took = 0;
+
+        g_mutex_lock(&fs->lock);
+        took = fs->took;
+        fs->took = 0;
+        // Never queue a second sample behind one that hangs.
+        if (fs->started == 0) {
+            fs->started = now;
+            start = TRUE;
+        }
+        g_mutex_unlock(&fs->lock);
+
+        // The worker threads do not touch the Prof, as they can outlive it.
+        if (took) {
+            prof_add(info->prof, PROF_STATVFS, took * 1000);
+        }
+        if (start) {
+            fs_queue_push(info->fs_queue, fs);
+            queued++;
+        }
+    }
+    if (queued > 0) {
+        fs_queue_wake(info->fs_queue);
+    }
+}
+
+static void
+info_update_net(Info *info)
+{
+    struct Net *net = &info->net;
+    net->rxspeed = 0;
+    net->txspeed = 0;
+    if (net->fd < 0 || !net_dump(net)) {
+        g_array_set_size(net->links, 0);
+        return;
+    }
+
+    // Drop the links the dump did not list. Their removal notifications
+    // may have been lost.
+    for (guint i = net->links->len; i-- > 0; ) {
+        struct NetLink *link = &g_array_index(net->links, struct NetLink, i);
+        if (link->dump != net->dump) {
+            g_array_remove_index(net->links, i);
+        } else if (strcmp(link->pub.name, net->iface) == 0) {
+            net->rxspeed = link->pub.rxspeed;
+            net->txspeed = link->pub.txspeed;
+        }
+    }
+}
+
+// Parses the contents of /proc/PID/stat into proc (but not proc->pid).
+// Returns FALSE if it does not look right.
+static gboolean
+parse_proc_stat(struct Proc *proc, const char *buf, long page_size)
+{
+    // The command name is in parentheses, and can have any characters in it,
+    // even ')'. The rest of the fields come after the last ')'.
+    const char *open = strchr(buf, '(');
+    const char *close = strrchr(buf, ')');
+    if (G_UNLIKELY(!open || !close || close < open)) {
+        return FALSE;
+    }
+    gsize len = MIN((gsize) (close - open - 1), sizeof(proc->pub.name) - 1);
+    memcpy(proc->pub.name, open + 1, len);
+    proc->pub.name[len] = '\0';
+
+    // Fields 3 (the state) to 24 (rss), see proc(5). Fields that are not
+    // numbers, or are negative, come out as 0; we do not use them.
+    guint64 field[25];
+    const char *s = close + 1;
+    for (int i = 3; i < 25; i++) {
+        while (*s == ' ') s++;
+        guint64 v = 0;
+        while (g_ascii_isdigit(*s)) {
+            v = 10 * v + (*s++ - '0');
+        }
+        field[i] = v;
+        while (*s != ' ' && *s != '\n' && *s) s++;
+        if (G_UNLIKELY(*s != ' ' && i < 24)) {
+            return FALSE;
+        }
+    }
+
+    proc->ticks = field[14] + field[15];    // utime + stime
+    proc->start = field[22];                // starttime
+    proc->pub.rss = field[24] * page_size;  // rss (pages)
+    return TRUE;
+}
+
+// Reads the process with the directory entry name in /proc. Returns it, or
+// NULL if it cannot be read (it has exited).
+static struct Proc *
+procs_read(struct Procs *procs, const char *name, gint64 now)
+{
+    // "PID/stat", without going through printf.
+    char path[32];
+    gsize len = strlen(name);
+    if (len > sizeof(path) - sizeof("/stat")) {
+        return NULL;
+    }
+    memcpy(path, name, len);
+    memcpy(path + len, "/stat", sizeof("/stat"));
+
+    int fd = openat(dirfd(procs->dir), path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL; // It has just exited.
+    }
+    ssize_t n;
+    do {
+        n = read(fd, procs->buf, sizeof(procs->buf) - 1);
+    } while (n < 0 && errno == EINTR);
+    close(fd);
+    if (n <= 0) {
+        return NULL;
+    }
+    procs->buf[n] = '\0';
+
+    struct Proc key = { .pid = atoi(name) };
+    if (!parse_proc_stat(&key, procs->buf, procs->page_size)) {
+        return NULL;
+    }
+
+    struct Proc *proc = g_hash_table_lookup(procs->table, &key);
+    if (!proc) {
+        // We have not seen it yet, so we do not know its usage yet.
+        proc = g_new(struct Proc, 1);
+        *proc = key;
+        proc->pub.pid = key.pid;
+        proc->pub.cpu = 0;
+        g_hash_table_add(procs->table, proc);
+    } else if (proc->time >= procs->update) {
+        // Read already by this update, as one of the busiest.
+        proc->pass = procs->pass;
+        return proc;
+    } else {
+        double seconds = (now - proc->time) / 1e6;
+        proc->pub.cpu = (seconds > 1e-3 && key.ticks >= proc->ticks) ?
+            (double) (key.ticks - proc->ticks) / procs->clock_ticks / seconds : 0;
+        proc->ticks = key.ticks;
+        proc->pub.rss = key.pub.rss;
+        memcpy(proc->pub.name, key.pub.name, sizeof(proc->pub.name));
+    }
+    proc->time = now;
+    proc->pass = procs->pass;
+    return proc;
+}
+
+// Returns TRUE if process a is busier than process b.
+static inline gboolean
+proc_busier(const InfoProc *a, const InfoProc *b)
+{
+    return a->cpu > b->cpu || (a->cpu == b->cpu && a->rss > b->rss);
+}
+
+// Puts proc into the busiest processes if it is one of them.
+static inline void
+procs_select(struct Procs *procs, struct Proc *proc)
+{
+    // An insertion into a short sorted list. Most processes are idle, and
+    // do not get past the first comparison.
+    guint i = procs->ntop;
+    if (i == procs->top_size) {
+        if (!proc_busier(&proc->pub, &procs->top[i - 1]->pub)) {
+            return;
+        }
+        i--;    // The last one drops out.
+    } else {
+        procs->ntop++;
+    }
+    for (; i > 0 && proc_busier(&proc->pub, &procs->top[i - 1]->pub); i--) {
+        procs->top[i] = procs->top[i - 1];
+    }
+    procs->top[i] = proc;
+}
+
+static gboolean
+proc_exited(gpointer key, gpointer value, gpointer data)
+{
+    const struct Proc *proc = key;
+    const struct Procs *procs = data;
+    return proc->pass != procs->pass;
+}
+
+static void
+info_update_procs(Info *info)
+{
+    struct Procs *procs = &info->procs;
+    if (procs->top_size == 0 || !procs->dir) {
+        return;
+    }
+
+    // Read the busiest processes again, dropping the ones that have exited
+    // (or whose PID now belongs to another process).
+    gint64 now = g_get_monotonic_time();
+    procs->update = now;
+    for (guint i = 0; i < procs->ntop; i++) {
+        struct Proc *proc = procs->top[i];
+        char name[16];
+        g_snprintf(name, sizeof(name), "%d", proc->pid);
+        if (procs_read(procs, name, now) != proc) {
+            g_hash_table_remove(procs->table, proc);
+        }
+    }
+
+    // Carry on with the current pass, for as long as the budget allows.
+    gint64 end = now + PROCS_SCAN_BUDGET;
+    guint n = 0;
+    struct dirent *de;
+    while ((de = readdir(procs->dir))) {
+        if (g_ascii_isdigit(de->d_name[0])) {
+            procs_read(procs, de->d_name, now);
+        }
+        if (++n % 32 == 0 && (now = g_get_monotonic_time()) > end) {
+            break;
+        }
+    }
+    if (!de) {
+        // The end of the pass.
+        g_hash_table_foreach_remove(procs->table, proc_exited, procs);
+        procs->count = g_hash_table_size(procs->table);
+        procs->pass++;
+        rewinddir(procs->dir);
+    }
+
+    procs->ntop = 0;
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, procs->table);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        procs_select(procs, key);
+    }
+}
+
+// Returns the cgroup right above cg, or NULL if cg is the root of the subtree
+// (or its parent is not known yet).
+static struct Cgroup *
+cgroup_parent(struct Cgroups *cgroups, const struct Cgroup *cg)
+{
+    if (strcmp(cg->path, cgroups->subtree) == 0) {
+        return NULL;
+    }
+    const char *slash = strrchr(cg->path, '/');
+    char *path = g_strndup(cg->path, slash ? slash - cg->path : 0);
+    struct Cgroup *parent = g_hash_table_lookup(cgroups->paths, path);
+    g_free(path);
+    return parent;
+}
+
+// Watches the cgroup cg in directory dir for the cgroups created and removed
+// under it. If it cannot be, the tree is walked again later to try again.
+static void
+cgroup_watch(struct Cgroups *cgroups, struct Cgroup *cg, const char *dir)
+{
+    // IN_ONLYDIR as the watch goes on the path, not on the fd.
+    cg->wd = inotify_add_watch(cgroups->inotify_fd, dir,
+                               IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ONLYDIR);
+    if (cg->wd >= 0) {
+        g_hash_table_insert(cgroups->wds, GINT_TO_POINTER(cg->wd), cg);
+        return;
+    }
+    if (!cgroups->warned) {
+        g_warning("Cannot watch %s: %s. Looking for new cgroups now and then",
+                  dir, g_strerror(errno));
+        cgroups->warned = TRUE;
+    }
+    cgroups->unwatched++;
+}
+
+// Adds the cgroup at path, and the ones under it, or marks them as seen by
+// the current walk if they are there already.
+static void
+cgroups_add(struct Cgroups *cgroups, const char *path)
+{
+    struct Cgroup *cg = g_hash_table_lookup(cgroups->paths, path);
+    if (!cg) {
+        char *dir = g_build_filename(cgroups->dir, path, NULL);
+        int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            // Removed already, or we are out of fds.
+            g_free(dir);
+            return;
+        }
+        cg = g_new0(struct Cgroup, 1);
+        cg->path = g_strdup(path);
+        cg->dirfd = fd;
+        cg->wd = -1;
+        g_strlcpy(cg->pub.path, path, sizeof(cg->pub.path));
+
+        // Watch before listing, so that no cgroup created in between is
+        // missed.
+        if (cgroups->inotify_fd >= 0) cgroup_watch(cgroups, cg, dir);
+        g_free(dir);
+        g_hash_table_insert(cgroups->paths, cg->path, cg);
+        struct Cgroup *parent = cgroup_parent(cgroups, cg);
+        if (parent) parent->children++;
+    } else if (cg->wd < 0 && cgroups->inotify_fd >= 0) {
+        // Try again, as watches may have been freed since.
+        char *dir = g_build_filename(cgroups->dir, path, NULL);
+        cgroup_watch(cgroups, cg, dir);
+        g_free(dir);
+    }
+    cg->pass = cgroups->pass;
+
+    // A directory of its own, as listing moves the offset.
+    int fd = openat(cg->dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = (fd >= 0) ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd >= 0) close(fd);
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir))) {
+        if (de->d_type == DT_DIR && strcmp(de->d_name, ".") != 0 &&
+            strcmp(de->d_name, "..") != 0) {
+            char *child = *path ? g_strconcat(path, "/", de->d_name, NULL) :
+                                  g_strdup(de->d_name);
+            cgroups_add(cgroups, child);
+            g_free(child);
+        }
+    }
+    closedir(dir);
+}
+
+// Returns TRUE if the watch of cg is its own. A renamed cgroup is added
+// again under its new path before the old one is dropped, and inotify gives
+// both the same watch.
+static gboolean
+cgroup_watched(struct Cgroups *cgroups, const struct Cgroup *cg)
+{
+    return cg->wd >= 0 && g_hash_table_lookup(cgroups->wds, GINT_TO_POINTER(cg->wd)) == cg;
+}
+
+// Forgets cg, which has been removed.
+static void
+cgroups_remove(struct Cgroups *cgroups, struct Cgroup *cg)
+{
+    struct Cgroup *parent = cgroup_parent(cgroups, cg);
+    if (parent && parent->children > 0) parent->children--;
+    if (cgroup_watched(cgroups, cg)) {
+        inotify_rm_watch(cgroups->inotify_fd, cg->wd);
+        g_hash_table_remove(cgroups->wds, GINT_TO_POINTER(cg->wd));
+    }
+    g_hash_table_remove(cgroups->paths, cg->path);
+}
+
+static gboolean
+cgroup_gone(gpointer key, gpointer value, gpointer data)
+{
+    struct Cgroup *cg = value;
+    struct Cgroups *cgroups = data;
+    if (cg->pass == cgroups->pass) {
+        return FALSE;
+    }
+    if (cgroup_watched(cgroups, cg)) {
+        inotify_rm_watch(cgroups->inotify_fd, cg->wd);
+        g_hash_table_remove(cgroups->wds, GINT_TO_POINTER(cg->wd));
+    }
+    return TRUE;
+}
+
+// Walks the subtree, adding the cgroups that are new and dropping the ones
+// that are gone. now is the monotonic time.
+static void
+cgroups_walk(struct Cgroups *cgroups, gint64 now)
+{
+    cgroups->pass++;
+    cgroups->unwatched = 0;
+    cgroups_add(cgroups, cgroups->subtree);
+    g_hash_table_foreach_remove(cgroups->paths, cgroup_gone, cgroups);
+
+    // Count the children again, as parents and children went in any order.
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, cgroups->paths);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        ((struct Cgroup *) value)->children = 0;
+    }
+    g_hash_table_iter_init(&iter, cgroups->paths);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        struct Cgroup *parent = cgroup_parent(cgroups, value);
+        if (parent) parent->children++;
+    }
+    cgroups->walk = FALSE;
+
+    // Back off while watches are short, as each walk tries them all again.
+    if (cgroups->unwatched > 0) {
+        cgroups->retry_delay = cgroups->retry_delay ?
+                               MIN(2 * cgroups->retry_delay, CGROUPS_RETRY_MAX) :
+                               CGROUPS_RETRY_MIN;
+        cgroups->retry_time = now + cgroups->retry_delay;
+    } else {
+        cgroups->retry_delay = 0;
+        cgroups->retry_time = 0;
+    }
+}
+
+// Applies the events inotify has queued since the last update.
+static void
+cgroups_read_events(struct Cgroups *cgroups)
+{
+    ssize_t n;
+    while ((n = read(cgroups->inotify_fd, cgroups->u.buf, sizeof(cgroups->u.buf))) > 0) {
+        const struct inotify_event *event;
+        for (char *p = cgroups->u.buf; p < cgroups->u.buf + n; p += sizeof(*event) + event->len) {
+            event = (const struct inotify_event *) p;
+            struct Cgroup *cg = g_hash_table_lookup(cgroups->wds, GINT_TO_POINTER(event->wd));
+            if (event->mask & IN_Q_OVERFLOW) {
+                cgroups->walk = TRUE;
+            } else if (!cg) {
+                continue;
+            } else if (event->mask & IN_IGNORED) {
+                // It is gone, and so is the watch (the root of the subtree
+                // has no parent to tell).
+                g_hash_table_remove(cgroups->wds, GINT_TO_POINTER(cg->wd));
+                cg->wd = -1;
+                cgroups_remove(cgroups, cg);
+            } else if (!(event->mask & IN_ISDIR)) {
+                continue;
+            } else if (event->mask & IN_MOVED_FROM) {
+                // Renamed: the paths of the cgroups under it change.
+                cgroups->walk = TRUE;
+            } else {
+                char *child = *cg->path ? g_strconcat(cg->path, "/", event->name, NULL) :
+                                          g_strdup(event->name);
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    cgroups_add(cgroups, child);
+                } else if (event->mask & IN_DELETE) {
+                    // The directory we hold keeps it from being deleted for
+                    // good, so this is the only event there is.
+                    struct Cgroup *gone = g_hash_table_lookup(cgroups->paths, child);
+                    if (gone) cgroups_remove(cgroups, gone);
+                }
+                g_free(child);
+            }
+        }
+    }
+}
+
+// Reads file in the directory of cg into Cgroups.u.buf. Returns the
+// contents, or NULL if the file cannot be read (e.g. when its controller is
+// not enabled for the cgroup).
+static const char *
+cgroup_read(struct Cgroups *cgroups, const struct Cgroup *cg, const char *file)
+{
+    int fd = openat(cg->dirfd, file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    ssize_t n;
+    do {
+        n = read(fd, cgroups->u.buf, sizeof(cgroups->u.buf) - 1);
+    } while (n < 0 && errno == EINTR);
+    close(fd);
+    if (n < 0) {
+        return NULL;
+    }
+    cgroups->u.buf[n] = '\0';
+    return cgroups->u.buf;
+}
+
+// Reads the usage of cg, and works out the rates since the last read.
+static void
+cgroup_update(struct Cgroups *cgroups, struct Cgroup *cg, gint64 now)
+{
+    const char *s;
+    guint64 usage = 0;
+    guint64 rbytes = 0;
+    guint64 wbytes = 0;
+
+    // "usage_usec 123456\nuser_usec ..."
+    if ((s = cgroup_read(cgroups, cg, "cpu.stat")) && strncmp(s, "usage_usec ", 11) == 0) {
+        usage = parse_number(s + 11, &s);
+    }
+    s = cgroup_read(cgroups, cg, "memory.current");
+    cg->pub.memory = s ? parse_number(s, &s) : 0;
+    // A number, or "max".
+    s = cgroup_read(cgroups, cg, "memory.max");
+    cg->pub.memory_max = (s && g_ascii_isdigit(*s)) ? parse_number(s, &s) : G_MAXUINT64;
+    // "8:0 rbytes=1024 wbytes=2048 rios=1 wios=2 dbytes=0 dios=0", a line
+    // per device.
+    for (s = cgroup_read(cgroups, cg, "io.stat"); s && *s; ) {
+        if (strncmp(s, "rbytes=", 7) == 0) {
+            rbytes += parse_number(s + 7, &s);
+        } else if (strncmp(s, "wbytes=", 7) == 0) {
+            wbytes += parse_number(s + 7, &s);
+        } else {
+            while (*s && *s != ' ' && *s != '\n') s++;
+        }
+        while (*s == ' ' || *s == '\n') s++;
+    }
+
+    double seconds = cg->time ? (now - cg->time) / 1e6 : 0;
+    if (seconds > 1e-3) {
+        cg->pub.cpu = (usage >= cg->usage) ? (usage - cg->usage) / 1e6 / seconds : 0;
+        cg->pub.read_bytes = (rbytes >= cg->rbytes) ? (rbytes - cg->rbytes) / seconds : 0;
+        cg->pub.write_bytes = (wbytes >= cg->wbytes) ? (wbytes - cg->wbytes) / seconds : 0;
+    }
+    cg->usage = usage;
+    cg->rbytes = rbytes;
+    cg->wbytes = wbytes;
+    cg->time = now;
+}
+
+// Returns TRUE if cgroup a is busier than cgroup b.
+static inline gboolean
+cgroup_busier(const InfoCgroup *a, const InfoCgroup *b)
+{
+    return a->cpu > b->cpu || (a->cpu == b->cpu && a->memory > b->memory);
+}
+
+// Puts cg into the busiest cgroups if it is one of them (see procs_select()).
+static inline void
+cgroups_select(struct Cgroups *cgroups, const InfoCgroup *cg)
+{
+    guint i = cgroups->ntop;
+    if (i == cgroups->top_size) {
+        if (!cgroup_busier(cg, &cgroups->top[i - 1])) {
+            return;
+        }
+        i--;
+    } else {
+        cgroups->ntop++;
+    }
+    for (; i > 0 && cgroup_busier(cg, &cgroups->top[i - 1]); i--) {
+        cgroups->top[i] = cgroups->top[i - 1];
+    }
+    cgroups->top[i] = *cg;
+}
+
+static void
+info_update_cgroups(Info *info)
+{
+    struct Cgroups *cgroups = &info->cgroups;
+    if (cgroups->top_size == 0) {
+        return;
+    }
+
+    if (cgroups->inotify_fd >= 0) {
+        cgroups_read_events(cgroups);
+    }
+    gint64 now = g_get_monotonic_time();
+    if (cgroups->walk || cgroups->inotify_fd < 0 ||
+        (cgroups->unwatched > 0 && now >= cgroups->retry_time)) {
+        cgroups_walk(cgroups, now);
+    }
+
+    // Processes only live at the bottom of the tree (or at its root), and
+    // the usage of a cgroup includes the usage of the ones under it, so
+    // only the cgroups without children are read and ranked.
+    cgroups->ntop = 0;
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, cgroups->paths);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        struct Cgroup *cg = value;
+        if (cg->children > 0) {
+            cg->time = 0;   // The rates start over if it becomes a leaf.
+            continue;
+        }
+        cgroup_update(cgroups, cg, now);
+        cgroups_select(cgroups, &cg->pub);
+    }
+}
+
+// Sets the clock to time (us since the epoch). Breaking a time down looks at
+// the time zone, so it is only done when the local minute changes (or the
+// time goes back); in between only the seconds move. tzset() first picks up
+// a change of TZ, and costs nothing otherwise.
+static void
+clock_set(struct Clock *clock, gint64 time)
+{
+    gint64 sec = time / G_USEC_PER_SEC;
+    if (sec >= clock->sec && sec < clock->until) {
+        clock->tm.tm_sec += sec - clock->sec;
+        clock->sec = sec;
+        return;
+    }
+
+    time_t t = sec;
+    tzset();
+    localtime_r(&t, &clock->tm);
+    clock->sec = sec;
+    clock->until = sec + 60 - MIN(clock->tm.tm_sec, 59);
+}
+
+static void
+info_update_time(Info *info)
+{
+    info->time = g_get_real_time();
+    clock_set(&info->clock, info->time);
+}
+
+static void
+info_update_uptime(Info *info)
+{
+    char *buf = source_read(&info->uptime_src);
+    if (G_UNLIKELY(!buf)) {
+        info->uptime = 0;
+        return;
+    }
+
+    // Uptime has fractional seconds, but we are not interested in that.
+    info->uptime = g_ascii_strtoull(buf, NULL, 10);
+}
+
+// Updates dev with the fields of its line in /proc/diskstats, read dt
+// seconds after the previous read.
+static void
+disk_update(struct DiskDevice *dev, const guint64 fields[DISK_FIELDS],
+            guint64 pass, double dt)
+{
+    guint64 d[DISK_COUNTERS];
+    for (int i = 0; i < DISK_COUNTERS; i++) {
+        guint64 v = fields[disk_fields[i]];
+        // The counters are unsigned longs, which wrap on 32-bit systems.
+        d[i] = v >= dev->counters[i] ? v - dev->counters[i] : 0;
+        dev->counters[i] = v;
+    }
+    dev->known = (dev->pass == pass - 1 && dt > 0);
+    dev->pass = pass;
+    if (!dev->known) {
+        return;
+    }
+
+    InfoDiskIO *io = &dev->io;
+    io->read_bytes = d[DISK_READ_SECTORS] * 512.0 / dt;
+    io->write_bytes = d[DISK_WRITE_SECTORS] * 512.0 / dt;
+    io->read_iops = d[DISK_READS] / dt;
+    io->write_iops = d[DISK_WRITES] / dt;
+    io->util = MIN(1.0, d[DISK_IO_MS] / (dt * 1000));
+    guint64 ios = d[DISK_READS] + d[DISK_WRITES];
+    io->await = ios ? (double) (d[DISK_READ_MS] + d[DISK_WRITE_MS]) / ios : 0;
+}
+
+static void
+info_update_disks(Info *info)
+{
+    struct Disks *disks = &info->disks;
+    const char *s = disks->mounts->len ? source_read(&disks->src) : NULL;
+    gint64 now = g_get_monotonic_time();
+    double dt = disks->time ? (now - disks->time) / 1e6 : 0;
+    disks->time = s ? now : 0;
+    disks->pass++;
+
+    // "   8       1 sda1 12345 67 ...", a line per device.
+    while (s && *s) {
+        parse_number(s, &s);
+        parse_number(s, &s);
+        while (*s == ' ') s++;
+        const char *name = s;
+        while (*s != ' ' && *s != '\n' && *s) s++;
+
+        char key[DISK_NAME_SIZE];
+        gsize len = s - name;
+        struct DiskDevice *dev = NULL;
+        if (len < sizeof(key)) {
+            memcpy(key, name, len);
+            key[len] = '\0';
+            dev = g_hash_table_lookup(disks->devices, key);
+        }
+        if (dev) {
+            guint64 fields[DISK_FIELDS];
+            for (int i = 0; i < DISK_FIELDS; i++) {
+                fields[i] = parse_number(s, &s);
+            }
+            disk_update(dev, fields, disks->pass, dt);
+        }
+        s = skip_line(s);
+    }
+
+    for (guint i = 0; i < disks->mounts->len; i++) {
+        struct DiskMount *m = &g_array_index(disks->mounts, struct DiskMount, i);
+        m->known = (m->dev->known && m->dev->pass == disks->pass);
+        if (!m->known) {
+            continue;
+        }
+        // The time a stacked device has I/O in flight says little about how
+        // busy the disks are, so take the busiest one.
+        m->io = m->dev->io;
+        gboolean disk_known = FALSE;
+        for (guint j = 0; j < m->disks->len; j++) {
+            const struct DiskDevice *disk = m->disks->pdata[j];
+            if (disk->known && disk->pass == disks->pass) {
+                m->io.util = disk_known ? MAX(m->io.util, disk->io.util) : disk->io.util;
+                disk_known = TRUE;
+            }
+        }
+    }
+}
+
+static void
+info_update_pressure(Info *info)
+{
+    struct Pressure *p = &info->pressure;
+    gint64 now = g_get_monotonic_time();
+
+    for (int i = 0; i < INFO_PRESSURES; i++) {
+        const char *s = source_read(&p->src[i]);
+        InfoPressure *v = &p->values[i];
+        p->known[i] = (s != NULL);
+        v->some = v->full = 0;
+
+        // "some avg10=1.23 avg60=0.45 avg300=0.06 total=12345", and the same
+        // for "full" (but not for the CPU before Linux 5.13).
+        for (; s && *s; s = skip_line(s)) {
+            double *value = (strncmp(s, "some ", 5) == 0) ? &v->some :
+                            (strncmp(s, "full ", 5) == 0) ? &v->full : NULL;
+            if (value && strncmp(s + 5, "avg10=", 6) == 0) {
+                *value = g_ascii_strtod(s + 11, NULL) / 100;
+            }
+        }
+        v->stalled = (p->fired[i] > 0 && now - p->fired[i] < p->trigger_window[i]);
+    }
+}
+
+// Sets up a trigger on fd, a pressure file, for some stall of stall us within
+// window us.
+static gboolean
+pressure_trigger(int fd, gint64 stall, gint64 window)
+{
+    char buf[64];
+    // The kernel wants the NUL too.
+    int n = 1 + g_snprintf(buf, sizeof(buf), "some %" G_GINT64_FORMAT " %" G_GINT64_FORMAT,
+                           stall, window);
+    return write(fd, buf, n) == n;
+}
+
+// Opens the pressure files again, with a trigger each, for the sampler to
+// poll. Without CAP_SYS_RESOURCE, Linux 6.5 and later only take windows that
+// are multiples of PRESSURE_WINDOW_STEP, so a window that is not is rounded
+// up to one (with the stall scaled to match) if the kernel refuses it. Older
+// kernels only let root write /proc/pressure.
+static void
+pressure_arm(Info *info)
+{
+    struct Pressure *p = &info->pressure;
+    gint64 window = (p->window + PRESSURE_WINDOW_STEP - 1) /
+                    PRESSURE_WINDOW_STEP * PRESSURE_WINDOW_STEP;
+    gint64 stall = p->stall * window / MAX(1, p->window);
+
+    for (int i = 0; p->window > 0 && i < INFO_PRESSURES; i++) {
+        int fd = open(p->src[i].path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        if (pressure_trigger(fd, p->stall, p->window)) {
+            p->trigger_fd[i] = fd;
+            p->trigger_window[i] = p->window;
+        } else if (window != p->window && pressure_trigger(fd, stall, window)) {
+            p->trigger_fd[i] = fd;
+            p->trigger_window[i] = window;
+        } else {
+            close(fd);
+        }
+    }
+}
+
+// Returns a new ring of n values that are all NAN (no value).
+static float *
+history_ring_new(gsize n)
+{
+    float *ring = g_new(float, n);
+    for (gsize i = 0; i < n; i++) {
+        ring[i] = NAN;
+    }
+    return ring;
+}
+
+// Makes the CPU rows of h ncpu long. The new CPUs have no history.
+static void
+history_resize_cpu(struct History *h, int ncpu)
+{
+    float *cpu = history_ring_new((gsize) h->size * ncpu);
+    for (guint i = 0; i < h->size; i++) {
+        memcpy(cpu + (gsize) i * ncpu, h->cpu + (gsize) i * h->ncpu, h->ncpu * sizeof(float));
+    }
+    g_free(h->cpu);
+    h->cpu = cpu;
+    h->ncpu = ncpu;
+}
+
+// Pushes the values of snap. This only allocates when a CPU or a mount is
+// seen for the first time.
+static void
+history_push(struct History *h, InfoSnapshot *snap)
+{
+    if (h->size == 0) {
+        return;
+    }
+
+    g_mutex_lock(&h->lock);
+    if (h->ncpu < snap->ncpu) {
+        history_resize_cpu(h, snap->ncpu);
+    }
+
+    guint pos = h->count % h->size;
+    float *row = h->cpu + (gsize) pos * h->ncpu;
+    double total = 0;
+    for (int i = 0; i < snap->ncpu; i++) {
+        row[i] = snap->cpu_usage[i];
+        total += snap->cpu_usage[i];
+    }
+
+    float *m = h->metrics + pos;
+    m[INFO_HISTORY_CPU * h->size] = snap->ncpu ? total / snap->ncpu : NAN;
+    m[INFO_HISTORY_MEM * h->size] = snap->mem;
+    m[INFO_HISTORY_SWAP * h->size] = snap->swap;
+    m[INFO_HISTORY_RX * h->size] = snap->rxspeed;
+    m[INFO_HISTORY_TX * h->size] = snap->txspeed;
+
+    for (guint i = 0; snap->fs_stats && i < snap->fs_stats->len; i++) {
+        struct FsStat *fs = snap->fs_stats->pdata[i];
+        if (G_UNLIKELY(!fs->history)) {
+            fs->history = history_ring_new(h->size);
+        }
+        fs->history[pos] = snap->fs[i].stale ? NAN : (float) snap->fs[i].free;
+    }
+
+    snap->history_count = ++h->count;
+    g_mutex_unlock(&h->lock);
+}
+
+// Copies the last n values of a ring up to snap into values, oldest first.
+// stride: The distance between consecutive values in ring (in floats).
+// Values that are not (or no longer) in the history are NAN.
+// Call with the history lock held.
+static void
+history_copy(InfoSnapshot *snap, const float *ring, gsize stride,
+             float *values, guint n)
+{
+    struct History *h = snap->history;
+    // The oldest value still in the history, and the end of the snapshot's.
+    guint64 oldest = h->count > h->size ? h->count - h->size : 0;
+    guint64 end = snap->history_count;
+
+    for (guint i = 0; i < n; i++) {
+        // The value for values[i] is number end - n + i.
+        if (end + i < n || end + i - n < oldest) {
+            values[i] = NAN;
+        } else {
+            values[i] = ring[((end + i - n) % h->size) * stride];
+        }
+    }
+}
+
+// Copies the current values into the back snapshot, and makes it the
+// middle (published) one.
+static void
+info_publish(Info *info)
+{
+    InfoSnapshot *snap = &info->snaps[info->back];
+
+    snap->time = info->time;
+    snap->local_time = info->clock.tm;
+    snap->uptime = info->uptime;
+
+    if (snap->cpu_size < info->cpu.n) {
+        snap->cpu_size = info->cpu.size;
+        snap->cpu_usage = g_renew(double, snap->cpu_usage, snap->cpu_size);
+        snap->cpu_times = g_renew(double, snap->cpu_times,
+                                  (gsize) snap->cpu_size * INFO_CPU_STATES);
+    }
+    snap->ncpu = info->cpu.n;
+    memcpy(snap->cpu_usage, info->cpu.usage, info->cpu.n * sizeof(double));
+    memcpy(snap->cpu_times, info->cpu.times,
+           (gsize) info->cpu.n * INFO_CPU_STATES * sizeof(double));
+    memcpy(snap->cpu_all_times, info->cpu.all_times, sizeof(snap->cpu_all_times));
+    snap->ctxt_rate = info->cpu.ctxt_rate;
+    snap->intr_rate = info->cpu.intr_rate;
+    snap->procs_running = info->cpu.procs_running;
+    snap->procs_blocked = info->cpu.procs_blocked;
+    memcpy(snap->pressure_known, info->pressure.known, sizeof(snap->pressure_known));
+    memcpy(snap->pressure, info->pressure.values, sizeof(snap->pressure));
+
+    snap->meminfo = info->meminfo;
+    snap->mem = info->mem;
+    snap->swap = info->swap;
+    snap->rxspeed = info->net.rxspeed;
+    snap->txspeed = info->net.txspeed;
+
+    GArray *links = info->net.links;
+    if (snap->net_size < links->len) {
+        snap->net_size = links->len;
+        snap->net = g_renew(InfoNetIface, snap->net, snap->net_size);
+    }
+    snap->nnet = links->len;
+    for (guint i = 0; i < links->len; i++) {
+        snap->net[i] = g_array_index(links, struct NetLink, i).pub;
+    }
+
+    struct Procs *procs = &info->procs;
+    if (snap->top_size < procs->top_size) {
+        snap->top_size = procs->top_size;
+        snap->top = g_renew(InfoProc, snap->top, snap->top_size);
+    }
+    snap->ntop = procs->ntop;
+    snap->nprocs = procs->count;
+    for (guint i = 0; i < procs->ntop; i++) {
+        snap->top[i] = procs->top[i]->pub;
+    }
+
+    struct Cgroups *cgroups = &info->cgroups;
+    if (snap->cgroup_top_size < cgroups->top_size) {
+        snap->cgroup_top_size = cgroups->top_size;
+        snap->cgroup_top = g_renew(InfoCgroup, snap->cgroup_top, snap->cgroup_top_size);
+    }
+    snap->cgroup_ntop = cgroups->ntop;
+    snap->ncgroups = g_hash_table_size(cgroups->paths);
+    memcpy(snap->cgroup_top, cgroups->top, cgroups->ntop * sizeof(InfoCgroup));
+
+    if (snap->mounts != info->mounts) {
+        if (snap->mounts) {
+            g_hash_table_unref(snap->mount_index);
+            g_ptr_array_unref(snap->mounts);
+            g_ptr_array_unref(snap->fs_stats);
+        }
+        snap->mounts = g_ptr_array_ref(info->mounts);
+        snap->mount_index = g_hash_table_ref(info->mount_index);
+        snap->fs_stats = g_ptr_array_ref(info->fs);
+    }
+    if (snap->fs_size < info->fs->len) {
+        snap->fs_size = info->fs->len;
+        snap->fs = g_renew(struct FsValue, snap->fs, snap->fs_size);
+    }
+    gint64 now = g_get_monotonic_time();
+    for (guint i = 0; i < info->fs->len; i++) {
+        struct FsStat *fs = info->fs->pdata[i];
+        g_mutex_lock(&fs->lock);
+        snap->fs[i].free = fs->free;
+        snap->fs[i].stale = (fs->time == 0 || fs->failed ||
+                             (fs->started && now - fs->started > FS_TIMEOUT));
+        g_mutex_unlock(&fs->lock);
+        // The disks are mapped along with the mounts.
+        const struct DiskMount *m = &g_array_index(info->disks.mounts, struct DiskMount, i);
+        snap->fs[i].io_known = m->known;
+        snap->fs[i].io = m->io;
+    }
+
+    history_push(&info->history, snap);
+
+    // Publish. The old middle buffer is ours to fill next time.
+    int old;
+    do {
+        old = g_atomic_int_get(&info->middle);
+    } while (!g_atomic_int_compare_and_exchange(&info->middle, old,
+                                                info->back | SNAPSHOT_FRESH));
+    info->back = old & SNAPSHOT_INDEX;
+
+    // The sampler only changes the back buffer, so snap stays intact until
+    // the next update.
+    if (info->snapshot_func) {
+        info->snapshot_func(snap, info->snapshot_data);
+    }
+    if (info->watch && !g_atomic_int_get(&info->paused)) {
+        // This is thread-safe, and wakes up the main context.
+        g_source_set_ready_time(info->watch, 0);
+    }
+}
+
+// The collectors, in the order they run (mounts before fs).
+static void (* const collectors[INFO_COLLECTORS])(Info *info) = {
+    [INFO_CPU] = info_update_cpu,
+    [INFO_MEM] = info_update_mem_swap,
+    [INFO_MOUNTS] = info_update_mounts,
+    [INFO_FS] = info_update_fs,
+    [INFO_NET] = info_update_net,
+    [INFO_PROCS] = info_update_procs,
+    [INFO_UPTIME] = info_update_uptime,
+    [INFO_DISKS] = info_update_disks,
+    [INFO_PRESSURE] = info_update_pressure,
+    [INFO_CGROUPS] = info_update_cgroups,
+};
+
+// Reads the Sources of the collectors that are about to run (run[i]) with
+// one system call, for source_read() to find. Without an io_uring, or for a
+// single Source, source_read() reads them itself.
+static void
+info_read_batch(Info *info, const gboolean run[INFO_COLLECTORS])
+{
+    // Forget what the last batch read, in case a collector did not call
+    // source_read() for it (e.g. INFO_DISKS without mounts), so it is never
+    // taken for what the file holds now.
+    GPtrArray *sources = info->sources;
+    for (guint i = 0; i < sources->len; i++) {
+        ((struct Source *) sources->pdata[i])->batched = -1;
+    }
+    if (!info->uring) {
+        return;
+    }
+
+    // The buffers grow now and then (see source_read()). Register them again
+    // when they do.
+    gboolean moved = FALSE;
+    for (guint i = 0; i < sources->len; i++) {
+        struct Source *src = sources->pdata[i];
+        moved |= (info->iovs[i].iov_base != src->buf || info->iovs[i].iov_len != src->size);
+    }
+    if (moved) {
+        for (guint i = 0; i < sources->len; i++) {
+            struct Source *src = sources->pdata[i];
+            info->iovs[i] = (struct iovec) { .iov_base = src->buf, .iov_len = src->size };
+        }
+        info->fixed = uring_register_buffers(info->uring, info->iovs, sources->len);
+    }
+
+    guint n = 0;
+    for (guint i = 0; i < sources->len; i++) {
+        struct Source *src = sources->pdata[i];
+        if (run[src->collector] && src->fd >= 0) {
+            info->reads[n++] = (UringRead) {
+                .fd = src->fd,
+                .buf = src->buf,
+                .len = src->size - 1,
+                .buf_index = info->fixed ? (int) i : -1,
+                .data = src,
+            };
+        }
+    }
+    if (n < 2) {
+        return;
+    }
+
+    if (!uring_read(info->uring, info->reads, n)) {
+        g_warning("io_uring failed, reading the files one at a time");
+        info->uring = (uring_free(info->uring), NULL);
+    }
+    for (guint i = 0; i < n; i++) {
+        ((struct Source *) info->reads[i].data)->batched = info->reads[i].res;
+    }
+}
+
+// Runs the collectors in mask (of 1 << InfoCollector) that are due at now
+// (all of them if all is TRUE), and publishes a snapshot.
+static void
+info_collect(Info *info, gint64 now, gboolean all, guint mask)
+{
+    gboolean run[INFO_COLLECTORS];
+    for (int i = 0; i < INFO_COLLECTORS; i++) {
+        run[i] = (mask & (1u << i)) && (all || info->due[i] <= now);
+    }
+
+    gint64 t = prof_start(info->prof);
+    info_read_batch(info, run);
+    prof_lap(info->prof, PROF_READ, &t);
+    for (int i = 0; i < INFO_COLLECTORS; i++) {
+        if (!run[i]) {
+            continue;
+        }
+
+        collectors[i](info);
+        prof_lap(info->prof, i, &t);
+
+        // Run next at the first multiple of the period after now, so that
+        // e.g. a 1 s period runs right after each second of the wall clock.
+        // This also skips the runs missed while falling behind (e.g. suspend).
+        info->due[i] = (now / info->period[i] + 1) * info->period[i];
+    }
+
+    info_update_time(info);
+    prof_lap(info->prof, PROF_TIME, &t);
+    info_publish(info);
+    prof_lap(info->prof, PROF_PUBLISH, &t);
+}
+
+void
+info_update(Info *info)
+{
+    info_collect(info, g_get_real_time(), TRUE, ALL_COLLECTORS);
+}
+
+void
+info_replay(Info *info, const InfoValues *values)
+{
+    g_return_if_fail(info->sampler == NULL);
+
+    struct Cpu *cpu = &info->cpu;
+    cpu_resize(cpu, values->ncpu);
+    cpu->n = values->ncpu;
+    memset(cpu->times, 0, (gsize) cpu->n * INFO_CPU_STATES * sizeof(double));
+    memset(cpu->all_times, 0, sizeof(cpu->all_times));
+    double sum = 0;
+    for (int i = 0; i < cpu->n; i++) {
+        double usage = CLAMP(values->cpu_usage[i], 0, 1);
+        cpu->usage[i] = usage;
+        cpu->times[i * INFO_CPU_STATES + INFO_CPU_USER] = usage;
+        cpu->times[i * INFO_CPU_STATES + INFO_CPU_IDLE] = 1 - usage;
+        sum += usage;
+    }
+    if (cpu->n > 0) {
+        cpu->all_times[INFO_CPU_USER] = sum / cpu->n;
+        cpu->all_times[INFO_CPU_IDLE] = 1 - sum / cpu->n;
+    }
+
+    info->mem = values->mem;
+    info->swap = values->swap;
+    info->net.rxspeed = values->rxspeed;
+    info->net.txspeed = values->txspeed;
+
+    info->time = values->time;
+    clock_set(&info->clock, info->time);
+
+    info_publish(info);
+}
+
+void
+info_set_period(Info *info, InfoCollector collector, guint period_ms)
+{
+    g_return_if_fail(info->sampler == NULL);
+    g_return_if_fail(collector < INFO_COLLECTORS);
+
+    info->period[collector] = MAX(1, period_ms) * G_TIME_SPAN_MILLISECOND;
+}
+
+void
+info_set_top_procs(Info *info, guint n)
+{
+    g_return_if_fail(info->sampler == NULL);
+
+    struct Procs *procs = &info->procs;
+    procs->top_size = n;
+    procs->top = g_renew(struct Proc *, procs->top, n);
+    procs->ntop = MIN(procs->ntop, n);
+}
+
+void
+info_set_cgroups(Info *info, const char *subtree, guint n)
+{
+    g_return_if_fail(info->sampler == NULL);
+
+    struct Cgroups *cgroups = &info->cgroups;
+    g_hash_table_remove_all(cgroups->wds);
+    g_hash_table_remove_all(cgroups->paths);
+    if (cgroups->inotify_fd >= 0) {
+        cgroups->inotify_fd = (close(cgroups->inotify_fd), -1);
+    }
+    if (n > 0) {
+        cgroups->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+
+    // Without the slashes around it, so that paths can be joined.
+    const char *start = subtree ? subtree : "";
+    while (*start == '/') start++;
+    gsize len = strlen(start);
+    while (len > 0 && start[len - 1] == '/') len--;
+    g_free(cgroups->subtree);
+    cgroups->subtree = g_strndup(start, len);
+
+    cgroups->top_size = n;
+    cgroups->top = g_renew(InfoCgroup, cgroups->top, n);
+    cgroups->ntop = 0;
+    cgroups->walk = TRUE;
+    cgroups->unwatched = 0;
+    cgroups->retry_delay = 0;
+    cgroups->retry_time = 0;
+}
+
+void
+info_set_pressure_cgroup(Info *info, const char *cgroup)
+{
+    g_return_if_fail(info->sampler == NULL);
+
+    for (int i = 0; i < INFO_PRESSURES; i++) {
+        struct Source *src = &info->pressure.src[i];
+        source_close(src);
+        g_free(src->path);
+        src->path = cgroup ?
+            g_strdup_printf("%s/sys/fs/cgroup/%s/%s.pressure", info->root, cgroup,
+                            pressure_names[i]) :
+            g_strdup_printf("%s/proc/pressure/%s", info->root, pressure_names[i]);
+        src->fd = open(src->path, O_RDONLY | O_CLOEXEC);
+    }
+}
+
+void
+info_set_pressure_trigger(Info *info, guint stall_ms, guint window_ms)
+{
+    g_return_if_fail(info->sampler == NULL);
+
+    info->pressure.stall = (gint64) stall_ms * G_TIME_SPAN_MILLISECOND;
+    info->pressure.window = (gint64) window_ms * G_TIME_SPAN_MILLISECOND;
+}
+
+gboolean
+info_set_io_uring(Info *info, gboolean use)
+{
+    g_return_val_if_fail(info->sampler == NULL, FALSE);
+
+    if (use && !info->uring) {
+        guint n = info->sources->len;
+        info->uring = uring_new(n);
+        info->reads = g_renew(UringRead, info->reads, n);
+        // Registered on the first batch.
+        info->iovs = g_renew(struct iovec, info->iovs, n);
+        memset(info->iovs, 0, n * sizeof(struct iovec));
+        info->fixed = FALSE;
+    } else if (!use && info->uring) {
+        info->uring = (uring_free(info->uring), NULL);
+    }
+    return info->uring != NULL;
+}
+
+Prof *
+info_enable_prof(Info *info)
+{
+    if (!info->prof) {
+        info->prof = prof_new("update", prof_stages, PROF_STAGES);
+    }
+    return info->prof;
+}
+
+void
+info_set_history(Info *info, guint length)
+{
+    g_return_if_fail(info->sampler == NULL);
+
+    struct History *h = &info->history;
+    g_mutex_lock(&h->lock);
+    g_free(h->metrics);
+    g_free(h->cpu);
+    h->size = length;
+    h->count = 0;
+    h->metrics = length ? history_ring_new((gsize) length * INFO_HISTORY_METRICS) : NULL;
+    h->cpu = NULL;
+    h->ncpu = 0;
+    g_mutex_unlock(&h->lock);
+}
+
+// Arms the sampler's timer for the earliest of the collectors in mask, or
+// disarms it if there are none.
+// Returns the time it was armed for, or -1.
+static gint64
+sampler_arm(Info *info, guint mask)
+{
+    gint64 next = -1;
+    for (int i = 0; i < INFO_COLLECTORS; i++) {
+        if (mask & (1u << i)) {
+            next = (next < 0) ? info->due[i] : MIN(next, info->due[i]);
+        }
+    }
+
+    // The timer is on the wall clock, and the kernel tells us (ECANCELED)
+    // when that is set.
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+    if (next >= 0) {
+        its.it_value.tv_sec = next / G_USEC_PER_SEC;
+        its.it_value.tv_nsec = (next % G_USEC_PER_SEC) * 1000;
+    }
+    timerfd_settime(info->timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL);
+    return next;
+}
+
+static gpointer
+info_sampler(gpointer data)
+{
+    Info *info = data;
+    guint running = ALL_COLLECTORS;
+
+    prctl(PR_SET_TIMERSLACK, (unsigned long) SAMPLER_SLACK * 1000, 0, 0, 0);
+
+    while (!g_atomic_int_get(&info->stopping)) {
+        // Through a pause, only the collectors the snapshot function (the
+        // recording) needs go on.
+        guint run = g_atomic_int_get(&info->paused) ? info->snapshot_collectors :
+                                                      ALL_COLLECTORS;
+        if (running != ALL_COLLECTORS && run == ALL_COLLECTORS) {
+            // Catch up with a single run of everything.
+            info_collect(info, g_get_real_time(), TRUE, ALL_COLLECTORS);
+        }
+        running = run;
+        sampler_arm(info, running);
+
+        // poll() skips the fds of the triggers that are not there (-1).
+        struct pollfd fds[2 + INFO_PRESSURES] = {
+            { .fd = info->control_fd, .events = POLLIN },
+            { .fd = info->timer_fd, .events = POLLIN },
+        };
+        for (int i = 0; i < INFO_PRESSURES; i++) {
+            fds[2 + i] = (struct pollfd) { .fd = info->pressure.trigger_fd[i], .events = POLLPRI };
+        }
+        if (poll(fds, G_N_ELEMENTS(fds), -1) < 0) {
+            continue;
+        }
+
+        guint64 n;
+        if (fds[0].revents & POLLIN) {
+            while (read(info->control_fd, &n, sizeof(n)) < 0 && errno == EINTR);
+        }
+        // A trigger that fired makes the pressure due now. Polling resets it.
+        gboolean stalled = FALSE;
+        for (int i = 0; i < INFO_PRESSURES; i++) {
+            int *fd = &info->pressure.trigger_fd[i];
+            if (fds[2 + i].revents & POLLERR) {
+                // The cgroup is gone.
+                *fd = (close(*fd), -1);
+            } else if (fds[2 + i].revents & POLLPRI) {
+                info->pressure.fired[i] = g_get_monotonic_time();
+                info->due[INFO_PRESSURE] = 0;
+                stalled = TRUE;
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            if (read(info->timer_fd, &n, sizeof(n)) < 0 && errno == ECANCELED) {
+                // The clock was set. Sample everything now, which also lines
+                // the collectors up with the new time.
+                info_collect(info, g_get_real_time(), TRUE, running);
+            } else if (running) {
+                info_collect(info, g_get_real_time() + SAMPLER_SLACK, FALSE, running);
+            }
+        }
+        if (stalled && (running & (1u << INFO_PRESSURE)) && info->due[INFO_PRESSURE] == 0) {
+            info_collect(info, g_get_real_time(), FALSE, running);
+        }
+    }
+
+    return NULL;
+}
+
+void
+info_start(Info *info)
+{
+    g_return_if_fail(info->sampler == NULL);
+
+    info->control_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    info->timer_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (info->control_fd < 0 || info->timer_fd < 0) {
+        g_warning("Cannot start sampling: %s", g_strerror(errno));
+        return;
+    }
+
+    // The collectors that have not run yet start at their next boundary.
+    gint64 now = g_get_real_time();
+    for (int i = 0; i < INFO_COLLECTORS; i++) {
+        if (info->due[i] == 0) {
+            info->due[i] = (now / info->period[i] + 1) * info->period[i];
+        }
+    }
+    pressure_arm(info);
+    info->sampler = g_thread_new("info-sampler", info_sampler, info);
+}
+
+void
+info_set_paused(Info *info, gboolean paused)
+{
+    if (g_atomic_int_get(&info->paused) != paused) {
+        g_atomic_int_set(&info->paused, paused);
+        if (info->sampler) {
+            sampler_wake(info);
+        }
+    }
+}
+
+static gboolean
+watch_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    g_source_set_ready_time(source, -1);
+    return callback ? callback(user_data) : G_SOURCE_REMOVE;
+}
+
+static GSourceFuncs watch_funcs = {
+    NULL, NULL, watch_dispatch, NULL, NULL, NULL,
+};
+
+void
+info_set_watch(Info *info, GSourceFunc func, gpointer data)
+{
+    g_return_if_fail(info->sampler == NULL);
+
+    if (info->watch) {
+        g_source_destroy(info->watch);
+        info->watch = (g_source_unref(info->watch), NULL);
+    }
+    if (func) {
+        info->watch = g_source_new(&watch_funcs, sizeof(GSource));
+        g_source_set_callback(info->watch, func, data, NULL);
+        g_source_set_ready_time(info->watch, -1);
+        g_source_attach(info->watch, NULL);
+    }
+}
+
+void
+info_set_snapshot_func(Info *info, InfoSnapshotFunc func, gpointer data, guint collectors)
+{
+    g_return_if_fail(info->sampler == NULL);
+
+    info->snapshot_func = func;
+    info->snapshot_data = data;
+    info->snapshot_collectors = func ? collectors : 0;
+}
+
+InfoSnapshot *
+info_acquire(Info *info)
+{
+    // Swap the front buffer with the middle one if there is a newer snapshot.
+    if (g_atomic_int_get(&info->middle) & SNAPSHOT_FRESH) {
+        int old;
+        do {
+            old = g_atomic_int_get(&info->middle);
+        } while (!g_atomic_int_compare_and_exchange(&info->middle, old, info->front));
+        info->front = old & SNAPSHOT_INDEX;
+    }
+
+    return &info->snaps[info->front];
+}
+
+int
+info_get_cpu_count(InfoSnapshot *snap)
+{
+    return snap->ncpu;
+}
+
+double
+info_get_cpu_usage(InfoSnapshot *snap, int n)
+{
+    return (0 <= n && n < snap->ncpu) ? snap->cpu_usage[n] : 0;
+}
+
+gboolean
+info_get_cpu_times(InfoSnapshot *snap, int n, double times[INFO_CPU_STATES])
+{
+    if (n == -1) {
+        memcpy(times, snap->cpu_all_times, INFO_CPU_STATES * sizeof(double));
+        return TRUE;
+    }
+    if (n < 0 || n >= snap->ncpu) {
+        return FALSE;
+    }
+    memcpy(times, snap->cpu_times + (gsize) n * INFO_CPU_STATES,
+           INFO_CPU_STATES * sizeof(double));
+    return TRUE;
+}
+
+double
+info_get_ctxt_rate(InfoSnapshot *snap)
+{
+    return snap->ctxt_rate;
+}
+
+double
+info_get_intr_rate(InfoSnapshot *snap)
+{
+    return snap->intr_rate;
+}
+
+guint
+info_get_procs_running(InfoSnapshot *snap)
+{
+    return snap->procs_running;
+}
+
+guint
+info_get_procs_blocked(InfoSnapshot *snap)
+{
+    return snap->procs_blocked;
+}
+
+gboolean
+info_get_pressure(InfoSnapshot *snap, InfoPressureResource resource, InfoPressure *pressure)
+{
+    if (resource < 0 || resource >= INFO_PRESSURES || !snap->pressure_known[resource]) {
+        return FALSE;
+    }
+    *pressure = snap->pressure[resource];
+    return TRUE;
+}
+
+guint
+info_get_cgroup_count(InfoSnapshot *snap)
+{
+    return snap->ncgroups;
+}
+
+guint
+info_get_top_cgroup_count(InfoSnapshot *snap)
+{
+    return snap->cgroup_ntop;
+}
+
+const InfoCgroup *
+info_get_top_cgroup(InfoSnapshot *snap, guint i)
+{
+    return (i < snap->cgroup_ntop) ? &snap->cgroup_top[i] : NULL;
+}
+
+// Returns the FsValue for mount point path, or NULL if there is no such mount.
+static struct FsValue *
+snapshot_fs(InfoSnapshot *snap, const char *path)
+{
+    guint i = snap->mount_index ?
+        GPOINTER_TO_UINT(g_hash_table_lookup(snap->mount_index, path)) : 0;
+    return i ? &snap->fs[i - 1] : NULL;
+}
+
+gboolean
+info_get_history(InfoSnapshot *snap, InfoMetric metric, float *values, guint n)
+{
+    struct History *h = snap->history;
+    if (!h || metric < 0 || metric >= INFO_HISTORY_METRICS) {
+        return FALSE;
+    }
+
+    g_mutex_lock(&h->lock);
+    gboolean ok = (h->size > 0);
+    if (ok) {
+        history_copy(snap, h->metrics + (gsize) metric * h->size, 1, values, n);
+    }
+    g_mutex_unlock(&h->lock);
+    return ok;
+}
+
+gboolean
+info_get_cpu_history(InfoSnapshot *snap, int cpu, float *values, guint n)
+{
+    struct History *h = snap->history;
+    if (!h || cpu < 0 || cpu >= snap->ncpu) {
+        return FALSE;
+    }
+
+    g_mutex_lock(&h->lock);
+    gboolean ok = (h->size > 0 && cpu < h->ncpu);
+    if (ok) {
+        history_copy(snap, h->cpu + cpu, h->ncpu, values, n);
+    }
+    g_mutex_unlock(&h->lock);
+    return ok;
+}
+
+gboolean
+info_get_fs_history(InfoSnapshot *snap, const char *path, float *values, guint n)
+{
+    struct History *h = snap->history;
+    guint i = snap->mount_index ?
+        GPOINTER_TO_UINT(g_hash_table_lookup(snap->mount_index, path)) : 0;
+    if (!h || i == 0) {
+        return FALSE;
+    }
+
+    struct FsStat *fs = snap->fs_stats->pdata[i - 1];
+    g_mutex_lock(&h->lock);
+    gboolean ok = (h->size > 0 && fs->history);
+    if (ok) {
+        history_copy(snap, fs->history, 1, values, n);
+    }
+    g_mutex_unlock(&h->lock);
+    return ok;
+}
+
+guint64
+info_get_history_count(InfoSnapshot *snap)
+{
+    return snap->history_count;
+}
+
+guint64
+info_get_fs_free(InfoSnapshot *snap, const char *path)
+{
+    struct FsValue *fs = snapshot_fs(snap, path);
+    return fs ? fs->free : 0;
+}
+
+gboolean
+info_get_fs_stale(InfoSnapshot *snap, const char *path)
+{
+    struct FsValue *fs = snapshot_fs(snap, path);
+    return fs ? fs->stale : TRUE;
+}
+
+gboolean
+info_get_disk_io(InfoSnapshot *snap, const char *path, InfoDiskIO *io)
+{
+    struct FsValue *fs = snapshot_fs(snap, path);
+    if (!fs || !fs->io_known) {
+        return FALSE;
+    }
+    *io = fs->io;
+    return TRUE;
+}
+
+double
+info_get_mem(InfoSnapshot *snap)
+{
+    return snap->mem;
+}
+
+const InfoMeminfo *
+info_get_meminfo(InfoSnapshot *snap)
+{
+    return &snap->meminfo;
+}
+
+GPtrArray *
+info_get_mounts(InfoSnapshot *snap)
+{
+    return snap->mounts;
+}
+
+double
+info_get_swap(InfoSnapshot *snap)
+{
+    return snap->swap;
+}
+
+gint64
+info_get_time(InfoSnapshot *snap)
+{
+    return snap->time;
+}
+
+const struct tm *
+info_get_local_time(InfoSnapshot *snap)
+{
+    return snap->time ? &snap->local_time : NULL;
+}
+
+guint64
+info_get_uptime(InfoSnapshot *snap)
+{
+    return snap->uptime;
+}
+
+double
+info_get_net_rxspeed(InfoSnapshot *snap)
+{
+    return snap->rxspeed;
+}
+
+double
+info_get_net_txspeed(InfoSnapshot *snap)
+{
+    return snap->txspeed;
+}
+
+guint
+info_get_proc_count(InfoSnapshot *snap)
+{
+    return snap->nprocs;
+}
+
+guint
+info_get_top_count(InfoSnapshot *snap)
+{
+    return snap->ntop;
+}
+
+const InfoProc *
+info_get_top_proc(InfoSnapshot *snap, guint i)
+{
+    return (i < snap->ntop) ? &snap->top[i] : NULL;
+}
+
+guint
+info_get_net_count(InfoSnapshot *snap)
+{
+    return snap->nnet;
+}
+
+const InfoNetIface *
+info_get_net_iface(InfoSnapshot *snap, guint i)
+{
+    return (i < snap->nnet) ? &snap->net[i] : NULL;
+}
+
+const InfoNetIface *
+info_find_net_iface(InfoSnapshot *snap, const char *name)
+{
+    for (guint i = 0; i < snap->nnet; i++) {
+        if (strcmp(snap->net[i].name, name) == 0) {
+            return &snap->net[i];
+        }
+    }
+    return NULL;
 }
@@ -5,49 +5,391 @@
 #ifndef MANITOR_INFO_H
 #define MANITOR_INFO_H
 
+// Info gathers the system information. Every update publishes a snapshot of
+// the values, which is what the info_get_*() functions read.
 typedef struct Info Info;
+typedef struct InfoSnapshot InfoSnapshot;
+
+// Values from /proc/meminfo, in bytes.
+// The HugePages_* fields are page counts. Fields missing from the file are 0.
+typedef struct {
+    guint64 mem_total;          // MemTotal
+    guint64 mem_free;           // MemFree
+    guint64 mem_available;      // MemAvailable
+    guint64 buffers;            // Buffers
+    guint64 cached;             // Cached
+    guint64 swap_cached;        // SwapCached
+    guint64 active;             // Active
+    guint64 inactive;           // Inactive
+    guint64 unevictable;        // Unevictable
+    guint64 mlocked;            // Mlocked
+    guint64 swap_total;         // SwapTotal
+    guint64 swap_free;          // SwapFree
+    guint64 dirty;              // Dirty
+    guint64 writeback;          // Writeback
+    guint64 anon_pages;         // AnonPages
+    guint64 mapped;             // Mapped
+    guint64 shmem;              // Shmem
+    guint64 kreclaimable;       // KReclaimable
+    guint64 slab;               // Slab
+    guint64 sreclaimable;       // SReclaimable
+    guint64 sunreclaim;         // SUnreclaim
+    guint64 kernel_stack;       // KernelStack
+    guint64 page_tables;        // PageTables
+    guint64 commit_limit;       // CommitLimit
+    guint64 committed_as;       // Committed_AS
+    guint64 anon_huge_pages;    // AnonHugePages
+    guint64 huge_pages_total;   // HugePages_Total
+    guint64 huge_pages_free;    // HugePages_Free
+    guint64 huge_pages_rsvd;    // HugePages_Rsvd
+    guint64 huge_pages_surp;    // HugePages_Surp
+    guint64 hugepagesize;       // Hugepagesize
+    guint64 hugetlb;            // Hugetlb
+} InfoMeminfo;
+
+// The counters of a network interface, and its speeds since the previous
+// update. The speeds are 0 at the first update, and when the counters go back.
+typedef struct {
+    char name[16];          // The interface name (IFNAMSIZ).
+    int index;              // The interface index.
+    guint64 rx_bytes;       // }
+    guint64 tx_bytes;       // }
+    guint64 rx_packets;     // }
+    guint64 tx_packets;     // } The totals, as counted by the kernel.
+    guint64 rx_errors;      // }
+    guint64 tx_errors;      // }
+    guint64 rx_dropped;     // }
+    guint64 tx_dropped;     // }
+    double rxspeed;         // Receive speed (bytes/s).
+    double txspeed;         // Transmit speed (bytes/s).
+} InfoNetIface;
+
+// Where the time of a CPU goes, in the order of /proc/stat.
+typedef enum {
+    INFO_CPU_USER,          // Normal processes in user mode.
+    INFO_CPU_NICE,          // Niced processes in user mode.
+    INFO_CPU_SYSTEM,        // Kernel mode.
+    INFO_CPU_IDLE,          // Doing nothing.
+    INFO_CPU_IOWAIT,        // Idle, waiting for I/O.
+    INFO_CPU_IRQ,           // Servicing interrupts.
+    INFO_CPU_SOFTIRQ,       // Servicing softirqs.
+    INFO_CPU_STEAL,         // Taken by the hypervisor for other guests.
+    INFO_CPU_GUEST,         // Running a guest (also counted in USER).
+    INFO_CPU_GUEST_NICE,    // Running a niced guest (also counted in NICE).
+    INFO_CPU_STATES
+} InfoCpuState;
+
+// A process, with its usage since it was last read.
+typedef struct {
+    int pid;                // The process ID.
+    char name[16];          // The command name (TASK_COMM_LEN).
+    double cpu;             // CPU usage, in CPUs (1: one CPU all the time).
+    guint64 rss;            // Resident memory (bytes).
+} InfoProc;
+
+// A cgroup (v2), with its usage since it was last read.
+typedef struct {
+    char path[256];         // Under /sys/fs/cgroup (truncated).
+    double cpu;             // CPU usage, in CPUs (1: one CPU all the time).
+    guint64 memory;         // Memory used (bytes, memory.current).
+    guint64 memory_max;     // Its limit (bytes, G_MAXUINT64: none).
+    double read_bytes;      // Bytes read per second (io.stat).
+    double write_bytes;     // Bytes written per second.
+} InfoCgroup;
+
+// The I/O of a block device, since the previous update.
+typedef struct {
+    double read_bytes;      // Bytes read per second.
+    double write_bytes;     // Bytes written per second.
+    double read_iops;       // Reads completed per second.
+    double write_iops;      // Writes completed per second.
+    double util;            // The fraction of the time it was busy (0..1).
+    double await;           // The average time a read or write took (ms).
+} InfoDiskIO;
+
+// The resources the kernel tracks the pressure of (see info_get_pressure()).
+typedef enum {
+    INFO_PRESSURE_CPU,
+    INFO_PRESSURE_MEMORY,
+    INFO_PRESSURE_IO,
+    INFO_PRESSURES
+} InfoPressureResource;
+
+// The pressure stall information (PSI) of a resource: the share of the time
+// tasks were stalled waiting for it, averaged over the last 10 s.
+typedef struct {
+    double some;            // At least one task stalled (0..1).
+    double full;            // All non-idle tasks stalled at once (0..1).
+    gboolean stalled;       // Did the trigger fire within its window (see
+                            // info_set_pressure_trigger())?
+} InfoPressure;
+
+// The collectors that gather the values. Each one runs at its own period
+// (see info_set_period()).
+typedef enum {
+    INFO_CPU,       // CPU usage.
+    INFO_MEM,       // Memory and swap usage.
+    INFO_MOUNTS,    // Changes to the mount table.
+    INFO_FS,        // The free space of the mounts.
+    INFO_NET,       // Network interfaces.
+    INFO_PROCS,     // The busiest processes (see info_set_top_procs()).
+    INFO_UPTIME,    // Uptime.
+    INFO_DISKS,     // The I/O of the disks the mounts are on.
+    INFO_PRESSURE,  // Pressure stall information.
+    INFO_CGROUPS,   // The busiest cgroups (see info_set_cgroups()).
+    INFO_COLLECTORS
+} InfoCollector;
+
+// Metrics with a history (see info_get_history()).
+typedef enum {
+    INFO_HISTORY_CPU,       // The average usage of the CPUs (0..1).
+    INFO_HISTORY_MEM,       // Memory used (0..1).
+    INFO_HISTORY_SWAP,      // Swap used (0..1).
+    INFO_HISTORY_RX,        // Receive speed (bytes/s).
+    INFO_HISTORY_TX,        // Transmit speed (bytes/s).
+    INFO_HISTORY_METRICS
+} InfoMetric;
 
 // Creates a new Info.
 // iface is the network interface to monitor.
-Info * info_new(const char *iface);
+// root is the directory to find proc/ in (NULL: /), e.g. a copy of the
+// files of another system. The network interfaces always come from the
+// kernel, and the mount table only comes from the root with GLib 2.82 or
+// later.
+Info * info_new(const char *iface, const char *root);
 
 // Frees the Info structure.
 void info_free(Info *info);
 
-// Updates the data gathered by info.
+// Runs all the collectors, and publishes a new snapshot.
+// Do not call this after info_start().
 void info_update(Info *info);
 
-// Returns the time at the last update.
-GDateTime * info_get_time(Info *info);
+// Values for info_replay().
+typedef struct {
+    gint64 time;                // The time of the values (us since the epoch).
+    int ncpu;                   // The number of CPUs...
+    const double *cpu_usage;    // ...and their usage (0..1).
+    double mem;                 // Memory used (0..1).
+    double swap;                // Swap used (0..1).
+    double rxspeed;             // The speeds of the monitored interface
+    double txspeed;             // (bytes/s).
+} InfoValues;
+
+// Publishes a snapshot of values instead of running the collectors, e.g. to
+// replay a recording. The rest (mounts, processes, etc.) is as of the last
+// update. The CPU time all counts as user time, as the breakdown is not
+// known. Do not call this after info_start().
+void info_replay(Info *info, const InfoValues *values);
+
+// Reads the files of the collectors that run together (/proc/stat,
+// /proc/meminfo, etc.) with a single system call, using io_uring, if use is
+// TRUE and the kernel allows it. Otherwise they are read one at a time.
+// This is on by default. Returns whether io_uring is used. Call this before
+// info_start().
+gboolean info_set_io_uring(Info *info, gboolean use);
+
+// Makes collector run every period_ms milliseconds (the default is 1000).
+// Call this before info_start().
+void info_set_period(Info *info, InfoCollector collector, guint period_ms);
+
+// Starts running each collector at its period on a background thread. The
+// runs are lined up with the wall clock: a collector with a period of 1 s runs
+// just after every second. The collectors that fall due together run
+// together, and every run publishes a snapshot. The thread is stopped by
+// info_free().
+void info_start(Info *info);
+
+// Pauses or resumes the sampling started by info_start(), e.g. while nobody
+// can see the values. Resuming runs every collector once right away.
+// The collectors a snapshot function needs (see info_set_snapshot_func()) go
+// on running for it, so pausing only saves the wakeups of the others, and
+// the watch is not called until the pause ends.
+// This can be called before info_start().
+void info_set_paused(Info *info, gboolean paused);
+
+// Makes the INFO_CGROUPS collector keep track of the cgroups (v2) under
+// subtree, a path under /sys/fs/cgroup ("" for all of them), and of the n
+// busiest ones at the bottom of the tree (where the processes are), by CPU
+// usage and then memory. 0 (the default) turns it off. Call this before
+// info_start().
+// Each cgroup tracked keeps its directory open: the caller may need to raise
+// RLIMIT_NOFILE for the thousands some hosts have.
+void info_set_cgroups(Info *info, const char *subtree, guint n);
+
+// Makes the INFO_PRESSURE collector read the pressure files of cgroup (a
+// path under /sys/fs/cgroup, e.g. "user.slice") rather than /proc/pressure.
+// NULL (the default) goes back to the whole system. Call this before
+// info_start().
+void info_set_pressure_cgroup(Info *info, const char *cgroup);
+
+// Sets up a PSI trigger on each pressure file when sampling starts: the
+// kernel wakes up the sampler as soon as some tasks have stalled for stall_ms
+// within window_ms, and the INFO_PRESSURE collector runs right away rather
+// than at its period. The resource is then stalled until the window has
+// passed. 0 (the default) turns the triggers off. Triggers need the right
+// to write the pressure files; without it, they are silently left out.
+// Call this before info_start().
+void info_set_pressure_trigger(Info *info, guint stall_ms, guint window_ms);
+
+// Makes the INFO_PROCS collector keep track of the n busiest processes, by
+// CPU usage and then resident memory. 0 (the default) turns it off. Call this
+// before info_start().
+void info_set_top_procs(Info *info, guint n);
+
+// Starts timing the stages of every update (see prof.h). Call this before
+// info_start(). Returns the Prof, which belongs to info.
+Prof * info_enable_prof(Info *info);
+
+// Keeps the last length values of the InfoMetrics, of the usage of each CPU,
+// and of the free space of each mount. 0 (the default) keeps none. Call this
+// before the first update.
+void info_set_history(Info *info, guint length);
+
+// Makes func (with data) get called on the main context whenever a new
+// snapshot is published. Pass NULL to remove it. Call this before
+// info_start().
+void info_set_watch(Info *info, GSourceFunc func, gpointer data);
+
+// Called with every snapshot as it is published, on the thread that
+// updates (see info_set_snapshot_func()).
+typedef void (*InfoSnapshotFunc)(InfoSnapshot *snap, gpointer data);
+
+// Makes func (with data) get called with every snapshot published, right
+// away on the thread that updates, e.g. to record them. snap stays intact
+// until func returns. func must be quick, since the next update waits for
+// it, and must not call info_acquire(). Pass NULL to remove it. Call this
+// before info_start().
+// collectors: The ones whose values func uses (a mask of 1 << InfoCollector).
+//             They keep running while paused (see info_set_paused()).
+void info_set_snapshot_func(Info *info, InfoSnapshotFunc func, gpointer data,
+                            guint collectors);
+
+// Returns the latest snapshot. It does not change, and stays valid until the
+// next info_acquire() or info_free(). This never blocks. Only one thread may
+// acquire snapshots.
+InfoSnapshot * info_acquire(Info *info);
+
+// The functions below return values from a snapshot.
+
+// Returns the time at the last update, in microseconds since the epoch (0
+// before the first update).
+gint64 info_get_time(InfoSnapshot *snap);
+
+// Returns the local time at the last update, broken down. NULL before the
+// first update.
+const struct tm * info_get_local_time(InfoSnapshot *snap);
 
 // Returns the uptime, in seconds.
-guint64 info_get_uptime(Info *info);
+guint64 info_get_uptime(InfoSnapshot *snap);
 
 // Returns the number of CPUs monitored.
-int info_get_cpu_count(Info *info);
+int info_get_cpu_count(InfoSnapshot *snap);
 
 // Returns the CPU usage (as a fraction in the range [0, 1]) for CPU n
-// (0 = first CPU).
-double info_get_cpu_usage(Info *info, int n);
+// (0 = first CPU). This is the time not idle or waiting for I/O, so it
+// includes the time stolen by the hypervisor.
+double info_get_cpu_usage(InfoSnapshot *snap, int n);
+
+// Copies where the time of CPU n went since the previous update into times,
+// indexed by InfoCpuState, as fractions of the time. n = -1 gives all the CPUs
+// together. Returns FALSE (and leaves times alone) if there is no such CPU.
+gboolean info_get_cpu_times(InfoSnapshot *snap, int n, double times[INFO_CPU_STATES]);
+
+// Returns the number of context switches and interrupts per second, since
+// the previous update.
+double info_get_ctxt_rate(InfoSnapshot *snap);
+double info_get_intr_rate(InfoSnapshot *snap);
+
+// Returns the number of tasks that are runnable (the run queue length), and
+// blocked waiting for I/O.
+guint info_get_procs_running(InfoSnapshot *snap);
+guint info_get_procs_blocked(InfoSnapshot *snap);
+
+// Returns the number of free bytes for mount point 'path', as of the last
+// successful sample. Sampling happens in the background, so this never
+// touches the filesystem.
+guint64 info_get_fs_free(InfoSnapshot *snap, const char *path);
+
+// Returns TRUE if the free space of mount point 'path' is not known or out of
+// date, e.g. because sampling failed or hangs.
+gboolean info_get_fs_stale(InfoSnapshot *snap, const char *path);
 
-// Returns the number of free bytes for mount point 'path'.
-guint64 info_get_fs_free(Info *info, const char *path);
+// Sets io to the I/O of the block device mount point 'path' is on. For a
+// partition, or a dm or md device, the utilization is that of the busiest
+// disk under it. Returns FALSE (and leaves io alone) if it is not known yet.
+gboolean info_get_disk_io(InfoSnapshot *snap, const char *path, InfoDiskIO *io);
+
+// Sets pressure to the pressure stall information of resource. Returns FALSE
+// (and leaves pressure alone) if it is not known, e.g. because the kernel
+// does not track it.
+gboolean info_get_pressure(InfoSnapshot *snap, InfoPressureResource resource,
+                           InfoPressure *pressure);
 
 // Returns the memory usage, as a fraction.
-double info_get_mem(Info *info);
+double info_get_mem(InfoSnapshot *snap);
+
+// Returns the values read from /proc/meminfo at the last update.
+const InfoMeminfo * info_get_meminfo(InfoSnapshot *snap);
+
+// Parses the contents of /proc/meminfo in buf into mi. Used by the updates,
+// and exposed for bench/meminfo-bench.
+void info_parse_meminfo(InfoMeminfo *mi, const char *buf);
 
-// Returns an array of mount entries of interest.
-// Each element is a pointer to a GUnixMountEntry.
+// Returns an array of mount entries of interest (NULL before the first
+// update). Each element is a pointer to a GUnixMountEntry.
 // Do NOT change the returned data!
-GPtrArray * info_get_mounts(Info *info);
+GPtrArray * info_get_mounts(InfoSnapshot *snap);
+
+// These copy the last n values of a metric, up to and including the ones in
+// snap, into values (oldest first). Values that are not known, or no longer
+// kept, are NAN. They return FALSE (and leave values alone) if there is no
+// such history.
+gboolean info_get_history(InfoSnapshot *snap, InfoMetric metric, float *values, guint n);
+gboolean info_get_cpu_history(InfoSnapshot *snap, int cpu, float *values, guint n);
+gboolean info_get_fs_history(InfoSnapshot *snap, const char *path, float *values, guint n);
+
+// Returns the number of values pushed to the history up to snap. The last
+// value copied by info_get_history() etc. is number info_get_history_count() - 1.
+guint64 info_get_history_count(InfoSnapshot *snap);
 
 // Returns the swap usage, as a fraction.
-double info_get_swap(Info *info);
+double info_get_swap(InfoSnapshot *snap);
 
 // Returns the receive speed (bytes/s) for the monitored network interface.
-double info_get_net_rxspeed(Info *info);
+double info_get_net_rxspeed(InfoSnapshot *snap);
 
 // Returns the transmit speed (bytes/s) for the monitored network interface.
-double info_get_net_txspeed(Info *info);
+double info_get_net_txspeed(InfoSnapshot *snap);
+
+// Returns the number of processes, as of the last complete scan.
+guint info_get_proc_count(InfoSnapshot *snap);
+
+// Returns the number of busiest processes (up to the n of
+// info_set_top_procs()), and busiest process i (0 = the busiest; NULL if
+// there is no such process).
+guint info_get_top_count(InfoSnapshot *snap);
+const InfoProc * info_get_top_proc(InfoSnapshot *snap, guint i);
+
+// Returns the number of cgroups tracked (see info_set_cgroups()).
+guint info_get_cgroup_count(InfoSnapshot *snap);
+
+// Returns the number of busiest cgroups (up to the n of info_set_cgroups()),
+// and busiest cgroup i (0 = the busiest; NULL if there is no such cgroup).
+guint info_get_top_cgroup_count(InfoSnapshot *snap);
+const InfoCgroup * info_get_top_cgroup(InfoSnapshot *snap, guint i);
+
+// Every network interface, for iterating:
+//
+//     for (guint i = 0; i < info_get_net_count(snap); i++) {
+//         const InfoNetIface *iface = info_get_net_iface(snap, i);
+//         ...
+//     }
+//
+// The interfaces are sorted by index. info_get_net_iface() returns NULL if
+// i is out of range, and info_find_net_iface() if there is no such name.
+guint info_get_net_count(InfoSnapshot *snap);
+const InfoNetIface * info_get_net_iface(InfoSnapshot *snap, guint i);
+const InfoNetIface * info_find_net_iface(InfoSnapshot *snap, const char *name);
 
 #endif // #ifndef MANITOR_INFO_H
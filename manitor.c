@@ -2,14 +2,49 @@
  * manitor -- Display system information on the desktop.
  * See LICENSE for copyright.
  */
+#define _GNU_SOURCE // For SIGUSR1 with -std=c99.
+
 #include <gtk/gtk.h>
 #include <gio/gunixmounts.h>
+#include <glib-unix.h>
 #include <cairo.h>
 #include <math.h>
+#include <signal.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/resource.h>
 
 #include "conf.h"
+#include "prof.h"
 #include "info.h"
+#include "export.h"
+#include "record.h"
+#include "text.h"
+
+// Keep this many laid out texts. The seconds alone take 60.
+#define TEXT_CACHE_SIZE 128
+
+// The rings: the radius of the innermost one, the gap between them, and the
+// width of the line showing the value. With many CPUs the CPU rings get
+// closer and thinner, down to MIN_RING_GAP apart and a line of 1.
+#define RING_RADIUS 35
+#define RING_GAP 15
+#define RING_WIDTH 7
+#define MIN_RING_GAP 1.5
+#define GRAPH_GAP 4         // Between graphs that go together.
+#define HEAT_SHADES 8       // The shades of a GRAPH_HEAT graph.
+
+// Frames that may still allocate when replaying (see run_replay()).
+#define REPLAY_WARMUP 10
+
+// How often the profiling overlay changes (us). New text is laid out each
+// time.
+#define PROF_OVERLAY_PERIOD G_TIME_SPAN_SECOND
+
+// The number of allocations so far, when linked with bench/allocs.c (see
+// make bench-draw). NULL in manitor itself.
+extern int allocs_get(void) __attribute__((weak));
 
 #define RAD(deg) ((deg) * G_PI / 180.0)
 #define TAU (2 * G_PI)
@@ -18,6 +53,142 @@
 #define FORMAT_BIG_END "</span>"
 #define FORMAT_BIG(strliteral) FORMAT_BIG_BEGIN strliteral FORMAT_BIG_END
 
+// Where the display elements go. This only depends on the window size, the
+// fonts and the number of CPUs, and is computed with the static layer.
+typedef struct {
+    int width;              // The window width...
+    int height;             // ...and height.
+    int scale;              // The window scale factor.
+    int ncpu;               // The number of CPU rings.
+    int clock_x;            // The center of the clock.
+    int clock_y;            //
+    int clock_radius;       // The radius of the clock background.
+    int seconds_radius;     // The seconds circle around at this radius.
+    double ring_y;          // The center of the rings (all of them).
+    double ring_radius;     // The radius of the MEM and SWAP rings, and the
+                            // innermost CPU ring.
+    double ring_gap;        // The gap between the CPU rings.
+    double ring_width;      // The width of their lines.
+    double cpu_x;           // The horizontal centers of the rings.
+    double mem_x;           //
+    double swap_x;          //
+    double cpu_graph_y;     // The bottom of the history graph of the CPU,
+    double cpus_graph_y;    // of each CPU,
+    double graph_y;         // and of the MEM and SWAP ones.
+    double graph_width;     // The size of the history graphs.
+    double graph_height;    //
+} Geometry;
+
+// The parts of the display that are redrawn separately.
+enum {
+    ELEM_CLOCK,     // The time.
+    ELEM_SECONDS,   // The seconds circling around it.
+    ELEM_CPU,       // The CPU rings.
+    ELEM_MEM,       // The MEM ring and percentage.
+    ELEM_SWAP,      // The SWAP ring and percentage.
+    ELEM_CPU_GRAPH, // The history of the CPU usage (all CPUs).
+    ELEM_CPUS_GRAPH,    // The history of the usage of each CPU.
+    ELEM_MEM_GRAPH, // The history of the memory usage.
+    ELEM_SWAP_GRAPH,    // The history of the swap usage.
+    ELEM_UPTIME,    // The uptime.
+    ELEM_NET,       // The network speeds.
+    ELEM_NET_GRAPH, // Their history.
+    ELEM_MOUNTS,    // The free space on the mounts.
+    ELEM_MOUNTS_GRAPH,  // Its history.
+    ELEM_PROCS,     // The busiest processes.
+    ELEM_PROF,      // The stage times (if MANITOR_PROF=overlay).
+    ELEM_COUNT
+};
+
+// The stages of drawing, as timed by Manitor.prof.
+enum {
+    DRAW_LAYOUT,    // Updating the elements (on_sample()).
+    DRAW_STATIC,    // Redrawing the static layer, if needed.
+    DRAW_PAINT,     // Painting the static layer.
+    DRAW_CLOCK,     // }
+    DRAW_RINGS,     // } Drawing the elements, by kind (see elem_stages).
+    DRAW_MOUNTS,    // }
+    DRAW_TEXT,      // }
+    DRAW_STAGES
+};
+
+static const char *draw_stages[DRAW_STAGES] = {
+    "layout", "static", "paint", "clock", "rings", "mounts", "text",
+};
+
+// The stage each element is timed as.
+static const int elem_stages[ELEM_COUNT] = {
+    [ELEM_CLOCK] = DRAW_CLOCK,
+    [ELEM_SECONDS] = DRAW_CLOCK,
+    [ELEM_CPU] = DRAW_RINGS,
+    [ELEM_MEM] = DRAW_RINGS,
+    [ELEM_SWAP] = DRAW_RINGS,
+    [ELEM_CPU_GRAPH] = DRAW_RINGS,
+    [ELEM_CPUS_GRAPH] = DRAW_RINGS,
+    [ELEM_MEM_GRAPH] = DRAW_RINGS,
+    [ELEM_SWAP_GRAPH] = DRAW_RINGS,
+    [ELEM_UPTIME] = DRAW_TEXT,
+    [ELEM_NET] = DRAW_TEXT,
+    [ELEM_NET_GRAPH] = DRAW_TEXT,
+    [ELEM_MOUNTS] = DRAW_MOUNTS,
+    [ELEM_MOUNTS_GRAPH] = DRAW_MOUNTS,
+    [ELEM_PROCS] = DRAW_TEXT,
+    [ELEM_PROF] = DRAW_TEXT,
+};
+
+// A ring as it was last drawn.
+typedef struct {
+    double value;   // The value shown.
+    double part;    // The part of it shown in the steal color.
+    int key;        // Rings with different keys look different.
+} Ring;
+
+// How a graph shows its values.
+typedef enum {
+    GRAPH_FRACTION, // Area graphs of fractions (0..1).
+    GRAPH_SCALED,   // Area graphs, each scaled to its highest value.
+    GRAPH_HEAT,     // Rows of shades of fractions (0: clear, 1: the color).
+} GraphStyle;
+
+// Copies the last n values of source i of a graph into values, like
+// info_get_history() does. data is what was given to element_set_graph().
+typedef gboolean (*HistoryFunc)(InfoSnapshot *snap, gconstpointer data, int i,
+                                float *values, guint n);
+
+// A part of the display as it was last drawn. Elements are only redrawn when
+// what they show changes, and only their own rectangle is invalidated.
+typedef struct {
+    GdkRectangle rect;      // Everything the element draws is inside this.
+    gboolean changed;       // Must be invalidated (see element_commit()).
+
+    /* Text */
+    Text *text;             // The text shown (NULL: none).
+    double tx, ty;          // The top left corner of its layout.
+
+    /* Rings */
+    GArray *rings;          // The Rings shown, innermost first.
+    double rx, ry;          // The center of the rings.
+    double radius;          // The radius of the innermost ring.
+    double gap;             // The gap between rings.
+    double width;           // The width of their lines.
+    double alarm;           // See draw_ring().
+
+    /* Graph */
+    int series;             // The number of graphs (0: none).
+    int gwidth;             // The number of columns of each.
+    GArray *columns;        // The highest value of each run (NAN: no value),
+                            // a row of gwidth for each series.
+    GArray *heights;        // What each column shows: its height in pixels,
+                            // or the shade for GRAPH_HEAT (<0: nothing).
+    gint64 last_run;        // The run the last columns are for.
+    GraphStyle gstyle;      // }
+    gconstpointer gdata;    // } What the graph shows.
+    int gsources;           // }
+    double gx, gy;          // The bottom left corner of the first series.
+    double gpitch;          // How much lower each next series is.
+    double gheight;         // The height of each series.
+} Element;
+
 typedef struct {
     /* Configuration */
     int monitor;                // Monitor number we want to appear on.
@@ -26,14 +197,70 @@ typedef struct {
     PangoFontDescription *font; // The font for most labels.
     GdkRGBA *color;             // Foreground color.
     GdkRGBA *alarm_color;       // Alarm color (used when CPU usage etc. is high).
+    char alarm_span[64];        // Starts markup in the alarm color.
+    GdkRGBA *steal_color;       // For the stolen CPU time.
     GdkRGBA *shade_color;       // Should be used as as background color.
-    int interval;               // Update interval in seconds.
+    guint periods[INFO_COLLECTORS]; // Sampling periods (ms).
 
     /* The rest */
-    GtkWidget *window;  // Yes, the window.
+    GtkWidget *window;  // Yes, the window (NULL: replaying, see run_replay()).
+    GdkRectangle damage[2 * ELEM_COUNT];    // What to redraw, without a
+    guint ndamage;                          // window.
+    int layout_allocs;              // Allocations laying out text, and by
+    int render_allocs;              // cairo and Pango drawing (counted if
+                                    // allocs_get() is there).
     Info *info;         // The monitored values.
+    TextCache *texts;               // Laid out text, by markup.
+    GString *scratch;               // For building markup.
+    GPtrArray *mounts;              // The mounts mount_names are for...
+    GPtrArray *mount_names;         // ...and their names, as markup.
+    Geometry geom;                  // Where things go.
+    cairo_surface_t *static_layer;  // Everything that does not change with
+                                    // the values (NULL: must be redrawn).
+    InfoSnapshot *snap;             // The values shown.
+    Element elements[ELEM_COUNT];   // What is shown (see ELEM_CLOCK, etc.)
+    Prof *prof;                     // Times the drawing (NULL: off).
+    Prof *update_prof;              // Times the updates (NULL: off).
+    gboolean prof_overlay;          // Show the times on the window?
+    gint64 prof_shown;              // When they were last formatted for it.
+    guint history_len;              // The number of values in the graphs.
+    float *history;                 // For the values of a graph.
+    gboolean withdrawn;             // }
+    gboolean obscured;              // } Why nobody can see the window.
+    gboolean idle;                  // }
+    Exporter *exporter;             // Serves the values (NULL: showing them).
+    Recorder *recorder;             // Records them (NULL: off).
 } Manitor;
 
+// Returns how many updates there are in span ms, with collectors running
+// every periods[i] ms. A value is added to the history on every update. The
+// collectors run at multiples of their periods, and together when they fall
+// due at the same time, so this counts the times at which any of them does.
+// (PSI triggers add updates of their own, which cut the history short while
+// they fire.)
+static guint
+count_updates(const guint *periods, guint64 span)
+{
+    guint step = periods[0];
+    for (int i = 1; i < INFO_COLLECTORS; i++) {
+        for (guint a = periods[i], b; a > 0; a = b) {
+            b = step % a;
+            step = a;
+        }
+    }
+
+    guint n = 0;
+    for (guint64 t = 0; t < span; t += step) {
+        for (int i = 0; i < INFO_COLLECTORS; i++) {
+            if (t % periods[i] == 0) {
+                n++;
+                break;
+            }
+        }
+    }
+    return n;
+}
+
 static Manitor *
 manitor_new(void)
 {
@@ -41,16 +268,48 @@ manitor_new(void)
     self->monitor = CONF_MONITOR;
     self->margin = CONF_MARGIN;
     self->iface = g_strdup(CONF_IFACE);
-    self->interval = MAX(1, CONF_INTERVAL);
+    self->periods[INFO_CPU] = CONF_CPU_PERIOD;
+    self->periods[INFO_MEM] = CONF_MEM_PERIOD;
+    self->periods[INFO_MOUNTS] = CONF_MOUNTS_PERIOD;
+    self->periods[INFO_FS] = CONF_FS_PERIOD;
+    self->periods[INFO_NET] = CONF_NET_PERIOD;
+    self->periods[INFO_PROCS] = CONF_PROCS_PERIOD;
+    self->periods[INFO_UPTIME] = CONF_UPTIME_PERIOD;
+    self->periods[INFO_DISKS] = CONF_DISKS_PERIOD;
+    self->periods[INFO_PRESSURE] = CONF_PRESSURE_PERIOD;
+    self->periods[INFO_CGROUPS] = CONF_CGROUPS_PERIOD;
     self->font = pango_font_description_from_string(CONF_FONT);
     self->color = g_new0(GdkRGBA, 1);
     self->shade_color = g_new0(GdkRGBA, 1);
     self->alarm_color = g_new0(GdkRGBA, 1);
+    self->steal_color = g_new0(GdkRGBA, 1);
     gdk_rgba_parse(self->color, CONF_COLOR);
     gdk_rgba_parse(self->shade_color, CONF_SHADE_COLOR);
     gdk_rgba_parse(self->alarm_color, CONF_ALARM_COLOR);
-
-    self->info = info_new(CONF_IFACE);
+    gdk_rgba_parse(self->steal_color, CONF_STEAL_COLOR);
+    g_snprintf(self->alarm_span, sizeof(self->alarm_span),
+               "<span foreground='#%02x%02x%02x'>",
+               (int) lround(255 * self->alarm_color->red),
+               (int) lround(255 * self->alarm_color->green),
+               (int) lround(255 * self->alarm_color->blue));
+
+    self->info = info_new(CONF_IFACE, NULL);
+    info_set_top_procs(self->info, CONF_TOP_PROCS);
+    info_set_cgroups(self->info, CONF_CGROUPS_SUBTREE, CONF_TOP_CGROUPS);
+    info_set_pressure_cgroup(self->info, CONF_PRESSURE_CGROUP);
+    info_set_pressure_trigger(self->info, CONF_PRESSURE_STALL, CONF_PRESSURE_WINDOW);
+
+    for (int i = 0; i < ELEM_COUNT; i++) {
+        self->elements[i].rings = g_array_new(FALSE, TRUE, sizeof(Ring));
+        self->elements[i].columns = g_array_new(FALSE, TRUE, sizeof(float));
+        self->elements[i].heights = g_array_new(FALSE, TRUE, sizeof(int));
+    }
+    for (int i = 0; i < INFO_COLLECTORS; i++) {
+        self->periods[i] = MAX(1, self->periods[i]);
+    }
+    self->history_len = count_updates(self->periods, (guint64) CONF_HISTORY * 1000);
+    self->history = g_new(float, MAX(1, self->history_len));
+    self->scratch = g_string_sized_new(1024);
 
     return self;
 }
@@ -99,36 +358,6 @@ manitor_place_window(Manitor *self)
     gtk_window_resize(GTK_WINDOW(self->window), w, h);
 }
 
-// Returns the baseline of line n (0 = first line).
-// n can be negative (-1 = last line, -2 = last before, etc.).
-// Returns 0 if there is no such line.
-static int
-get_baseline(PangoLayout *layout, int n)
-{
-    int retval = 0;
-    if (n < 0) {
-        n += pango_layout_get_line_count(layout);
-        if (n < 0) return retval;
-    }
-
-    // Quick case -- we want the first line.
-    if (n == 0) {
-        retval = pango_layout_get_baseline(layout);
-        return PANGO_PIXELS(retval);
-    }
-
-    // Find line n
-    PangoLayoutIter *iter = pango_layout_get_iter(layout);
-    while (n > 0 && pango_layout_iter_next_line(iter)) { n--; }
-
-    if (n == 0) {
-        retval = pango_layout_iter_get_baseline(iter);
-        retval = PANGO_PIXELS(retval);
-    }
-    pango_layout_iter_free(iter);
-    return retval;
-}
-
 // Gets the pixel extents of line n in the layout.
 // n can be negative to count from the end.
 /*
@@ -149,61 +378,103 @@ get_line_pixel_extents(PangoLayout *layout, int n, PangoRectangle *ink, PangoRec
 }
 */
 
-// Show a layout such that its alignment point (selected by ha and va)
-// is at (x, y).
-//
-// ha: Horizontal alignment from 0 (left) to 1 (right).
-// va: Vertical alignment from 0 (top) to 1 (bottom).
-//     Negative integers select the baseline of line |va|.
+// Computes where show_text() puts the top left corner of the layout of text,
+// given the same arguments.
 static void
-show_layout(cairo_t *cr, PangoLayout *layout, double x, double y, double ha, double va)
+place_text(const Text *text, double x, double y, double ha, double va,
+           double *lx, double *ly)
 {
     ha = CLAMP(ha, 0, 1);
     if (va > 1) va = 1; else if (va < 0) va = floor(va);
 
-    PangoRectangle ex;
-    pango_layout_get_pixel_extents(layout, NULL, &ex);
-
-    x += trunc(ex.x - ha * ex.width);
+    const PangoRectangle *ex = &text->logical;
+    x += trunc(ex->x - ha * ex->width);
     if (va >= 0) {
-        y += trunc(ex.y - va * ex.height);
+        y += trunc(ex->y - va * ex->height);
     } else {
-        // Align to baseline. get_baseline() is 0-based, hence the -1.
-        y -= get_baseline(layout, ((int) -va) - 1);
+        // Align to baseline. text_get_baseline() is 0-based, hence the -1.
+        y -= text_get_baseline(text, ((int) -va) - 1);
     }
 
+    *lx = x;
+    *ly = y;
+}
+
+// Show a text such that its alignment point (selected by ha and va)
+// is at (x, y).
+//
+// ha: Horizontal alignment from 0 (left) to 1 (right).
+// va: Vertical alignment from 0 (top) to 1 (bottom).
+//     Negative integers select the baseline of line |va|.
+static void
+show_text(cairo_t *cr, const Text *text, double x, double y, double ha, double va)
+{
+    place_text(text, x, y, ha, va, &x, &y);
     cairo_move_to(cr, x, y);
-    pango_cairo_show_layout(cr, layout);
+    pango_cairo_show_layout(cr, text->layout);
     cairo_new_path(cr);
 }
 
+// Draws the thin "track" of a ring, which is part of the static layer.
 // x, y: Coordinates of the center.
 // radius: Yep.
+// angle1: Start angle (degrees).
+// angle2: End angle (degrees).
+static void
+draw_ring_track(Manitor *self, cairo_t *cr, double x, double y,
+                double radius, double angle1, double angle2)
+{
+    cairo_save(cr);
+    gdk_cairo_set_source_rgba(cr, self->color);
+    cairo_set_line_width(cr, 1);
+    cairo_arc(cr, x + 0.5, y + 0.5, radius, RAD(MIN(angle1, angle2)), RAD(MAX(angle1, angle2)));
+    cairo_stroke(cr);
+    cairo_restore(cr);
+}
+
+// Draws the value of a ring over its track (see draw_ring_track()).
+// x, y: Coordinates of the center.
+// radius: Yep.
+// width: The width of the line.
 // value: The value to display (a fraction in the range [0, 1]).
+// part: The last part of value to draw in the steal color (0 for none).
 // angle1: Start angle (degrees).
 // angle2: End angle (degrees).
 // alarm: Draw using the alarm color if value >= alarm. 0 to disable alarms.
 static void
-draw_ring(Manitor *self, cairo_t *cr, double value, double x, double y,
-          double radius, double angle1, double angle2, double alarm)
+draw_ring(Manitor *self, cairo_t *cr, double value, double part, double x, double y,
+          double radius, double width, double angle1, double angle2, double alarm)
 {
     value = CLAMP(value, 0, 1);
+    part = CLAMP(part, 0, value);
     alarm = CLAMP(alarm, 0, 1);
 
     double a1 = RAD(angle1);
     double a2 = RAD(angle2);
     double a = a1 + value * (a2 - a1); // value angle
+    gboolean alarmed = (alarm > 0 && value >= alarm);
 
     cairo_save(cr);
-    gdk_cairo_set_source_rgba(cr, (alarm == 0 || value < alarm) ? self->color : self->alarm_color);
+    gdk_cairo_set_source_rgba(cr, alarmed ? self->alarm_color : self->color);
 
     if (value > 0) {
-        cairo_set_line_width(cr, 7);
+        cairo_set_line_width(cr, width);
         cairo_arc(cr, x + 0.5, y + 0.5, radius, MIN(a1, a), MAX(a1, a));
         cairo_stroke(cr);
     }
+    if (part > 0) {
+        double p = a - part * (a2 - a1);
+        cairo_save(cr);
+        gdk_cairo_set_source_rgba(cr, self->steal_color);
+        cairo_set_line_width(cr, width);
+        cairo_arc(cr, x + 0.5, y + 0.5, radius, MIN(p, a), MAX(p, a));
+        cairo_stroke(cr);
+        cairo_restore(cr);
+    }
 
-    if (value < 1) {
+    // The track is in the normal color. Paint the rest of it in the alarm
+    // color if needed.
+    if (alarmed && value < 1) {
         cairo_set_line_width(cr, 1);
         cairo_arc(cr, x + 0.5, y + 0.5, radius, MIN(a, a2), MAX(a, a2));
         cairo_stroke(cr);
@@ -212,61 +483,90 @@ draw_ring(Manitor *self, cairo_t *cr, double value, double x, double y,
     cairo_restore(cr);
 }
 
-static char *
-format_uptime(guint64 uptime)
+static void
+format_clock(char *buf, gsize size, const struct tm *tm)
+{
+    if (strftime(buf, size, CONF_CLOCK_FORMAT, tm) == 0) {
+        buf[0] = '\0';
+    }
+}
+
+static void
+format_uptime(char *buf, gsize size, guint64 uptime)
 {
     double h = uptime / 3600;
     double m = (uptime % 3600) / 60;
 
     if (h == 0) {
-        return g_strdup_printf(FORMAT_BIG("%.0f") " min", m);
+        g_snprintf(buf, size, FORMAT_BIG("%.0f") " min", m);
     } else if (m == 0) {
-        return g_strdup_printf(FORMAT_BIG("%.0f") " hr", h);
+        g_snprintf(buf, size, FORMAT_BIG("%.0f") " hr", h);
+    } else {
+        g_snprintf(buf, size, FORMAT_BIG("%.0f") " hr "
+                              FORMAT_BIG("%.0f") " min", h, m);
     }
-
-    return g_strdup_printf(FORMAT_BIG("%.0f") " hr "
-                           FORMAT_BIG("%.0f") " min", h, m);
 }
 
-static char *
-format_netspeed(double speed)
+static void
+format_netspeed(char *buf, gsize size, double speed)
 {
     speed /= 1000;
     if (speed >= 10 || speed == 0) {
-        return g_strdup_printf(FORMAT_BIG("%.0f") "<span fgalpha='1'>.0</span>", speed);
+        g_snprintf(buf, size, FORMAT_BIG("%.0f") "<span fgalpha='1'>.0</span>", speed);
     } else {
-        char *s = g_strdup_printf("%.1f", speed);
+        char s[32];
+        g_snprintf(s, sizeof(s), "%.1f", speed);
         char *dot = strchr(s, '.');
         *dot = '\0';
-        char *retval = g_strdup_printf(FORMAT_BIG("%s") ".%s", s, dot + 1);
-        g_free(s);
-        return retval;
+        g_snprintf(buf, size, FORMAT_BIG("%s") ".%s", s, dot + 1);
     }
 }
 
-static char *
-format_size(double size)
+// Formats a number of bytes in the largest unit it makes at least 1 of,
+// rounded to a tenth below 10 units and to a unit from there, with the number
+// in big type if big. This only uses integers, so it is exact up to EB.
+static void
+format_size(char *buf, gsize bufsize, guint64 size, gboolean big)
 {
     static const char *units[] = {"B", "kB", "MB", "GB", "TB", "PB", "EB"};
-    static int units_max_index = G_N_ELEMENTS(units) - 1;
 
-    int i = trunc(trunc(log10(fabs(size))) / 3);
-    i = MIN(i, units_max_index);
-    const char *unit = units[i];
-    if (i > 0) {
-        size /= pow(10, 3 * i);
+    guint i = 0;
+    guint64 scale = 1;  // The size of units[i].
+    while (i + 1 < G_N_ELEMENTS(units) && size / scale >= 1000) {
+        scale *= 1000;
+        i++;
     }
 
-    if (size >= 10 || size == 0) {
-        return g_strdup_printf(FORMAT_BIG("%.0f") " %s", size, unit);
+    if (i > 0 && size / scale < 10) {
+        guint64 tenths = (size + scale / 20) / (scale / 10);
+        if (tenths < 100) {
+            g_snprintf(buf, bufsize, big ? FORMAT_BIG("%u") ".%u %s" : "%u.%u %s",
+                       (guint) (tenths / 10), (guint) (tenths % 10), units[i]);
+            return;
+        }
     }
+    g_snprintf(buf, bufsize, big ? FORMAT_BIG("%" G_GUINT64_FORMAT) " %s" :
+                                   "%" G_GUINT64_FORMAT " %s",
+               size / scale + (size % scale >= scale - scale / 2), units[i]);
+}
 
-    char *s = g_strdup_printf("%.1f", size);
-    char *dot = strchr(s, '.');
-    *dot = '\0';
-    char *retval = g_strdup_printf(FORMAT_BIG("%s") ".%s %s", s, dot + 1, unit);
-    g_free(s);
-    return retval;
+// Shows markup in the default font (see show_text()).
+static void
+show_markup(Manitor *self, cairo_t *cr, const char *markup,
+            double x, double y, double ha, double va)
+{
+    Text *text = text_cache_get(self->texts, markup, self->font, PANGO_ALIGN_LEFT);
+    show_text(cr, text, x, y, ha, va);
+    text_unref(text);
+}
+
+// Makes the next draw redraw the static layer.
+static void
+manitor_invalidate_static(Manitor *self)
+{
+    if (self->static_layer) {
+        self->static_layer = (cairo_surface_destroy(self->static_layer), NULL);
+    }
 }
 
 // Gets called when the number, size or position of the monitors attached to
@@ -274,206 +574,1357 @@ format_size(double size)
 static void
 on_monitors_changed(GdkScreen *screen, Manitor *self)
 {
+    manitor_invalidate_static(self);
     manitor_place_window(self);
 }
 
-static gboolean
-on_tick(Manitor *self)
+// Gets called when the style (e.g. the font settings) changes.
+static void
+on_style_updated(GtkWidget *widget, Manitor *self)
 {
-    info_update(self->info);
-    gtk_widget_queue_draw(self->window);
-    return TRUE;
+    // The texts are laid out again with the new context.
+    text_cache_clear(self->texts);
+    manitor_invalidate_static(self);
+    gtk_widget_queue_draw(widget);
 }
 
+// Computes self->geom for the given window size and number of CPUs.
 static void
-draw_clock(Manitor *self, cairo_t *cr, PangoLayout *layout, int window_width, int window_height)
+compute_geometry(Manitor *self, int width, int height, int ncpu)
 {
-    static int radius = 0;
-    static int seconds_radius = 0;
-
-    if (G_UNLIKELY(radius == 0)) {
-        GDateTime *tm = g_date_time_new_local(2000, 1, 1, 20, 0, 59);
-        char *tmstr = g_date_time_format(tm, CONF_CLOCK_FORMAT);
-        pango_layout_set_markup(layout, tmstr, -1);
-        g_free(tmstr);
-        g_date_time_unref(tm);
+    Geometry *g = &self->geom;
+    g->width = width;
+    g->height = height;
+    g->ncpu = ncpu;
 
-        int w, h;
-        pango_layout_get_pixel_size(layout, &w, &h);
-        radius = MAX(w, h) / 2;
-
-        pango_layout_set_markup(layout, "59", -1);
-        pango_layout_get_pixel_size(layout, &w, &h);
+    // The clock is as big as the widest time, plus room for the seconds.
+    {
+        struct tm tm = { .tm_year = 100, .tm_mday = 1, .tm_hour = 20, .tm_sec = 59 };
+        char tmstr[256];
+        format_clock(tmstr, sizeof(tmstr), &tm);
+        Text *text = text_cache_get(self->texts, tmstr, self->font, PANGO_ALIGN_LEFT);
+
+        int w = text->logical.width;
+        int h = text->logical.height;
+        int radius = MAX(w, h) / 2;
+        text_unref(text);
+
+        text = text_cache_get(self->texts, "59", self->font, PANGO_ALIGN_LEFT);
+        w = text->logical.width;
+        h = text->logical.height;
         radius += 2 * MAX(w, h);
-        seconds_radius = radius - MAX(w, h);
+        text_unref(text);
+
+        g->clock_x = width / 2;
+        g->clock_y = height / 2;
+        g->clock_radius = radius;
+        g->seconds_radius = radius - MAX(w, h);
     }
 
-    int cx = window_width / 2;
-    int cy = window_height / 2;
+    g->ring_y = height - 1;
+    g->ring_radius = RING_RADIUS;
+    g->cpu_x = width / 2;
+    g->graph_width = 2 * g->ring_radius;
+    g->graph_height = 24;
+
+    // The CPU rings stay below the clock, with their graphs above them, and
+    // leave room on either side for the MEM and SWAP rings and their
+    // percentages (about as wide as a ring). With many CPUs they get closer
+    // together to fit.
+    double avail = MIN(g->ring_y - (g->clock_y + g->clock_radius) -
+                       2 * g->graph_height - GRAPH_GAP - RING_GAP,
+                       g->cpu_x - 6 * RING_GAP - 4 * g->ring_radius);
+    g->ring_gap = CLAMP((avail - g->ring_radius) / MAX(1, ncpu - 1), MIN_RING_GAP, RING_GAP);
+    g->ring_width = CLAMP(g->ring_gap / 2, 1, RING_WIDTH);
+
+    double cpuradius = g->ring_radius + MAX(0, ncpu - 1) * g->ring_gap;
+    g->mem_x = g->cpu_x - (cpuradius + 4 * RING_GAP);
+    g->swap_x = g->cpu_x + (cpuradius + 4 * RING_GAP);
+
+    // The graphs are as wide as the MEM and SWAP rings, above the rings.
+    // The one of each CPU is between the CPU rings and the average.
+    g->cpus_graph_y = g->ring_y - cpuradius - RING_GAP;
+    g->cpu_graph_y = g->cpus_graph_y - g->graph_height - GRAPH_GAP;
+    g->graph_y = g->ring_y - g->ring_radius - RING_GAP;
+}
+
+// Draws what does not change with the values: the clock background, the ring
+// tracks and the ring labels.
+static void
+draw_static(Manitor *self, cairo_t *cr)
+{
+    Geometry *g = &self->geom;
 
-    // Draw the background
     cairo_save(cr);
     gdk_cairo_set_source_rgba(cr, self->shade_color);
-    cairo_arc(cr, cx, cy, radius, 0, TAU);
+    cairo_arc(cr, g->clock_x, g->clock_y, g->clock_radius, 0, TAU);
     cairo_fill(cr);
     cairo_restore(cr);
 
-    GDateTime *tm = info_get_time(self->info);
-    // Handle the case when we cannot get the time...
-    if (G_UNLIKELY(!tm)) {
-        pango_layout_set_markup(layout, "Cannot get the time \360\237\230\262", -1);
-        show_layout(cr, layout, cx, cy, 0.5, 0.5);
+    for (int i = 0; i < g->ncpu; i++) {
+        draw_ring_track(self, cr, g->cpu_x, g->ring_y,
+                        g->ring_radius + i * g->ring_gap, 180, 360);
+    }
+    draw_ring_track(self, cr, g->mem_x, g->ring_y, g->ring_radius, 180, 360);
+    draw_ring_track(self, cr, g->swap_x, g->ring_y, g->ring_radius, 180, 360);
+
+    gdk_cairo_set_source_rgba(cr, self->color);
+    show_markup(self, cr, "CPU", g->cpu_x, g->ring_y, 0.5, -1);
+    show_markup(self, cr, "MEM", g->mem_x, g->ring_y, 0.5, -1);
+    show_markup(self, cr, "SWAP", g->swap_x, g->ring_y, 0.5, -1);
+}
+
+// Makes sure self->static_layer is up to date for the size and scale of the
+// window, and the number of CPUs to show. Returns TRUE if it had to be
+// redrawn (the geometry may have changed).
+// window: The window, or NULL to draw into an image surface.
+static gboolean
+update_static_layer(Manitor *self, GdkWindow *window, int width, int height,
+                    int scale, int ncpu)
+{
+    Geometry *g = &self->geom;
+
+    if (self->static_layer && g->width == width && g->height == height &&
+        g->scale == scale && g->ncpu == ncpu) {
+        return FALSE;
+    }
+
+    manitor_invalidate_static(self);
+    compute_geometry(self, width, height, ncpu);
+    g->scale = scale;
+
+    // The surface gets the scale of the window, so it is drawn at the full
+    // device resolution.
+    if (window) {
+        self->static_layer = gdk_window_create_similar_surface(
+            window, CAIRO_CONTENT_COLOR_ALPHA, width, height);
+    } else {
+        self->static_layer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    }
+    cairo_t *cr = cairo_create(self->static_layer);
+    draw_static(self, cr);
+    cairo_destroy(cr);
+    return TRUE;
+}
+
+// Sets the text of an element, to be placed like show_text() would.
+// markup can be NULL to show no text.
+static void
+element_set_text(Manitor *self, Element *e, const char *markup, PangoAlignment align,
+                 double x, double y, double ha, double va)
+{
+    if (e->text ? (markup && strcmp(e->text->markup, markup) == 0) : !markup) {
+        return;
+    }
+
+    text_unref(e->text);
+    if (markup && allocs_get) {
+        // Pango allocates when it lays out text the cache does not have.
+        guint64 hits, misses, after;
+        text_cache_get_stats(self->texts, &hits, &misses);
+        int a = allocs_get();
+        e->text = text_cache_get(self->texts, markup, self->font, align);
+        text_cache_get_stats(self->texts, &hits, &after);
+        if (after != misses) self->layout_allocs += allocs_get() - a;
+    } else {
+        e->text = markup ? text_cache_get(self->texts, markup, self->font, align) : NULL;
+    }
+    e->changed = TRUE;
+    if (e->text) {
+        place_text(e->text, x, y, ha, va, &e->tx, &e->ty);
+    }
+}
+
+// Makes an element show n rings centered at (x, y).
+// radius: The radius of the innermost ring.
+// gap: The gap between rings.
+// width: The width of their lines.
+// alarm: See draw_ring().
+static void
+element_set_rings(Element *e, guint n, double x, double y, double radius,
+                  double gap, double width, double alarm)
+{
+    if (e->rings->len != n) {
+        g_array_set_size(e->rings, n);
+        e->changed = TRUE;
+    }
+    e->rx = x;
+    e->ry = y;
+    e->radius = radius;
+    e->gap = gap;
+    e->width = width;
+    e->alarm = alarm;
+}
+
+// Sets the value of ring i (0 = innermost) of an element.
+static void
+element_set_ring_value(Element *e, guint i, double value, double part)
+{
+    value = CLAMP(value, 0, 1);
+    part = CLAMP(part, 0, value);
+
+    // One step per pixel along the ring: smaller changes are not visible.
+    double radius = e->radius + i * e->gap;
+    int length = lround(value * G_PI * radius);
+    int part_length = lround(part * G_PI * radius);
+    int key = 2 * (length * 4096 + part_length);
+    key += (e->alarm > 0 && value >= e->alarm);
+
+    Ring *ring = &g_array_index(e->rings, Ring, i);
+    if (ring->key != key) {
+        ring->key = key;
+        ring->value = value;
+        ring->part = part;
+        e->changed = TRUE;
+    }
+}
+
+static gboolean
+metric_history(InfoSnapshot *snap, gconstpointer data, int i, float *values, guint n)
+{
+    const InfoMetric *metrics = data;
+    return info_get_history(snap, metrics[i], values, n);
+}
+
+static gboolean
+cpu_history(InfoSnapshot *snap, gconstpointer data, int i, float *values, guint n)
+{
+    return info_get_cpu_history(snap, i, values, n);
+}
+
+static gboolean
+mount_history(InfoSnapshot *snap, gconstpointer data, int i, float *values, guint n)
+{
+    const GPtrArray *mounts = data;
+    return info_get_fs_history(snap, g_unix_mount_get_mount_path(mounts->pdata[i]),
+                               values, n);
+}
+
+// Makes an element show the history of nsources values (see HistoryFunc) as
+// graphs of width columns. Each column shows the highest value of a run of
+// values. The runs start at multiples of their length, so the graphs only
+// scroll when a run is complete, and only the values of the runs that are not
+// complete yet are read again. (So the oldest columns keep the values that
+// have since left the history.)
+// x, y: The bottom left corner of the first graph.
+// height: The height of each graph. GRAPH_HEAT: of all the rows together.
+//         Sources then share rows when there are more of them than pixels.
+// pitch: How much lower each next graph is (not for GRAPH_HEAT: the rows
+//        touch).
+static void
+element_set_graph(Manitor *self, Element *e, GraphStyle style, HistoryFunc func,
+                  gconstpointer data, int nsources, double x, double y,
+                  int width, double height, double pitch)
+{
+    guint n = self->history_len;
+    int series = (style == GRAPH_HEAT) ? MIN(nsources, MAX(1, (int) height)) : nsources;
+    if (n == 0 || width <= 0 || series <= 0) {
+        if (e->series > 0) {
+            e->series = 0;
+            e->changed = TRUE;
+        }
         return;
     }
 
-    // Show the time
-    char *s = g_date_time_format(tm, CONF_CLOCK_FORMAT);
-    pango_layout_set_markup(layout, s, -1);
-    g_free(s);
-    show_layout(cr, layout, cx, cy, 0.5, 0.5);
+    if (style == GRAPH_HEAT) {
+        pitch = height / series;
+        height = pitch;
+        y -= (series - 1) * pitch;
+    }
+    if (e->gx != x || e->gy != y || e->gheight != height || e->gpitch != pitch) {
+        e->changed = TRUE;
+    }
+    e->gx = x;
+    e->gy = y;
+    e->gheight = height;
+    e->gpitch = pitch;
+
+    gint64 count = info_get_history_count(self->snap);
+    gint64 run = (n + width - 1) / width;
+    gint64 last_run = (count > 0) ? (count - 1) / run : 0;
+
+    // Scroll the complete runs. The ones from column "from" on are read again.
+    int from = 0;
+    if (e->series == series && e->gwidth == width && e->gstyle == style &&
+        e->gdata == data && e->gsources == nsources &&
+        last_run >= e->last_run && last_run - e->last_run < width) {
+        int shift = last_run - e->last_run;
+        from = width - 1 - shift;
+        for (int i = 0; shift > 0 && i < series; i++) {
+            float *row = &g_array_index(e->columns, float, i * width);
+            memmove(row, row + shift, from * sizeof(float));
+        }
+    } else {
+        g_array_set_size(e->columns, series * width);
+        g_array_set_size(e->heights, series * width);
+        for (int i = 0; i < series * width; i++) {
+            g_array_index(e->heights, int, i) = -1;
+        }
+        e->series = series;
+        e->gwidth = width;
+        e->gstyle = style;
+        e->gdata = data;
+        e->gsources = nsources;
+        e->changed = TRUE;
+    }
+    e->last_run = last_run;
+
+    for (int i = 0; i < series; i++) {
+        float *row = &g_array_index(e->columns, float, i * width);
+        for (int col = from; col < width; col++) {
+            row[col] = NAN;
+        }
+    }
 
-    // Show the seconds circling around
-    char buf[20];
-    int sec = g_date_time_get_second(tm);
-    g_snprintf(buf, sizeof(buf), "%02d", sec);
-    double fraction = ((double) sec) / 60.0;
-    pango_layout_set_markup(layout, buf, -1);
-    show_layout(cr, layout,
-                cx + seconds_radius * cos(RAD(-90) + fraction * TAU),
-                cy + seconds_radius * sin(RAD(-90) + fraction * TAU),
-                0.5, 0.5);
+    // self->history[k] is value number first + k.
+    gint64 start = (last_run - (width - 1 - from)) * run;
+    guint m = CLAMP(count - start, 0, n);
+    gint64 first = count - m;
+    for (int i = 0; i < nsources && m > 0; i++) {
+        if (!func(self->snap, data, i, self->history, m)) {
+            continue;
+        }
+        float *row = &g_array_index(e->columns, float, (i * series / nsources) * width);
+        for (int col = from; col < width; col++) {
+            gint64 begin = (last_run - (width - 1 - col)) * run;
+            for (gint64 k = MAX(begin, first); k < MIN(begin + run, count); k++) {
+                row[col] = fmaxf(row[col], self->history[k - first]);
+            }
+        }
+    }
+
+    for (int i = 0; i < series; i++) {
+        const float *row = &g_array_index(e->columns, float, i * width);
+        double scale = 1;
+        if (style == GRAPH_SCALED) {
+            // A power of 2, so the scale only changes now and then.
+            float max = 0;
+            for (int col = 0; col < width; col++) {
+                if (row[col] > max) max = row[col];
+            }
+            scale = (max > 0) ? exp2(ceil(log2(max))) : 1;
+        }
+
+        for (int col = 0; col < width; col++) {
+            double v = CLAMP(row[col] / scale, 0, 1);
+            int h = isnan(row[col]) ? -1 :
+                    (style == GRAPH_HEAT) ? (int) lround(v * HEAT_SHADES) :
+                                            (int) lround(v * height);
+            int *column = &g_array_index(e->heights, int, i * width + col);
+            if (*column != h) {
+                *column = h;
+                e->changed = TRUE;
+            }
+        }
+    }
 }
 
+// Adds rectangle b to rectangle a. Empty rectangles do not count.
 static void
-draw_mounts(Manitor *self, cairo_t *cr, PangoLayout *layout, int window_width, int window_height)
+add_rectangle(GdkRectangle *a, const GdkRectangle *b)
 {
-    GString *str = g_string_sized_new(1024);
+    if (b->width <= 0 || b->height <= 0) {
+        return;
+    }
+    if (a->width <= 0 || a->height <= 0) {
+        *a = *b;
+        return;
+    }
+    gdk_rectangle_union(a, b, a);
+}
 
-    GPtrArray *mounts = info_get_mounts(self->info);
-    for (guint i = 0; i < mounts->len; i++) {
-        GUnixMountEntry *entry = mounts->pdata[i];
-        const char *path = g_unix_mount_get_mount_path(entry);
+// Marks rectangle r of the window to be redrawn.
+static void
+manitor_queue_draw(Manitor *self, const GdkRectangle *r)
+{
+    if (self->window) {
+        gtk_widget_queue_draw_area(self->window, r->x, r->y, r->width, r->height);
+    } else if (self->ndamage < G_N_ELEMENTS(self->damage)) {
+        self->damage[self->ndamage++] = *r;
+    } else {
+        GdkRectangle *last = &self->damage[self->ndamage - 1];
+        gdk_rectangle_union(last, r, last);
+    }
+}
 
-        char *size = format_size(info_get_fs_free(self->info, path));
-        g_string_append(str, size);
-        g_string_append(str, " free\n");
-        g_free(size);
+// Finds the new rectangle of an element that changed, and invalidates the
+// old and new ones if invalidate is TRUE.
+static void
+element_commit(Manitor *self, Element *e, gboolean invalidate)
+{
+    if (!e->changed) {
+        return;
+    }
+    e->changed = FALSE;
+
+    if (invalidate) {
+        manitor_queue_draw(self, &e->rect);
+    }
+
+    GdkRectangle rect = { 0 };
+    if (e->text) {
+        const PangoRectangle *ink = &e->text->ink;
+        const PangoRectangle *logical = &e->text->logical;
+        GdkRectangle r = { ink->x, ink->y, ink->width, ink->height };
+        GdkRectangle l = { logical->x, logical->y, logical->width, logical->height };
+        add_rectangle(&rect, &r);
+        add_rectangle(&rect, &l);
+        // One more pixel on each side for antialiasing.
+        rect.x += floor(e->tx) - 1;
+        rect.y += floor(e->ty) - 1;
+        rect.width += 3;
+        rect.height += 3;
+    }
+    if (e->series > 0) {
+        GdkRectangle graph = { floor(e->gx), floor(e->gy - e->gheight), e->gwidth + 1,
+                               ceil((e->series - 1) * e->gpitch + e->gheight) + 2 };
+        add_rectangle(&rect, &graph);
+    }
+    if (e->rings->len > 0) {
+        // Half the thick line width, and then some.
+        int r = ceil(e->radius + (e->rings->len - 1) * e->gap + 5);
+        GdkRectangle rings = { floor(e->rx) - r, floor(e->ry) - r, 2 * r + 1, r + 6 };
+        add_rectangle(&rect, &rings);
+    }
+    e->rect = rect;
+
+    if (invalidate) {
+        manitor_queue_draw(self, &e->rect);
+    }
+}
 
-        if (strcmp(path, "/") == 0) {
+// Appends text to str, escaped for markup like g_markup_escape_text() does,
+// but without allocating.
+static void
+append_escaped(GString *str, const char *text)
+{
+    for (const char *p = text; *p; p++) {
+        guchar c = *p;
+        switch (c) {
+        case '&':
+            g_string_append(str, "&amp;");
+            break;
+        case '<':
+            g_string_append(str, "&lt;");
+            break;
+        case '>':
+            g_string_append(str, "&gt;");
+            break;
+        case '\'':
+            g_string_append(str, "&#39;");
+            break;
+        case '"':
+            g_string_append(str, "&quot;");
+            break;
+        default:
+            if ((c < 0x20 && c != '\t' && c != '\n' && c != '\r') || c == 0x7f) {
+                g_string_append(str, "&#x");
+                g_string_append_c(str, "0123456789abcdef"[c >> 4]);
+                g_string_append_c(str, "0123456789abcdef"[c & 15]);
+                g_string_append_c(str, ';');
+            } else {
+                g_string_append_c(str, c);
+            }
+        }
+    }
+}
+
+// Returns the names of mounts, as markup. Guessing them allocates, so they
+// are kept until the mount table changes.
+static GPtrArray *
+get_mount_names(Manitor *self, GPtrArray *mounts)
+{
+    if (self->mounts == mounts) {
+        return self->mount_names;
+    }
+
+    if (self->mounts) {
+        g_ptr_array_unref(self->mounts);
+        g_ptr_array_unref(self->mount_names);
+    }
+    // Holding on to mounts keeps another table from getting its address.
+    self->mounts = g_ptr_array_ref(mounts);
+    self->mount_names = g_ptr_array_new_full(mounts->len, g_free);
+    GString *str = g_string_new(NULL);
+    for (guint i = 0; i < mounts->len; i++) {
+        GUnixMountEntry *entry = mounts->pdata[i];
+        g_string_truncate(str, 0);
+        if (strcmp(g_unix_mount_get_mount_path(entry), "/") == 0) {
             g_string_append(str, "root");
         } else {
             char *name = g_unix_mount_guess_name(entry);
-            g_string_append(str, name);
+            append_escaped(str, name);
             g_free(name);
         }
-        g_string_append(str, "\n\n");
+        g_ptr_array_add(self->mount_names, g_strdup(str->str));
     }
+    g_string_free(str, TRUE);
+    return self->mount_names;
+}
 
-    PangoAlignment align = pango_layout_get_alignment(layout);
-    pango_layout_set_alignment(layout, PANGO_ALIGN_RIGHT);
-    pango_layout_set_markup(layout, str->str, -1);
-    show_layout(cr, layout, window_width - 1, 0, 1.0, 0.0);
-    pango_layout_set_alignment(layout, align);
+// Builds the mounts text in self->scratch. Returns NULL if there are no
+// mounts yet.
+static const char *
+format_mounts(Manitor *self, InfoSnapshot *snap)
+{
+    GPtrArray *mounts = info_get_mounts(snap);
+    if (!mounts) {
+        return NULL;
+    }
 
-    g_string_free(str, TRUE);
+    GPtrArray *names = get_mount_names(self, mounts);
+    GString *str = self->scratch;
+    char size[256];
+    char read[32];
+    char write[32];
+    g_string_truncate(str, 0);
+    for (guint i = 0; i < mounts->len; i++) {
+        GUnixMountEntry *entry = mounts->pdata[i];
+        const char *path = g_unix_mount_get_mount_path(entry);
+
+        // Dim the free space if it is out of date (e.g. the filesystem hangs).
+        // Drawing never waits for the filesystem.
+        gboolean stale = info_get_fs_stale(snap, path);
+        format_size(size, sizeof(size), info_get_fs_free(snap, path), TRUE);
+        if (stale) g_string_append(str, "<span fgalpha='50%'>");
+        g_string_append(str, size);
+        g_string_append(str, " free");
+        if (stale) g_string_append(str, "</span>");
+
+        // The I/O of its device: reads and writes, operations, how busy the
+        // disk is and how long an operation takes.
+        InfoDiskIO io;
+        if (info_get_disk_io(snap, path, &io)) {
+            format_size(read, sizeof(read), io.read_bytes, FALSE);
+            format_size(write, sizeof(write), io.write_bytes, FALSE);
+            g_snprintf(size, sizeof(size),
+                       "  <span size='small'>R %s/s  W %s/s  %.0f IOPS  %.0f%%  %.1f ms</span>",
+                       read, write, io.read_iops + io.write_iops, io.util * 100, io.await);
+            g_string_append(str, size);
+        }
+        g_string_append(str, "\n");
+        g_string_append(str, names->pdata[i]);
+        g_string_append(str, "\n\n");
+    }
+
+    return str->str;
 }
 
+// Returns TRUE if resource is under enough pressure to be shown in the alarm
+// color.
 static gboolean
-on_draw(GtkWidget *widget, cairo_t *cr, Manitor *self)
+pressure_alarm(InfoSnapshot *snap, InfoPressureResource resource)
 {
-    char buf[256];
+    InfoPressure p;
+    return info_get_pressure(snap, resource, &p) &&
+           (p.stalled || (CONF_PRESSURE_ALARM > 0 && p.some >= CONF_PRESSURE_ALARM));
+}
 
-    PangoLayout *layout = pango_cairo_create_layout(cr);
-    pango_layout_set_font_description(layout, self->font);
-    gdk_cairo_set_source_rgba(cr, self->color);
+// Builds the list of the busiest processes in self->scratch, one per line:
+// the CPU usage (100% = one CPU), the resident memory and the name. The
+// busiest cgroups follow, with their I/O. Returns NULL if there are none.
+static const char *
+format_procs(Manitor *self, InfoSnapshot *snap)
+{
+    guint n = info_get_top_count(snap);
+    guint ncgroups = info_get_top_cgroup_count(snap);
+    if (n == 0 && ncgroups == 0) {
+        return NULL;
+    }
+    GString *str = self->scratch;
+
+    // The run queue first: how many want a CPU, and how busy the scheduler is.
+    // (g_string_append_printf() allocates, g_snprintf() does not.)
+    char buf[128];
+    g_snprintf(buf, sizeof(buf), "%u running  %u blocked  %.0fk switches/s",
+               info_get_procs_running(snap), info_get_procs_blocked(snap),
+               info_get_ctxt_rate(snap) / 1e3);
+    g_string_truncate(str, 0);
+    g_string_append(str, buf);
+
+    // Then the pressure: how much of the time some and all tasks stalled
+    // waiting for each resource.
+    static const char *resources[INFO_PRESSURES] = { "cpu", "mem", "io" };
+    const char *sep = "\n";
+    for (int i = 0; i < INFO_PRESSURES; i++) {
+        InfoPressure p;
+        if (!info_get_pressure(snap, i, &p)) {
+            continue;
+        }
+        gboolean alarm = pressure_alarm(snap, i);
+        g_snprintf(buf, sizeof(buf), "%s%s%s %.0f/%.0f%%%s", sep,
+                   alarm ? self->alarm_span : "", resources[i],
+                   100 * p.some, 100 * p.full, alarm ? "</span>" : "");
+        g_string_append(str, buf);
+        sep = "  ";
+    }
 
-    int width = gtk_widget_get_allocated_width(widget);
-    int height = gtk_widget_get_allocated_height(widget);
-    int cx = width / 2;
-    //int cy = height / 2;
+    for (guint i = 0; i < n; i++) {
+        const InfoProc *proc = info_get_top_proc(snap, i);
+        g_snprintf(buf, sizeof(buf), "\n%.0f%%  %.0f MB  ", 100 * proc->cpu, proc->rss / 1e6);
+        g_string_append(str, buf);
+        append_escaped(str, proc->name);
+    }
 
-    draw_clock(self, cr, layout, width, height);
-    draw_mounts(self, cr, layout, width, height);
+    char read[32];
+    char write[32];
+    if (ncgroups > 0) g_string_append(str, "\n");
+    for (guint i = 0; i < ncgroups; i++) {
+        const InfoCgroup *cg = info_get_top_cgroup(snap, i);
+        format_size(read, sizeof(read), cg->read_bytes, FALSE);
+        format_size(write, sizeof(write), cg->write_bytes, FALSE);
+        g_snprintf(buf, sizeof(buf), "\n%.0f%%  %.0f MB  R %s/s  W %s/s  ",
+                   100 * cg->cpu, cg->memory / 1e6, read, write);
+        g_string_append(str, buf);
+        append_escaped(str, *cg->path ? cg->path : "/");
+    }
 
-    // CPU
-    double x = cx;
-    double y = height - 1;
-    double radius = 35;
-    double gap = 15;
-    double cpuradius;
-    {
-        int ncpu = info_get_cpu_count(self->info);
-        for (int i = 0; i < ncpu; i++) {
-            int r = radius + i * gap;
-            cpuradius = r;
-            int cpu = ncpu - i - 1;
-            draw_ring(self, cr, info_get_cpu_usage(self->info, cpu),
-                      x, y, r, 180, 360, CONF_CPU_ALARM);
+    return str->str;
+}
+
+// Appends the stage times and the text cache statistics to out.
+// markup: format them as Pango markup.
+static void
+manitor_format_prof(Manitor *self, GString *out, gboolean markup)
+{
+    guint64 hits, misses;
+    text_cache_get_stats(self->texts, &hits, &misses);
+
+    // (g_string_append_printf() allocates, g_snprintf() does not.)
+    char buf[128];
+    prof_format(self->update_prof, out, markup);
+    if (markup) g_string_append(out, "\n");
+    prof_format(self->prof, out, markup);
+    g_snprintf(buf, sizeof(buf), "%stext cache: %" G_GUINT64_FORMAT " hits, %"
+               G_GUINT64_FORMAT " misses", markup ? "\n" : "", hits, misses);
+    g_string_append(out, buf);
+}
+
+// Brings the elements up to date with self->snap.
+// relayout: TRUE if the geometry changed. Every element is then placed again
+//           and nothing is invalidated, as the whole window gets redrawn.
+static void
+manitor_update_elements(Manitor *self, gboolean relayout)
+{
+    InfoSnapshot *snap = self->snap;
+    Geometry *g = &self->geom;
+    Element *elems = self->elements;
+    char buf[256];
+
+    if (relayout) {
+        for (int i = 0; i < ELEM_COUNT; i++) {
+            text_unref(elems[i].text);
+            elems[i].text = NULL;
+            g_array_set_size(elems[i].rings, 0);
+            elems[i].series = 0;
+            elems[i].changed = TRUE;
         }
-        pango_layout_set_markup(layout, "CPU", -1);
-        show_layout(cr, layout, x, y, 0.5, -1);
+    }
+
+    // Clock
+    const struct tm *tm = info_get_local_time(snap);
+    if (G_LIKELY(tm)) {
+        format_clock(buf, sizeof(buf), tm);
+        element_set_text(self, &elems[ELEM_CLOCK], buf,
+                         PANGO_ALIGN_LEFT, g->clock_x, g->clock_y, 0.5, 0.5);
+
+        int sec = MIN(tm->tm_sec, 59);
+        double a = RAD(-90) + sec / 60.0 * TAU;
+        g_snprintf(buf, sizeof(buf), "%02d", sec);
+        element_set_text(self, &elems[ELEM_SECONDS], buf,
+                         PANGO_ALIGN_LEFT,
+                         g->clock_x + g->seconds_radius * cos(a),
+                         g->clock_y + g->seconds_radius * sin(a), 0.5, 0.5);
+    } else {
+        // Handle the case when we cannot get the time...
+        element_set_text(self, &elems[ELEM_CLOCK],
+                         "Cannot get the time \360\237\230\262",
+                         PANGO_ALIGN_LEFT, g->clock_x, g->clock_y, 0.5, 0.5);
+        element_set_text(self, &elems[ELEM_SECONDS], NULL, PANGO_ALIGN_LEFT, 0, 0, 0, 0);
+    }
+
+    // CPU. Tasks stalling for it sound the alarm whatever the usage.
+    element_set_rings(&elems[ELEM_CPU], g->ncpu, g->cpu_x, g->ring_y,
+                      g->ring_radius, g->ring_gap, g->ring_width,
+                      pressure_alarm(snap, INFO_PRESSURE_CPU) ? G_MINDOUBLE : CONF_CPU_ALARM);
+    for (int i = 0; i < g->ncpu; i++) {
+        // The time stolen by the hypervisor counts as used, as the CPU is
+        // not there for us. Show how much of it there is.
+        double times[INFO_CPU_STATES] = { 0 };
+        info_get_cpu_times(snap, g->ncpu - i - 1, times);
+        element_set_ring_value(&elems[ELEM_CPU], i,
+                               info_get_cpu_usage(snap, g->ncpu - i - 1),
+                               times[INFO_CPU_STEAL]);
     }
 
     // Memory
     {
-        double mem = info_get_mem(self->info);
-        x = cx - (cpuradius + 4 * gap);
-        draw_ring(self, cr, mem, x, y, radius, 180, 360, CONF_MEM_ALARM);
-        pango_layout_set_markup(layout, "MEM", -1);
-        show_layout(cr, layout, x, y, 0.5, -1);
-
+        double mem = info_get_mem(snap);
+        Element *e = &elems[ELEM_MEM];
+        element_set_rings(e, 1, g->mem_x, g->ring_y, g->ring_radius, 0, RING_WIDTH,
+                          pressure_alarm(snap, INFO_PRESSURE_MEMORY) ? G_MINDOUBLE :
+                                                                       CONF_MEM_ALARM);
+        element_set_ring_value(e, 0, mem, 0);
         g_snprintf(buf, sizeof(buf), "%.0f%%", trunc(100 * mem));
-        pango_layout_set_markup(layout, buf, -1);
-        show_layout(cr, layout, x - radius - gap, y, 1, -1);
+        element_set_text(self, e, buf,
+                         PANGO_ALIGN_LEFT, g->mem_x - g->ring_radius - RING_GAP,
+                         g->ring_y, 1, -1);
     }
 
     // Swap
     {
-        double swp = info_get_swap(self->info);
-        x = cx + (cpuradius + 4 * gap);
-        draw_ring(self, cr, swp, x, y, radius, 180, 360, CONF_SWAP_ALARM);
-        pango_layout_set_markup(layout, "SWAP", -1);
-        show_layout(cr, layout, x, y, 0.5, -1);
-
+        double swp = info_get_swap(snap);
+        Element *e = &elems[ELEM_SWAP];
+        element_set_rings(e, 1, g->swap_x, g->ring_y, g->ring_radius, 0, RING_WIDTH,
+                          CONF_SWAP_ALARM);
+        element_set_ring_value(e, 0, swp, 0);
         g_snprintf(buf, sizeof(buf), "%.0f%%", trunc(100 * swp));
-        pango_layout_set_markup(layout, buf, -1);
-        show_layout(cr, layout, x + radius + gap, y, 0, -1);
+        element_set_text(self, e, buf,
+                         PANGO_ALIGN_LEFT, g->swap_x + g->ring_radius + RING_GAP,
+                         g->ring_y, 0, -1);
     }
 
+    // History. The rows of the CPUs are in the order of the rings, the
+    // outermost (CPU 0) on top.
+    static const InfoMetric cpu_metric[] = { INFO_HISTORY_CPU };
+    static const InfoMetric mem_metric[] = { INFO_HISTORY_MEM };
+    static const InfoMetric swap_metric[] = { INFO_HISTORY_SWAP };
+    element_set_graph(self, &elems[ELEM_CPU_GRAPH], GRAPH_FRACTION, metric_history,
+                      cpu_metric, 1, g->cpu_x - g->graph_width / 2, g->cpu_graph_y,
+                      g->graph_width, g->graph_height, 0);
+    element_set_graph(self, &elems[ELEM_CPUS_GRAPH], GRAPH_HEAT, cpu_history,
+                      NULL, g->ncpu, g->cpu_x - g->graph_width / 2, g->cpus_graph_y,
+                      g->graph_width, g->graph_height, 0);
+    element_set_graph(self, &elems[ELEM_MEM_GRAPH], GRAPH_FRACTION, metric_history,
+                      mem_metric, 1, g->mem_x - g->graph_width / 2, g->graph_y,
+                      g->graph_width, g->graph_height, 0);
+    element_set_graph(self, &elems[ELEM_SWAP_GRAPH], GRAPH_FRACTION, metric_history,
+                      swap_metric, 1, g->swap_x - g->graph_width / 2, g->graph_y,
+                      g->graph_width, g->graph_height, 0);
+
     // Uptime
+    format_uptime(buf, sizeof(buf), info_get_uptime(snap));
+    element_set_text(self, &elems[ELEM_UPTIME], buf,
+                     PANGO_ALIGN_LEFT, 0, g->height - 1, 0, -1);
+
+    // Net
     {
-        int x = 0;
-        int y = height - 1;
-        char *s = format_uptime(info_get_uptime(self->info));
-        pango_layout_set_markup(layout, s, -1);
-        g_free(s);
-        show_layout(cr, layout, x, y, 0, -1);
+        char up[96], dn[96];
+        format_netspeed(up, sizeof(up), info_get_net_txspeed(snap));
+        format_netspeed(dn, sizeof(dn), info_get_net_rxspeed(snap));
+        g_snprintf(buf, sizeof(buf), "%s kB/s \360\237\240\211\n"
+                                     "%s kB/s \360\237\240\213", up, dn);
+        element_set_text(self, &elems[ELEM_NET], buf, PANGO_ALIGN_RIGHT,
+                         g->width - 1, g->height - 1, 1, -2);
+
+        // Their history above them, in the same order, each scaled to fit.
+        static const InfoMetric net_metrics[] = { INFO_HISTORY_TX, INFO_HISTORY_RX };
+        const Element *e = &elems[ELEM_NET];
+        double height = g->graph_height / 2;
+        double y = e->ty + e->text->logical.y - GRAPH_GAP - (height + GRAPH_GAP);
+        element_set_graph(self, &elems[ELEM_NET_GRAPH], GRAPH_SCALED, metric_history,
+                          net_metrics, 2, g->width - 1 - g->graph_width, y,
+                          g->graph_width, height, height + GRAPH_GAP);
     }
 
-    // Net
+    // Mounts, with the history of their free space in the empty line after
+    // each one, scaled to fit.
+    element_set_text(self, &elems[ELEM_MOUNTS], format_mounts(self, snap),
+                     PANGO_ALIGN_RIGHT, g->width - 1, 0, 1.0, 0.0);
     {
-        int x = width - 1;
-        int y = height - 1;
-        char *up = format_netspeed(info_get_net_txspeed(self->info));
-        char *dn = format_netspeed(info_get_net_rxspeed(self->info));
-        char *s = g_strdup_printf("%s kB/s \360\237\240\211\n"
-                                  "%s kB/s \360\237\240\213", up, dn);
-        pango_layout_set_markup(layout, s, -1);
-        pango_layout_set_alignment(layout, PANGO_ALIGN_RIGHT);
-        show_layout(cr, layout, x, y, 1, -2);
-
-        g_free(s);
-        g_free(up);
-        g_free(dn);
-    }
-
-    g_object_unref(layout);
+        GPtrArray *mounts = info_get_mounts(snap);
+        const Element *e = &elems[ELEM_MOUNTS];
+        int n = (mounts && e->text) ? mounts->len : 0;
+        int line = n ? text_get_baseline(e->text, 2) - text_get_baseline(e->text, 1) : 0;
+        int pitch = (n > 1) ? text_get_baseline(e->text, 5) - text_get_baseline(e->text, 2) : 0;
+        element_set_graph(self, &elems[ELEM_MOUNTS_GRAPH], GRAPH_SCALED, mount_history,
+                          mounts, n, g->width - 1 - g->graph_width,
+                          e->ty + (n ? text_get_baseline(e->text, 2) : 0),
+                          g->graph_width, floor(line * 3 / 4), pitch);
+    }
+
+    // Processes
+    element_set_text(self, &elems[ELEM_PROCS], format_procs(self, snap),
+                     PANGO_ALIGN_LEFT, 0, 0, 0.0, 0.0);
+
+    // Profiling overlay, below the processes.
+    gint64 now = g_get_monotonic_time();
+    if (self->prof_overlay &&
+        (!elems[ELEM_PROF].text || now - self->prof_shown >= PROF_OVERLAY_PERIOD)) {
+        const Text *procs = elems[ELEM_PROCS].text;
+        self->prof_shown = now;
+        g_string_truncate(self->scratch, 0);
+        manitor_format_prof(self, self->scratch, TRUE);
+        element_set_text(self, &elems[ELEM_PROF], self->scratch->str,
+                         PANGO_ALIGN_LEFT, 0, procs ? procs->logical.height : 0, 0, 0);
+    }
+
+    for (int i = 0; i < ELEM_COUNT; i++) {
+        element_commit(self, &elems[i], !relayout);
+    }
+}
+
+static void
+draw_element(Manitor *self, cairo_t *cr, Element *e)
+{
+    GdkRGBA *c = self->color;
+    if (e->series > 0 && e->gstyle == GRAPH_HEAT) {
+        // One fill for each shade.
+        for (int shade = 1; shade <= HEAT_SHADES; shade++) {
+            for (int i = 0; i < e->series * e->gwidth; i++) {
+                if (g_array_index(e->heights, int, i) == shade) {
+                    double y = e->gy + (i / e->gwidth) * e->gpitch - e->gheight;
+                    cairo_rectangle(cr, e->gx + i % e->gwidth, y, 1, e->gheight);
+                }
+            }
+            cairo_set_source_rgba(cr, c->red, c->green, c->blue,
+                                  c->alpha * shade / HEAT_SHADES);
+            cairo_fill(cr);
+        }
+    } else if (e->series > 0) {
+        cairo_set_source_rgba(cr, c->red, c->green, c->blue, c->alpha / 2);
+        for (int i = 0; i < e->series * e->gwidth; i++) {
+            int h = g_array_index(e->heights, int, i);
+            if (h > 0) {
+                double y = e->gy + (i / e->gwidth) * e->gpitch;
+                cairo_rectangle(cr, e->gx + i % e->gwidth, y - h, 1, h);
+            }
+        }
+        cairo_fill(cr);
+    }
+
+    for (guint i = 0; i < e->rings->len; i++) {
+        Ring *ring = &g_array_index(e->rings, Ring, i);
+        draw_ring(self, cr, ring->value, ring->part, e->rx, e->ry,
+                  e->radius + i * e->gap, e->width, 180, 360, e->alarm);
+    }
+
+    if (e->text) {
+        gdk_cairo_set_source_rgba(cr, self->color);
+        cairo_move_to(cr, e->tx, e->ty);
+        pango_cairo_show_layout(cr, e->text->layout);
+        cairo_new_path(cr);
+    }
+}
+
+// Draws self->snap on cr, a window of the given size and scale (window is
+// NULL for an image surface).
+static void
+manitor_draw(Manitor *self, cairo_t *cr, GdkWindow *window, int width, int height,
+             int scale)
+{
+    // The sampler never touches this snapshot while we draw it.
+    if (G_UNLIKELY(!self->snap)) {
+        self->snap = info_acquire(self->info);
+    }
+
+    // These only time the drawing commands. The compositing happens later.
+    gint64 t = prof_start(self->prof);
+    // What cairo and Pango allocate is counted apart, so the rest can be
+    // held to none (see run_replay()).
+    int a = allocs_get ? allocs_get() : 0;
+
+    if (update_static_layer(self, window, width, height, scale,
+                            info_get_cpu_count(self->snap))) {
+        manitor_update_elements(self, TRUE);
+    }
+    prof_lap(self->prof, DRAW_STATIC, &t);
+
+    // Replace whatever is in the clip, so there is no need to clear it first.
+    cairo_save(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(cr, self->static_layer, 0, 0);
+    cairo_paint(cr);
+    cairo_restore(cr);
+    prof_lap(self->prof, DRAW_PAINT, &t);
+    if (allocs_get) self->render_allocs += allocs_get() - a;
+
+    // Only draw the elements that are (partly) in the extents of the clip.
+    // (cairo_copy_clip_rectangle_list() would allocate every frame.) Each
+    // kind of element is timed as a whole.
+    gint64 times[DRAW_STAGES] = { 0 };
+    GdkRectangle clip;
+    gboolean visible = gdk_cairo_get_clip_rectangle(cr, &clip);
+    for (int i = 0; i < ELEM_COUNT; i++) {
+        if (visible && gdk_rectangle_intersect(&clip, &self->elements[i].rect, NULL)) {
+            a = allocs_get ? allocs_get() : 0;
+            draw_element(self, cr, &self->elements[i]);
+            if (allocs_get) self->render_allocs += allocs_get() - a;
+        }
+        gint64 now = prof_start(self->prof);
+        times[elem_stages[i]] += now - t;
+        t = now;
+    }
+    for (int i = DRAW_CLOCK; i <= DRAW_TEXT; i++) {
+        prof_add(self->prof, i, times[i]);
+    }
+}
+
+static gboolean
+on_draw(GtkWidget *widget, cairo_t *cr, Manitor *self)
+{
+    manitor_draw(self, cr, gtk_widget_get_window(widget),
+                 gtk_widget_get_allocated_width(widget),
+                 gtk_widget_get_allocated_height(widget),
+                 gtk_widget_get_scale_factor(widget));
     return TRUE;
 }
 
+// Gets called on the main thread when the sampler has a new snapshot.
+static gboolean
+on_sample(Manitor *self)
+{
+    self->snap = info_acquire(self->info);
+
+    // Redraw everything if the layout has to change, otherwise only what
+    // changed.
+    if (!self->static_layer ||
+        info_get_cpu_count(self->snap) != self->geom.ncpu) {
+        manitor_invalidate_static(self);
+        if (self->window) {
+            gtk_widget_queue_draw(self->window);
+        }
+    } else {
+        gint64 t = prof_start(self->prof);
+        manitor_update_elements(self, FALSE);
+        prof_lap(self->prof, DRAW_LAYOUT, &t);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+// Stops sampling (and so drawing) while nobody can see the window. Resuming
+// takes a sample right away, which redraws what changed meanwhile. While
+// recording, what the recording needs is still sampled, so it has no gaps
+// (e.g. for the night the screen is locked).
+static void
+manitor_update_paused(Manitor *self)
+{
+    info_set_paused(self->info, self->withdrawn || self->obscured || self->idle);
+}
+
+static gboolean
+on_window_state_event(GtkWidget *widget, GdkEventWindowState *event, Manitor *self)
+{
+    self->withdrawn = (event->new_window_state &
+                       (GDK_WINDOW_STATE_WITHDRAWN | GDK_WINDOW_STATE_ICONIFIED)) != 0;
+    manitor_update_paused(self);
+    return FALSE;
+}
+
+// Only works without a compositor: with one, windows are never obscured.
+static gboolean
+on_visibility_notify_event(GtkWidget *widget, GdkEventVisibility *event, Manitor *self)
+{
+    self->obscured = (event->state == GDK_VISIBILITY_FULLY_OBSCURED);
+    manitor_update_paused(self);
+    return FALSE;
+}
+
+// Gets called when the screen saver starts or stops.
+static void
+on_screensaver_active_changed(GDBusConnection *connection, const char *sender,
+                              const char *path, const char *iface,
+                              const char *signal, GVariant *params, gpointer data)
+{
+    Manitor *self = data;
+    if (g_variant_is_of_type(params, G_VARIANT_TYPE("(b)"))) {
+        g_variant_get(params, "(b)", &self->idle);
+        manitor_update_paused(self);
+    }
+}
+
+// Prints the stage times on SIGUSR1.
+static gboolean
+on_sigusr1(Manitor *self)
+{
+    GString *str = g_string_new(NULL);
+    manitor_format_prof(self, str, FALSE);
+    g_printerr("%s\n", str->str);
+    g_string_free(str, TRUE);
+    return G_SOURCE_CONTINUE;
+}
+
+// Records every sample to CONF_RECORD_DIR, unless it is "". Call this
+// before the first update.
+static void
+manitor_start_recording(Manitor *self)
+{
+    if (!*CONF_RECORD_DIR) {
+        return;
+    }
+
+    char *dir = g_build_filename(g_get_user_data_dir(), CONF_RECORD_DIR, NULL);
+    GError *error = NULL;
+    self->recorder = recorder_new(dir, CONF_RECORD_SEGMENTS, &error);
+    if (self->recorder) {
+        info_set_snapshot_func(self->info, (InfoSnapshotFunc) recorder_add, self->recorder,
+                               RECORD_COLLECTORS);
+    } else {
+        g_warning("Not recording: %s", error->message);
+        g_error_free(error);
+    }
+    g_free(dir);
+}
+
+// Stops sampling and recording, and writes out what is left.
+static void
+manitor_stop(Manitor *self)
+{
+    self->info = (info_free(self->info), NULL);
+    self->recorder = (recorder_free(self->recorder), NULL);
+}
+
+static gboolean
+on_export_sample(Manitor *self)
+{
+    exporter_update(self->exporter, info_acquire(self->info));
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+on_quit_signal(GMainLoop *loop)
+{
+    g_main_loop_quit(loop);
+    return G_SOURCE_CONTINUE;
+}
+
+// Serves the values on the socket at path (NULL: CONF_SOCKET) instead of
+// showing them, without a display.
+static int
+run_headless(const char *path)
+{
+    Manitor *self = manitor_new();
+    char *default_path = g_build_filename(g_get_user_runtime_dir(), CONF_SOCKET, NULL);
+    GError *error = NULL;
+
+    self->exporter = exporter_new(path ? path : default_path, &error);
+    if (!self->exporter) {
+        g_printerr("manitor: %s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    manitor_start_recording(self);
+    info_update(self->info);
+    on_export_sample(self);
+    info_set_watch(self->info, (GSourceFunc) on_export_sample, self);
+    for (int i = 0; i < INFO_COLLECTORS; i++) {
+        info_set_period(self->info, i, self->periods[i]);
+    }
+    info_start(self->info);
+
+    // Quit cleanly, so the socket is removed.
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    g_unix_signal_add(SIGINT, (GSourceFunc) on_quit_signal, loop);
+    g_unix_signal_add(SIGTERM, (GSourceFunc) on_quit_signal, loop);
+    g_main_loop_run(loop);
+
+    g_main_loop_unref(loop);
+    exporter_free(self->exporter);
+    manitor_stop(self);
+    g_free(default_path);
+    return 0;
+}
+
+// Where run_replay() gets the values from: a recording, or made up.
+typedef struct {
+    char *path;             // The recording (NULL: make them up).
+    RecordReader *reader;   // Reads it, over and over again.
+    int series[5];          // The series of mem, swap, rx, tx and cpu0.
+    double *sample;         // A sample of the recording.
+    int ncpu;               // The number of CPUs.
+    double *usage;          // Their usage.
+    gint64 time;            // The time of the last values (us).
+    gint64 step;            // The time between made-up values (us).
+    guint64 count;          // The number of values so far.
+} Replay;
+
+// Opens the recording of r->path, and finds its series. Returns FALSE (and
+// sets error) if it cannot be read or is empty.
+static gboolean
+replay_open(Replay *r, GError **error)
+{
+    static const char *names[] = { "mem", "swap", "rx", "tx", "cpu0" };
+
+    r->reader = record_reader_open(r->path, error);
+    if (!r->reader) {
+        return FALSE;
+    }
+    if (record_reader_get_count(r->reader) == 0) {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s is empty", r->path);
+        r->reader = (record_reader_free(r->reader), NULL);
+        return FALSE;
+    }
+
+    guint n = record_reader_get_nseries(r->reader);
+    for (guint i = 0; i < G_N_ELEMENTS(names); i++) {
+        r->series[i] = -1;
+        for (guint j = 0; j < n; j++) {
+            if (strcmp(record_reader_get_name(r->reader, j), names[i]) == 0) {
+                r->series[i] = j;
+            }
+        }
+    }
+    // The CPUs follow cpu0.
+    r->ncpu = 0;
+    for (guint j = r->series[4]; r->series[4] >= 0 && j < n; j++) {
+        char name[32];
+        g_snprintf(name, sizeof(name), "cpu%d", r->ncpu);
+        if (strcmp(record_reader_get_name(r->reader, j), name) != 0) {
+            break;
+        }
+        r->ncpu++;
+    }
+
+    r->sample = g_renew(double, r->sample, n);
+    r->usage = g_renew(double, r->usage, MAX(1, r->ncpu));
+    return TRUE;
+}
+
+// Gets the next values into v. They are valid until the next call.
+static gboolean
+replay_next(Replay *r, InfoValues *v, GError **error)
+{
+    if (r->path) {
+        gint64 time;
+        if (!record_reader_next(r->reader, &time, r->sample)) {
+            // Start over.
+            record_reader_free(r->reader);
+            if (!replay_open(r, error) || !record_reader_next(r->reader, &time, r->sample)) {
+                return FALSE;
+            }
+        }
+        double *s = r->sample;
+        v->time = time * G_TIME_SPAN_MILLISECOND;
+        v->mem = (r->series[0] >= 0) ? s[r->series[0]] : 0;
+        v->swap = (r->series[1] >= 0) ? s[r->series[1]] : 0;
+        v->rxspeed = (r->series[2] >= 0) ? s[r->series[2]] : 0;
+        v->txspeed = (r->series[3] >= 0) ? s[r->series[3]] : 0;
+        for (int i = 0; i < r->ncpu; i++) {
+            r->usage[i] = s[r->series[4] + i];
+        }
+    } else {
+        // Everything moves, at different speeds.
+        double k = r->count;
+        r->time += r->step;
+        v->time = r->time;
+        v->mem = 0.5 + 0.2 * sin(k / 100);
+        v->swap = 0.05 + 0.05 * sin(k / 300);
+        v->rxspeed = 1e6 * (1 + sin(k / 10));
+        v->txspeed = 1e5 * (1 + cos(k / 7));
+        for (int i = 0; i < r->ncpu; i++) {
+            r->usage[i] = 0.5 + 0.45 * sin(k / 20 + i);
+        }
+    }
+    v->ncpu = r->ncpu;
+    v->cpu_usage = r->usage;
+    r->count++;
+    return TRUE;
+}
+
+static gboolean
+parse_size(const char *s, int *width, int *height)
+{
+    char *end;
+    guint64 w = g_ascii_strtoull(s, &end, 10);
+    if (*end != 'x') {
+        return FALSE;
+    }
+    guint64 h = g_ascii_strtoull(end + 1, &end, 10);
+    if (*end || w == 0 || h == 0 || w > 32767 || h > 32767) {
+        return FALSE;
+    }
+    *width = w;
+    *height = h;
+    return TRUE;
+}
+
+// Draws frames of values from a recording, or made up, into an image
+// surface as fast as it can, and prints how long the stages took. This
+// needs no display. The mounts, processes etc. are those of the system.
+//
+// manitor --replay [--size WxH] [--cpus N] [--frames N] [--full]
+//                  [--output PNG] [RECORDING]
+//
+// --cpus is for the made-up values. Only what changed is redrawn, as in the
+// window, unless --full is given. --output saves the last frame.
+//
+// Linked with bench/allocs.c (bench/draw-bench), this also counts the
+// allocations of each frame after the first REPLAY_WARMUP, and exits with 1
+// if updating the elements allocated. What Pango allocates laying out text
+// that changed, and what cairo and Pango allocate drawing, are reported
+// apart.
+static int
+run_replay(int argc, char **argv)
+{
+    int width = 1920;
+    int height = 1080;
+    int nframes = 1000;
+    gboolean full = FALSE;
+    const char *output = NULL;
+    Replay replay = { .ncpu = 8 };
+
+    for (int i = 2; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--full") == 0) {
+            full = TRUE;
+        } else if (strcmp(arg, "--size") == 0 && value && parse_size(value, &width, &height)) {
+            i++;
+        } else if (strcmp(arg, "--cpus") == 0 && value && atoi(value) > 0) {
+            replay.ncpu = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--frames") == 0 && value && atoi(value) > 0) {
+            nframes = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--output") == 0 && value) {
+            output = value;
+            i++;
+        } else if (arg[0] != '-' && !replay.path) {
+            replay.path = g_strdup(arg);
+        } else {
+            g_printerr("Usage: %s --replay [--size WxH] [--cpus N] [--frames N] [--full]\n"
+                       "       [--output PNG] [RECORDING]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    GError *error = NULL;
+    if (replay.path && !replay_open(&replay, &error)) {
+        g_printerr("manitor: %s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+    if (!replay.path) {
+        replay.usage = g_new(double, replay.ncpu);
+    }
+
+    Manitor *self = manitor_new();
+    self->prof = prof_new("draw", draw_stages, DRAW_STAGES);
+    PangoContext *context = pango_font_map_create_context(pango_cairo_font_map_get_default());
+    self->texts = text_cache_new(context, TEXT_CACHE_SIZE);
+    g_object_unref(context);
+
+    // The made-up values come as often as the fastest collector runs.
+    replay.step = G_MAXINT64;
+    for (int i = 0; i < INFO_COLLECTORS; i++) {
+        replay.step = MIN(replay.step, self->periods[i] * G_TIME_SPAN_MILLISECOND);
+    }
+    replay.time = g_get_real_time();
+
+    // Take the rest from the system.
+    info_set_history(self->info, self->history_len);
+    info_update(self->info);
+
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    gint64 total = 0;
+    int update_allocs = 0;  // After the warmup: by on_sample(), bar Pango...
+    int layout_allocs = 0;  // ...laying out new text,
+    int render_allocs = 0;  // by cairo and Pango drawing,
+    int draw_allocs = 0;    // and by the rest of manitor_draw().
+    for (int frame = 0; frame < nframes; frame++) {
+        InfoValues values;
+        if (!replay_next(&replay, &values, &error)) {
+            g_printerr("manitor: %s\n", error->message);
+            g_error_free(error);
+            return 1;
+        }
+        info_replay(self->info, &values);
+
+        // What the window does: update the elements, then redraw what they
+        // say changed (everything if the static layer has to be redrawn).
+        gint64 start = g_get_monotonic_time();
+        int a0 = allocs_get ? allocs_get() : 0;
+        self->layout_allocs = 0;
+        self->render_allocs = 0;
+        on_sample(self);
+        int a1 = allocs_get ? allocs_get() : 0;
+        int layout = self->layout_allocs;
+        cairo_t *cr = cairo_create(surface);
+        if (self->static_layer && !full) {
+            for (guint i = 0; i < self->ndamage; i++) {
+                const GdkRectangle *d = &self->damage[i];
+                cairo_rectangle(cr, d->x, d->y, d->width, d->height);
+            }
+            cairo_clip(cr);
+        }
+        int a2 = allocs_get ? allocs_get() : 0;
+        manitor_draw(self, cr, NULL, width, height, 1);
+        int a3 = allocs_get ? allocs_get() : 0;
+        cairo_destroy(cr);
+        cairo_surface_flush(surface);
+        total += g_get_monotonic_time() - start;
+        self->ndamage = 0;
+
+        if (frame >= REPLAY_WARMUP) {
+            update_allocs += a1 - a0 - layout;
+            layout_allocs += layout;
+            render_allocs += self->render_allocs;
+            draw_allocs += a3 - a2 - self->render_allocs;
+        }
+    }
+
+    g_print("%dx%d, %d CPUs, %d frames%s: %.3f ms/frame\n", width, height, replay.ncpu,
+            nframes, full ? " (full)" : "", total / 1e3 / nframes);
+    int status = 0;
+    if (allocs_get) {
+        int counted = MAX(1, nframes - REPLAY_WARMUP);
+        g_print("allocations/frame: %.1f update, %.1f laying out text, %.1f rendering, "
+                "%.1f drawing\n", (double) update_allocs / counted,
+                (double) layout_allocs / counted, (double) render_allocs / counted,
+                (double) draw_allocs / counted);
+        if (update_allocs > 0) {
+            g_printerr("manitor: %d allocations updating %d frames, expected none\n",
+                       update_allocs, counted);
+            status = 1;
+        }
+        if (draw_allocs > 0) {
+            g_printerr("manitor: %d allocations drawing %d frames, expected none\n",
+                       draw_allocs, counted);
+            status = 1;
+        }
+    }
+    GString *str = g_string_new(NULL);
+    manitor_format_prof(self, str, FALSE);
+    g_print("%s\n", str->str);
+    g_string_free(str, TRUE);
+
+    if (output && cairo_surface_write_to_png(surface, output) != CAIRO_STATUS_SUCCESS) {
+        g_printerr("manitor: Cannot write %s\n", output);
+    }
+    cairo_surface_destroy(surface);
+    if (replay.reader) {
+        record_reader_free(replay.reader);
+    }
+    g_free(replay.path);
+    g_free(replay.sample);
+    g_free(replay.usage);
+    manitor_stop(self);
+    return status;
+}
+
 int
 main(int argc, char** argv)
 {
+    // Each cgroup tracked keeps its directory open (see info_set_cgroups()),
+    // and there can be thousands: allow as many files as we may, for all the
+    // modes.
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    // manitor --headless [SOCKET]
+    if (argc > 1 && strcmp(argv[1], "--headless") == 0) {
+        return run_headless(argc > 2 ? argv[2] : NULL);
+    }
+    // manitor --replay ... (see run_replay())
+    if (argc > 1 && strcmp(argv[1], "--replay") == 0) {
+        return run_replay(argc, argv);
+    }
+
     gtk_init(&argc, &argv);
     
     Manitor *self = manitor_new();
@@ -508,13 +1959,60 @@ main(int argc, char** argv)
     }
 
     g_signal_connect(G_OBJECT(self->window), "destroy", G_CALLBACK(gtk_main_quit), NULL);
+    self->texts = text_cache_new(gtk_widget_get_pango_context(self->window), TEXT_CACHE_SIZE);
+
     g_signal_connect(G_OBJECT(self->window), "draw", G_CALLBACK(on_draw), self);
-    g_timeout_add(self->interval * 1000, (GSourceFunc) on_tick, self);
+    g_signal_connect(G_OBJECT(self->window), "style-updated", G_CALLBACK(on_style_updated), self);
+
+    // Pause while the window cannot be seen: when it is withdrawn, covered
+    // or the screen saver is on.
+    gtk_widget_add_events(self->window, GDK_STRUCTURE_MASK | GDK_VISIBILITY_NOTIFY_MASK);
+    g_signal_connect(G_OBJECT(self->window), "window-state-event",
+                     G_CALLBACK(on_window_state_event), self);
+    g_signal_connect(G_OBJECT(self->window), "visibility-notify-event",
+                     G_CALLBACK(on_visibility_notify_event), self);
+    GDBusConnection *bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+    if (bus) {
+        static const char * const screensavers[] = {
+            "org.freedesktop.ScreenSaver",
+            "org.gnome.ScreenSaver",
+        };
+        for (guint i = 0; i < G_N_ELEMENTS(screensavers); i++) {
+            g_dbus_connection_signal_subscribe(bus, NULL, screensavers[i], "ActiveChanged",
+                                               NULL, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                                               on_screensaver_active_changed, self, NULL);
+        }
+    }
 
+    // MANITOR_PROF=1 times the updates and the drawing; the times are printed
+    // on SIGUSR1 and at exit. MANITOR_PROF=overlay also shows them.
+    const char *prof = g_getenv("MANITOR_PROF");
+    if (prof && *prof && strcmp(prof, "0") != 0) {
+        self->prof = prof_new("draw", draw_stages, DRAW_STAGES);
+        self->update_prof = info_enable_prof(self->info);
+        self->prof_overlay = (strcmp(prof, "overlay") == 0);
+        g_unix_signal_add(SIGUSR1, (GSourceFunc) on_sigusr1, self);
+    }
+
+    info_set_history(self->info, self->history_len);
+
+    // Take the first sample right away, then let the sampler thread take over.
+    manitor_start_recording(self);
     info_update(self->info);
+    info_set_watch(self->info, (GSourceFunc) on_sample, self);
+    for (int i = 0; i < INFO_COLLECTORS; i++) {
+        info_set_period(self->info, i, self->periods[i]);
+    }
+    info_start(self->info);
+
     manitor_place_window(self);
     gtk_widget_show(self->window);
     gtk_main();
 
+    if (self->prof) {
+        on_sigusr1(self);
+    }
+    manitor_stop(self);
+
     return 0;
 }
@@ -0,0 +1,144 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ */
+#define _GNU_SOURCE // For clock_gettime() with -std=c99.
+
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "prof.h"
+
+struct ProfStage {
+    const char *name;               // The name of the stage.
+    guint64 count;                  // The number of times recorded.
+    gint64 times[PROF_WINDOW];      // The last times (ns), a ring buffer.
+};
+
+struct Prof {
+    char *name;                     // The name of the work.
+    GMutex lock;                    // Protects the stages.
+    int nstages;                    // The number of stages.
+    struct ProfStage stages[];      // The stages.
+};
+
+static gint64
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64) ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+static int
+compare_times(const void *a, const void *b)
+{
+    gint64 ta = *(const gint64 *) a;
+    gint64 tb = *(const gint64 *) b;
+    return (ta > tb) - (ta < tb);
+}
+
+Prof *
+prof_new(const char *name, const char * const *stages, int nstages)
+{
+    Prof *prof = g_malloc0(sizeof(Prof) + nstages * sizeof(struct ProfStage));
+    prof->name = g_strdup(name);
+    g_mutex_init(&prof->lock);
+    prof->nstages = nstages;
+    for (int i = 0; i < nstages; i++) {
+        prof->stages[i].name = stages[i];
+    }
+    return prof;
+}
+
+void
+prof_free(Prof *prof)
+{
+    if (!prof) {
+        return;
+    }
+    g_mutex_clear(&prof->lock);
+    g_free(prof->name);
+    g_free(prof);
+}
+
+gint64
+prof_start(Prof *prof)
+{
+    return prof ? now_ns() : 0;
+}
+
+void
+prof_add(Prof *prof, int stage, gint64 ns)
+{
+    if (!prof || stage < 0 || stage >= prof->nstages) {
+        return;
+    }
+
+    struct ProfStage *s = &prof->stages[stage];
+    g_mutex_lock(&prof->lock);
+    s->times[s->count % PROF_WINDOW] = ns;
+    s->count++;
+    g_mutex_unlock(&prof->lock);
+}
+
+void
+prof_lap(Prof *prof, int stage, gint64 *t)
+{
+    if (!prof) {
+        return;
+    }
+
+    gint64 now = now_ns();
+    prof_add(prof, stage, now - *t);
+    *t = now;
+}
+
+void
+prof_format(Prof *prof, GString *out, gboolean markup)
+{
+    if (!prof) {
+        return;
+    }
+
+    // (g_string_append_printf() allocates, g_snprintf() does not.)
+    char line[128];
+    if (markup) g_string_append(out, "<span font_family='monospace' size='small'>");
+    g_snprintf(line, sizeof(line), "%-10s %8s %9s %9s %9s %9s\n",
+               prof->name, "n", "min us", "avg us", "p99 us", "max us");
+    g_string_append(out, line);
+
+    gint64 times[PROF_WINDOW];
+    for (int i = 0; i < prof->nstages; i++) {
+        struct ProfStage *s = &prof->stages[i];
+
+        // Copy the window, so the lock is not held while sorting.
+        g_mutex_lock(&prof->lock);
+        guint64 count = s->count;
+        int n = MIN(count, PROF_WINDOW);
+        memcpy(times, s->times, n * sizeof(times[0]));
+        g_mutex_unlock(&prof->lock);
+
+        if (n == 0) {
+            g_snprintf(line, sizeof(line), "%-10s %8d\n", s->name, 0);
+            g_string_append(out, line);
+            continue;
+        }
+
+        qsort(times, n, sizeof(times[0]), compare_times);
+        double sum = 0;
+        for (int j = 0; j < n; j++) {
+            sum += times[j];
+        }
+        // The smallest time that at least 99% of the times are not above.
+        int p99 = (99 * n + 99) / 100 - 1;
+
+        g_snprintf(line, sizeof(line), "%-10s %8" G_GUINT64_FORMAT " %9.1f %9.1f %9.1f %9.1f\n",
+                   s->name, count, times[0] / 1e3, sum / n / 1e3,
+                   times[p99] / 1e3, times[n - 1] / 1e3);
+        g_string_append(out, line);
+    }
+    if (markup) g_string_append(out, "</span>");
+}
@@ -0,0 +1,39 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ */
+#ifndef MANITOR_PROF_H
+#define MANITOR_PROF_H
+
+// A Prof times the stages of some work (e.g. an update) with the monotonic
+// clock. It keeps the last PROF_WINDOW times of each stage, and reports their
+// min, average, 99th percentile and max.
+//
+// The functions that take a Prof do nothing if it is NULL, so profiling can
+// be disabled by not creating one. Stages can be timed on any thread.
+typedef struct Prof Prof;
+
+// The number of times kept per stage.
+#define PROF_WINDOW 1024
+
+// Creates a new Prof with nstages stages, named by stages (not copied).
+Prof * prof_new(const char *name, const char * const *stages, int nstages);
+
+// Frees the Prof.
+void prof_free(Prof *prof);
+
+// Returns the monotonic time in nanoseconds, or 0 if prof is NULL.
+// Use it to start timing, then call prof_lap() after each stage.
+gint64 prof_start(Prof *prof);
+
+// Records the time since *t for stage, and sets *t to the current time.
+void prof_lap(Prof *prof, int stage, gint64 *t);
+
+// Records ns nanoseconds for stage.
+void prof_add(Prof *prof, int stage, gint64 ns);
+
+// Appends a table of the stage times to out. markup: format it as Pango
+// markup in a monospace font.
+void prof_format(Prof *prof, GString *out, gboolean markup);
+
+#endif // #ifndef MANITOR_PROF_H
@@ -0,0 +1,692 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ */
+#define _GNU_SOURCE // For O_CLOEXEC etc. with -std=c99.
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "prof.h"
+#include "info.h"
+#include "record.h"
+
+// Snapshots queued beyond this many are dropped.
+#define QUEUE_MAX 1024
+
+// The series before the per-CPU ones.
+static const char *fixed_series[] = { "cpu", "mem", "swap", "rx", "tx" };
+#define NFIXED G_N_ELEMENTS(fixed_series)
+
+// The header of a segment (see record.h). All the fields are little-endian.
+struct Header {
+    char magic[8];
+    guint32 version;
+    guint32 nseries;
+    guint32 names_size;
+    guint32 data_offset;
+    gint64 start;
+    guint64 count;
+    guint64 bits;
+};
+G_STATIC_ASSERT(sizeof(struct Header) == 48);
+
+// The most bits a sample of n series takes: a 64-bit timestamp difference,
+// and for each series a new window with all 64 bits meaningful.
+#define SAMPLE_MAX_BITS(n) (4 + 64 + (guint64) (n) * (2 + 5 + 6 + 64))
+
+// A stream of bits, most significant first.
+struct Bits {
+    guint8 *data;       // The bytes (zeroed before writing).
+    guint64 size;       // Their number, in bits.
+    guint64 pos;        // The next bit to write or read.
+    gboolean overrun;   // Did a read go past the end, or find bits that
+                        // cannot have been written (a damaged segment)?
+};
+
+// The state of the compression of a series.
+struct Series {
+    guint64 prev;       // The previous value, as bits.
+    int leading;        // The zeros around the meaningful bits of the last
+    int trailing;       // XOR written in full (leading < 0: none yet).
+};
+
+// The state of the compression of the timestamps and of every series, the
+// same for writing and for reading.
+struct Codec {
+    gint64 time;        // The previous timestamp (ms).
+    gint64 delta;       // The previous difference between them.
+    guint nseries;      // The number of series.
+    struct Series *series;
+};
+
+// A segment being written.
+struct Segment {
+    int fd;                 // The file (-1: none).
+    guint8 *map;            // All of it, mapped.
+    struct Header *header;  // At the start of map.
+    struct Bits bits;       // The data, after the names.
+    struct Codec codec;     // The state of the compression.
+    gint64 start;           // The time of the first sample (ms).
+};
+
+// A snapshot queued to be written. Written samples are kept to be filled
+// again, so recording does not allocate once the queue is warm.
+struct Sample {
+    GList link;             // In Recorder.queue or .spare (data is the sample).
+    guint size;             // The allocated length of values.
+    gint64 time;            // ms since the epoch.
+    guint nseries;          // The number of values.
+    double values[];        // Rounded already.
+};
+
+struct Recorder {
+    char *dir;              // Where the segments go.
+    guint max_segments;     // Keep at most this many.
+    GMutex lock;            // Protects the fields below.
+    GCond cond;             // Signalled when a sample is queued, and on stop.
+    GQueue queue;           // The samples to write (struct Sample.link).
+    GQueue spare;           // The samples written.
+    gboolean stop;          // Stop once the queue is written.
+    GThread *thread;        // Writes them.
+    struct Segment seg;     // The segment being written.
+    gboolean failed;        // Did the last segment fail to open?
+};
+
+struct RecordReader {
+    guint8 *map;            // The file, mapped.
+    gsize size;             // Its size.
+    const char **names;     // The names of the series (into map).
+    guint64 count;          // The number of samples...
+    guint64 index;          // ...and the next one to read.
+    struct Bits bits;       // The data.
+    struct Codec codec;     // The state of the decompression.
+};
+
+static void
+codec_init(struct Codec *codec, guint nseries, gint64 start)
+{
+    codec->time = start;
+    codec->delta = 0;
+    codec->nseries = nseries;
+    codec->series = g_new(struct Series, nseries);
+    for (guint i = 0; i < nseries; i++) {
+        codec->series[i].prev = 0;
+        codec->series[i].leading = -1;
+        codec->series[i].trailing = 0;
+    }
+}
+
+static void
+codec_clear(struct Codec *codec)
+{
+    codec->series = (g_free(codec->series), NULL);
+    codec->nseries = 0;
+}
+
+// Appends the low n (<= 64) bits of value.
+static void
+put_bits(struct Bits *b, guint64 value, int n)
+{
+    while (n > 0) {
+        int room = 8 - (b->pos & 7);
+        int take = MIN(room, n);
+        guint8 bits = (value >> (n - take)) & ((1u << take) - 1);
+        b->data[b->pos >> 3] |= bits << (room - take);
+        b->pos += take;
+        n -= take;
+    }
+}
+
+// Reads n (<= 64) bits. Past the end, sets b->overrun and returns 0.
+static guint64
+get_bits(struct Bits *b, int n)
+{
+    if (b->pos + n > b->size) {
+        b->overrun = TRUE;
+        return 0;
+    }
+
+    guint64 value = 0;
+    while (n > 0) {
+        int room = 8 - (b->pos & 7);
+        int take = MIN(room, n);
+        guint8 bits = (b->data[b->pos >> 3] >> (room - take)) & ((1u << take) - 1);
+        value = (value << take) | bits;
+        b->pos += take;
+        n -= take;
+    }
+    return value;
+}
+
+// Returns the low n bits of value, sign-extended.
+static gint64
+sign_extend(guint64 value, int n)
+{
+    guint64 sign = G_GUINT64_CONSTANT(1) << (n - 1);
+    return (gint64) ((value ^ sign) - sign);
+}
+
+// The timestamps: the difference from the previous difference, in the
+// smallest of 1, 2+7, 3+9, 4+12 and 4+64 bits that it fits.
+static void
+put_time(struct Bits *b, struct Codec *codec, gint64 time)
+{
+    gint64 delta = time - codec->time;
+    gint64 dod = delta - codec->delta;
+    codec->time = time;
+    codec->delta = delta;
+
+    if (dod == 0) {
+        put_bits(b, 0, 1);
+    } else if (-64 <= dod && dod < 64) {
+        put_bits(b, 2, 2);
+        put_bits(b, dod, 7);
+    } else if (-256 <= dod && dod < 256) {
+        put_bits(b, 6, 3);
+        put_bits(b, dod, 9);
+    } else if (-2048 <= dod && dod < 2048) {
+        put_bits(b, 14, 4);
+        put_bits(b, dod, 12);
+    } else {
+        put_bits(b, 15, 4);
+        put_bits(b, dod, 64);
+    }
+}
+
+static gint64
+get_time(struct Bits *b, struct Codec *codec)
+{
+    gint64 dod;
+    if (get_bits(b, 1) == 0) {
+        dod = 0;
+    } else if (get_bits(b, 1) == 0) {
+        dod = sign_extend(get_bits(b, 7), 7);
+    } else if (get_bits(b, 1) == 0) {
+        dod = sign_extend(get_bits(b, 9), 9);
+    } else if (get_bits(b, 1) == 0) {
+        dod = sign_extend(get_bits(b, 12), 12);
+    } else {
+        dod = (gint64) get_bits(b, 64);
+    }
+
+    codec->delta += dod;
+    codec->time += codec->delta;
+    return codec->time;
+}
+
+// The values: the XOR with the previous value, as 0 if it is 0, as 10 and
+// its meaningful bits if they fit in those of the last XOR written in full,
+// and otherwise in full: 11, the leading zeros (5 bits), the number of
+// meaningful bits - 1 (6 bits) and the bits.
+static void
+put_value(struct Bits *b, struct Series *s, double value)
+{
+    guint64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    guint64 x = bits ^ s->prev;
+    s->prev = bits;
+
+    if (x == 0) {
+        put_bits(b, 0, 1);
+        return;
+    }
+
+    int leading = MIN(__builtin_clzll(x), 31);
+    int trailing = __builtin_ctzll(x);
+    if (s->leading >= 0 && leading >= s->leading && trailing >= s->trailing) {
+        put_bits(b, 2, 2);
+        put_bits(b, x >> s->trailing, 64 - s->leading - s->trailing);
+    } else {
+        int n = 64 - leading - trailing;
+        put_bits(b, 3, 2);
+        put_bits(b, leading, 5);
+        put_bits(b, n - 1, 6);
+        put_bits(b, x >> trailing, n);
+        s->leading = leading;
+        s->trailing = trailing;
+    }
+}
+
+static double
+get_value(struct Bits *b, struct Series *s)
+{
+    if (get_bits(b, 1) == 1) {
+        if (get_bits(b, 1) == 1) {
+            s->leading = get_bits(b, 5);
+            s->trailing = 64 - s->leading - (get_bits(b, 6) + 1);
+        }
+        // Damage can give a 10 before any 11, or more meaningful bits than
+        // there is room for after the leading zeros. Stop there.
+        if (s->leading < 0 || s->trailing < 0) {
+            b->overrun = TRUE;
+            s->leading = -1;
+            s->trailing = 0;
+            return 0;
+        }
+        int n = 64 - s->leading - s->trailing;
+        s->prev ^= get_bits(b, n) << s->trailing;
+    }
+
+    double value;
+    memcpy(&value, &s->prev, sizeof(value));
+    return value;
+}
+
+// Writing
+
+static void
+segment_close(struct Segment *seg)
+{
+    if (seg->fd < 0) {
+        return;
+    }
+
+    // Give back the space not used.
+    guint32 data_offset = GUINT32_FROM_LE(seg->header->data_offset);
+    munmap(seg->map, RECORD_SEGMENT_SIZE);
+    if (ftruncate(seg->fd, data_offset + (seg->bits.pos + 7) / 8) < 0) {
+        g_warning("Cannot truncate a recording: %s", g_strerror(errno));
+    }
+    close(seg->fd);
+    codec_clear(&seg->codec);
+    seg->fd = -1;
+    seg->map = NULL;
+    seg->header = NULL;
+}
+
+// Starts a new segment in rec->dir for samples like s, named after its time.
+static gboolean
+segment_open(struct Segment *seg, Recorder *rec, const struct Sample *s)
+{
+    GDateTime *dt = g_date_time_new_from_unix_utc(s->time / 1000);
+    char *stamp = g_date_time_format(dt, "%Y%m%dT%H%M%S");
+    char *name = g_strdup_printf("%s.%03dZ.mrec", stamp, (int) (s->time % 1000));
+    char *path = g_build_filename(rec->dir, name, NULL);
+    g_date_time_unref(dt);
+    g_free(stamp);
+    g_free(name);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    int err = (fd < 0) ? errno : 0;
+
+    // Allocate the blocks now: running out of space while writing to the
+    // mapping would be a SIGBUS.
+    if (fd >= 0 && (err = posix_fallocate(fd, 0, RECORD_SEGMENT_SIZE)) == 0) {
+        seg->map = mmap(NULL, RECORD_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+        if (seg->map == MAP_FAILED) {
+            err = errno;
+            seg->map = NULL;
+        }
+    }
+    if (err) {
+        if (!rec->failed) {
+            g_warning("Cannot record to %s: %s", path, g_strerror(err));
+        }
+        rec->failed = TRUE;
+        if (fd >= 0) {
+            close(fd);
+            g_unlink(path);
+        }
+        g_free(path);
+        return FALSE;
+    }
+    rec->failed = FALSE;
+    g_free(path);
+
+    // The names of the series follow the header, and the data them.
+    struct Header *h = seg->header = (struct Header *) seg->map;
+    char *names = (char *) (h + 1);
+    char *p = names;
+    for (guint i = 0; i < s->nseries; i++) {
+        if (i < NFIXED) {
+            p = g_stpcpy(p, fixed_series[i]) + 1;
+        } else {
+            p += g_snprintf(p, 16, "cpu%u", i - (guint) NFIXED) + 1;
+        }
+    }
+    guint32 names_size = p - names;
+    guint32 data_offset = (sizeof(*h) + names_size + 7) & ~7u;
+
+    memcpy(h->magic, RECORD_MAGIC, sizeof(h->magic));
+    h->version = GUINT32_TO_LE(RECORD_VERSION);
+    h->nseries = GUINT32_TO_LE(s->nseries);
+    h->names_size = GUINT32_TO_LE(names_size);
+    h->data_offset = GUINT32_TO_LE(data_offset);
+    h->start = GINT64_TO_LE(s->time);
+    h->count = 0;
+    h->bits = 0;
+
+    seg->fd = fd;
+    seg->bits.data = seg->map + data_offset;
+    seg->bits.size = (guint64) (RECORD_SEGMENT_SIZE - data_offset) * 8;
+    seg->bits.pos = 0;
+    seg->start = s->time;
+    codec_init(&seg->codec, s->nseries, s->time);
+    return TRUE;
+}
+
+static void
+segment_append(struct Segment *seg, const struct Sample *s)
+{
+    put_time(&seg->bits, &seg->codec, s->time);
+    for (guint i = 0; i < s->nseries; i++) {
+        put_value(&seg->bits, &seg->codec.series[i], s->values[i]);
+    }
+
+    // The data is in place before the header says so.
+    guint64 count = GUINT64_FROM_LE(seg->header->count) + 1;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    seg->header->bits = GUINT64_TO_LE(seg->bits.pos);
+    seg->header->count = GUINT64_TO_LE(count);
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+// Removes the oldest segments beyond rec->max_segments. The names start
+// with the time, so they sort by it.
+static void
+recorder_expire(Recorder *rec)
+{
+    GDir *dir = g_dir_open(rec->dir, 0, NULL);
+    if (!dir) {
+        return;
+    }
+
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    const char *name;
+    while ((name = g_dir_read_name(dir))) {
+        if (g_str_has_suffix(name, ".mrec")) {
+            g_ptr_array_add(names, g_strdup(name));
+        }
+    }
+    g_dir_close(dir);
+
+    qsort(names->pdata, names->len, sizeof(char *), compare_names);
+    for (guint i = 0; i + rec->max_segments < names->len; i++) {
+        char *path = g_build_filename(rec->dir, names->pdata[i], NULL);
+        g_unlink(path);
+        g_free(path);
+    }
+    g_ptr_array_free(names, TRUE);
+}
+
+static void
+recorder_write(Recorder *rec, const struct Sample *s)
+{
+    struct Segment *seg = &rec->seg;
+
+    // Start a new segment when the series change, the clock goes back, it
+    // is time, or the sample might not fit.
+    if (seg->fd >= 0 &&
+        (s->nseries != seg->codec.nseries ||
+         s->time < seg->codec.time ||
+         (s->time - seg->start) * G_TIME_SPAN_MILLISECOND >= RECORD_SEGMENT_PERIOD ||
+         seg->bits.pos + SAMPLE_MAX_BITS(s->nseries) > seg->bits.size)) {
+        segment_close(seg);
+    }
+    if (seg->fd < 0) {
+        if (!segment_open(seg, rec, s)) {
+            return;
+        }
+        recorder_expire(rec);
+    }
+    segment_append(seg, s);
+}
+
+static gpointer
+recorder_run(gpointer data)
+{
+    Recorder *rec = data;
+
+    g_mutex_lock(&rec->lock);
+    for (;;) {
+        GList *link = g_queue_pop_head_link(&rec->queue);
+        if (link) {
+            g_mutex_unlock(&rec->lock);
+            recorder_write(rec, link->data);
+            g_mutex_lock(&rec->lock);
+            g_queue_push_head_link(&rec->spare, link);
+        } else if (rec->stop) {
+            break;
+        } else {
+            g_cond_wait(&rec->cond, &rec->lock);
+        }
+    }
+    g_mutex_unlock(&rec->lock);
+
+    segment_close(&rec->seg);
+    return NULL;
+}
+
+Recorder *
+recorder_new(const char *dir, guint max_segments, GError **error)
+{
+    if (g_mkdir_with_parents(dir, 0700) < 0) {
+        int err = errno;
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                    "Cannot create %s: %s", dir, g_strerror(err));
+        return NULL;
+    }
+
+    Recorder *rec = g_new0(Recorder, 1);
+    rec->dir = g_strdup(dir);
+    rec->max_segments = MAX(1, max_segments);
+    g_mutex_init(&rec->lock);
+    g_cond_init(&rec->cond);
+    g_queue_init(&rec->queue);
+    g_queue_init(&rec->spare);
+    rec->seg.fd = -1;
+    rec->thread = g_thread_new("recorder", recorder_run, rec);
+    return rec;
+}
+
+void
+recorder_free(Recorder *rec)
+{
+    if (!rec) {
+        return;
+    }
+
+    g_mutex_lock(&rec->lock);
+    rec->stop = TRUE;
+    g_cond_signal(&rec->cond);
+    g_mutex_unlock(&rec->lock);
+    g_thread_join(rec->thread);
+
+    GList *link;
+    while ((link = g_queue_pop_head_link(&rec->spare))) {
+        g_free(link->data);
+    }
+    g_mutex_clear(&rec->lock);
+    g_cond_clear(&rec->cond);
+    g_free(rec->dir);
+    g_free(rec);
+}
+
+// Rounds a fraction to a multiple of 1/RECORD_RATIO_STEPS.
+static double
+round_ratio(double value)
+{
+    return round(value * RECORD_RATIO_STEPS) / RECORD_RATIO_STEPS;
+}
+
+void
+recorder_add(InfoSnapshot *snap, Recorder *rec)
+{
+    gint64 time = info_get_time(snap);
+    if (!time) {
+        return;
+    }
+
+    g_mutex_lock(&rec->lock);
+    gboolean full = (rec->queue.length >= QUEUE_MAX);
+    GList *link = full ? NULL : g_queue_pop_head_link(&rec->spare);
+    g_mutex_unlock(&rec->lock);
+    if (full) {
+        return;
+    }
+
+    int ncpu = info_get_cpu_count(snap);
+    guint n = NFIXED + ncpu;
+    struct Sample *s = link ? link->data : NULL;
+    if (!s || s->size < n) {
+        g_free(s);
+        s = g_malloc(sizeof(*s) + n * sizeof(double));
+        s->link.data = s;
+        s->size = n;
+    }
+    s->time = time / 1000;
+    s->nseries = n;
+
+    double times[INFO_CPU_STATES];
+    double cpu = 0;
+    if (info_get_cpu_times(snap, -1, times)) {
+        cpu = CLAMP(1 - times[INFO_CPU_IDLE] - times[INFO_CPU_IOWAIT], 0, 1);
+    }
+    s->values[0] = round_ratio(cpu);
+    s->values[1] = round_ratio(info_get_mem(snap));
+    s->values[2] = round_ratio(info_get_swap(snap));
+    s->values[3] = round(info_get_net_rxspeed(snap));
+    s->values[4] = round(info_get_net_txspeed(snap));
+    for (int i = 0; i < ncpu; i++) {
+        s->values[NFIXED + i] = round_ratio(info_get_cpu_usage(snap, i));
+    }
+
+    g_mutex_lock(&rec->lock);
+    g_queue_push_tail_link(&rec->queue, &s->link);
+    g_cond_signal(&rec->cond);
+    g_mutex_unlock(&rec->lock);
+}
+
+// Reading
+
+RecordReader *
+record_reader_open(const char *path, GError **error)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        int err = errno;
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                    "Cannot open %s: %s", path, g_strerror(err));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    gsize size = st.st_size;
+    guint8 *map = (size >= sizeof(struct Header))
+                ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                    "%s is not a recording", path);
+        return NULL;
+    }
+
+    // Check that the header and the names are consistent and fit.
+    const struct Header *h = (const struct Header *) map;
+    guint32 nseries = GUINT32_FROM_LE(h->nseries);
+    guint32 names_size = GUINT32_FROM_LE(h->names_size);
+    guint32 data_offset = GUINT32_FROM_LE(h->data_offset);
+    guint64 bits = GUINT64_FROM_LE(h->bits);
+    gboolean ok = memcmp(h->magic, RECORD_MAGIC, sizeof(h->magic)) == 0 &&
+                  GUINT32_FROM_LE(h->version) == RECORD_VERSION &&
+                  data_offset <= size &&
+                  sizeof(*h) + (guint64) names_size <= data_offset &&
+                  bits <= (guint64) (size - data_offset) * 8;
+
+    const char **names = ok ? g_new(const char *, MAX(1, nseries)) : NULL;
+    const char *p = (const char *) (h + 1);
+    const char *end = p + (ok ? names_size : 0);
+    for (guint i = 0; ok && i < nseries; i++) {
+        const char *nul = memchr(p, '\0', end - p);
+        if (!nul) {
+            ok = FALSE;
+            break;
+        }
+        names[i] = p;
+        p = nul + 1;
+    }
+    if (!ok) {
+        g_free(names);
+        munmap(map, size);
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                    "%s is not a recording", path);
+        return NULL;
+    }
+
+    RecordReader *reader = g_new0(RecordReader, 1);
+    reader->map = map;
+    reader->size = size;
+    reader->names = names;
+    reader->count = GUINT64_FROM_LE(h->count);
+    reader->bits.data = map + data_offset;
+    reader->bits.size = bits;
+    codec_init(&reader->codec, nseries, GINT64_FROM_LE(h->start));
+    return reader;
+}
+
+void
+record_reader_free(RecordReader *reader)
+{
+    if (!reader) {
+        return;
+    }
+
+    munmap(reader->map, reader->size);
+    g_free(reader->names);
+    codec_clear(&reader->codec);
+    g_free(reader);
+}
+
+guint
+record_reader_get_nseries(RecordReader *reader)
+{
+    return reader->codec.nseries;
+}
+
+const char *
+record_reader_get_name(RecordReader *reader, guint i)
+{
+    return (i < reader->codec.nseries) ? reader->names[i] : NULL;
+}
+
+guint64
+record_reader_get_count(RecordReader *reader)
+{
+    return reader->count;
+}
+
+gboolean
+record_reader_next(RecordReader *reader, gint64 *time, double *values)
+{
+    struct Bits *b = &reader->bits;
+    if (reader->index >= reader->count || b->overrun) {
+        return FALSE;
+    }
+    reader->index++;
+
+    *time = get_time(b, &reader->codec);
+    for (guint i = 0; i < reader->codec.nseries; i++) {
+        values[i] = get_value(b, &reader->codec.series[i]);
+    }
+    // A damaged segment can claim more samples than it holds, or hold bits
+    // that do not decode.
+    return !b->overrun;
+}
@@ -0,0 +1,88 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ */
+#ifndef MANITOR_RECORD_H
+#define MANITOR_RECORD_H
+
+// A Recorder appends snapshots to segment files in a directory, so that what
+// manitor saw can be looked at later. Each sample is the time and a value
+// for each series: "cpu" (all the CPUs), "mem", "swap", "rx", "tx" (the
+// speeds of the monitored interface, in bytes/s) and "cpu0", "cpu1", etc.
+//
+// The samples are compressed as in Facebook's Gorilla: the timestamps
+// (milliseconds) are stored as the difference from the previous difference,
+// which is usually 0 and takes 1 bit, and each value as the XOR with the
+// previous one of its series, which is usually 0 or has few meaningful bits.
+// The fractions are rounded to multiples of 1/RECORD_RATIO_STEPS and the
+// speeds to whole bytes first, so their mantissas end in zeros. A day of an
+// 8-CPU machine at 1 Hz takes a few megabytes.
+//
+// A segment is a file of RECORD_SEGMENT_SIZE bytes mapped into memory, and
+// the samples are written to the mapping. A new segment is started every
+// RECORD_SEGMENT_PERIOD, when the current one is full, and when the number
+// of series changes, and the finished one is cut down to what it holds. The
+// oldest segments are removed so that at most max_segments remain. The
+// encoding and the file operations happen on a thread of their own, so
+// neither the UI nor the sampler waits for the disk.
+//
+// A segment starts with a header (little-endian):
+//
+//     char magic[8]           RECORD_MAGIC
+//     u32 version             RECORD_VERSION
+//     u32 nseries
+//     u32 names_size          The size of the names below.
+//     u32 data_offset         Where the data starts.
+//     i64 start               The first timestamp (ms since the epoch).
+//     u64 count               The number of samples in the data.
+//     u64 bits                The size of the data, in bits.
+//     char names[names_size]  The names of the series, each NUL-terminated.
+//
+// The count and bits are updated after each sample, so a segment cut short
+// by a crash reads fine up to its last complete sample.
+typedef struct Recorder Recorder;
+
+// Reads a segment written by a Recorder.
+typedef struct RecordReader RecordReader;
+
+#define RECORD_MAGIC "MNTRREC\0"
+#define RECORD_VERSION 1
+
+#define RECORD_SEGMENT_SIZE (4 << 20)       // Bytes.
+#define RECORD_SEGMENT_PERIOD G_TIME_SPAN_HOUR
+#define RECORD_RATIO_STEPS 4096
+
+// The collectors whose values are recorded (see info_set_snapshot_func()).
+#define RECORD_COLLECTORS ((1u << INFO_CPU) | (1u << INFO_MEM) | (1u << INFO_NET))
+
+// Creates a new Recorder writing to dir (created if need be), keeping at
+// most max_segments segments. Returns NULL (and sets error) if dir cannot be
+// created.
+Recorder * recorder_new(const char *dir, guint max_segments, GError **error);
+
+// Writes out what is queued, closes the segment and frees the Recorder.
+void recorder_free(Recorder *rec);
+
+// Queues snap to be recorded. This only copies the values, and is meant to
+// be passed to info_set_snapshot_func(), with RECORD_COLLECTORS. If the
+// writing falls far behind, snapshots are dropped.
+void recorder_add(InfoSnapshot *snap, Recorder *rec);
+
+// Opens the segment at path. Returns NULL (and sets error) if it cannot be
+// read or is not a segment.
+RecordReader * record_reader_open(const char *path, GError **error);
+
+void record_reader_free(RecordReader *reader);
+
+// Returns the number of series, and the name of series i.
+guint record_reader_get_nseries(RecordReader *reader);
+const char * record_reader_get_name(RecordReader *reader, guint i);
+
+// Returns the number of samples in the segment.
+guint64 record_reader_get_count(RecordReader *reader);
+
+// Reads the next sample: its time (ms since the epoch) and a value for each
+// series. Returns FALSE at the end of the segment.
+gboolean record_reader_next(RecordReader *reader, gint64 *time, double *values);
+
+#endif // #ifndef MANITOR_RECORD_H
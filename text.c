@@ -0,0 +1,209 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ */
+#include <pango/pango.h>
+#include <string.h>
+
+#include "text.h"
+
+// A Text, as the cache keeps it.
+struct TextEntry {
+    Text text;      // Must be the first member (see text_ref()).
+    int ref;        // The reference count. The cache holds one.
+    GList link;     // The entry in TextCache.lru (data is the entry).
+    gsize markup_size;  // The allocated sizes of text.markup...
+    int baselines_size; // ...and of text.baselines.
+};
+
+struct TextCache {
+    PangoContext *context;  // Texts are laid out for this.
+    guint size;             // Keep at most this many Texts.
+    GHashTable *table;      // The Texts in the cache (keys and values).
+    GQueue lru;             // The same Texts, most recently used first.
+    guint64 hits;           // See text_cache_get_stats().
+    guint64 misses;         //
+};
+
+static guint
+text_hash(gconstpointer p)
+{
+    const Text *t = p;
+    return g_str_hash(t->markup) * 31 + pango_font_description_hash(t->font) * 7 + t->align;
+}
+
+static gboolean
+text_equal(gconstpointer a, gconstpointer b)
+{
+    const Text *ta = a;
+    const Text *tb = b;
+    return ta->align == tb->align &&
+           strcmp(ta->markup, tb->markup) == 0 &&
+           pango_font_description_equal(ta->font, tb->font);
+}
+
+// Lays out markup in e, reusing the buffers and the layout e already has.
+static void
+text_entry_set(struct TextEntry *e, const char *markup,
+               const PangoFontDescription *font, PangoAlignment align)
+{
+    Text *t = &e->text;
+    gsize len = strlen(markup) + 1;
+    if (len > e->markup_size) {
+        e->markup_size = MAX(len, 2 * e->markup_size);
+        t->markup = g_realloc(t->markup, e->markup_size);
+    }
+    memcpy(t->markup, markup, len);
+    if (!t->font || !pango_font_description_equal(t->font, font)) {
+        if (t->font) pango_font_description_free(t->font);
+        t->font = pango_font_description_copy(font);
+        pango_layout_set_font_description(t->layout, t->font);
+    }
+    t->align = align;
+    pango_layout_set_alignment(t->layout, align);
+    pango_layout_set_markup(t->layout, markup, -1);
+    pango_layout_get_pixel_extents(t->layout, &t->ink, &t->logical);
+
+    t->nlines = pango_layout_get_line_count(t->layout);
+    if (t->nlines > e->baselines_size) {
+        e->baselines_size = MAX(t->nlines, 2 * e->baselines_size);
+        t->baselines = g_renew(int, t->baselines, e->baselines_size);
+    }
+    PangoLayoutIter *iter = pango_layout_get_iter(t->layout);
+    for (int i = 0; i < t->nlines; i++) {
+        t->baselines[i] = PANGO_PIXELS(pango_layout_iter_get_baseline(iter));
+        pango_layout_iter_next_line(iter);
+    }
+    pango_layout_iter_free(iter);
+}
+
+// Lays out a new Text with a reference count of 1.
+static struct TextEntry *
+text_entry_new(PangoContext *context, const char *markup,
+               const PangoFontDescription *font, PangoAlignment align)
+{
+    struct TextEntry *e = g_new0(struct TextEntry, 1);
+    e->ref = 1;
+    e->link.data = e;
+    e->text.layout = pango_layout_new(context);
+    text_entry_set(e, markup, font, align);
+    return e;
+}
+
+Text *
+text_ref(Text *text)
+{
+    ((struct TextEntry *) text)->ref++;
+    return text;
+}
+
+void
+text_unref(Text *text)
+{
+    struct TextEntry *e = (struct TextEntry *) text;
+    if (!e || --e->ref > 0) {
+        return;
+    }
+
+    g_free(text->markup);
+    pango_font_description_free(text->font);
+    g_object_unref(text->layout);
+    g_free(text->baselines);
+    g_free(e);
+}
+
+int
+text_get_baseline(const Text *text, int n)
+{
+    if (n < 0) {
+        n += text->nlines;
+    }
+    return (0 <= n && n < text->nlines) ? text->baselines[n] : 0;
+}
+
+TextCache *
+text_cache_new(PangoContext *context, guint size)
+{
+    TextCache *cache = g_new0(TextCache, 1);
+    cache->context = g_object_ref(context);
+    cache->size = MAX(1, size);
+    cache->table = g_hash_table_new(text_hash, text_equal);
+    g_queue_init(&cache->lru);
+    return cache;
+}
+
+void
+text_cache_clear(TextCache *cache)
+{
+    g_hash_table_remove_all(cache->table);
+    GList *link;
+    while ((link = g_queue_pop_head_link(&cache->lru))) {
+        text_unref(link->data);
+    }
+}
+
+void
+text_cache_free(TextCache *cache)
+{
+    if (!cache) {
+        return;
+    }
+
+    text_cache_clear(cache);
+    g_hash_table_destroy(cache->table);
+    g_object_unref(cache->context);
+    g_free(cache);
+}
+
+Text *
+text_cache_get(TextCache *cache, const char *markup,
+               const PangoFontDescription *font, PangoAlignment align)
+{
+    Text key = {
+        .markup = (char *) markup,
+        .font = (PangoFontDescription *) font,
+        .align = align,
+    };
+
+    struct TextEntry *e = g_hash_table_lookup(cache->table, &key);
+    if (e) {
+        cache->hits++;
+        g_queue_unlink(&cache->lru, &e->link);
+        g_queue_push_head_link(&cache->lru, &e->link);
+        return text_ref(&e->text);
+    }
+
+    cache->misses++;
+
+    // Drop the least recently used Texts to make room. Elements still showing
+    // them keep their own references; one that nobody else holds is laid out
+    // again rather than freed, so a full cache stops allocating Texts.
+    struct TextEntry *spare = NULL;
+    while (cache->lru.length >= cache->size) {
+        GList *old = g_queue_pop_tail_link(&cache->lru);
+        g_hash_table_remove(cache->table, old->data);
+        if (!spare && ((struct TextEntry *) old->data)->ref == 1) {
+            spare = old->data;
+        } else {
+            text_unref(old->data);
+        }
+    }
+
+    if (spare) {
+        e = spare;
+        text_entry_set(e, markup, font, align);
+    } else {
+        e = text_entry_new(cache->context, markup, font, align);
+    }
+    g_hash_table_add(cache->table, e);
+    g_queue_push_head_link(&cache->lru, &e->link);
+
+    return text_ref(&e->text);
+}
+
+void
+text_cache_get_stats(TextCache *cache, guint64 *hits, guint64 *misses)
+{
+    if (hits) *hits = cache->hits;
+    if (misses) *misses = cache->misses;
+}
@@ -0,0 +1,53 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ */
+#ifndef MANITOR_TEXT_H
+#define MANITOR_TEXT_H
+
+// A piece of marked-up text, laid out and measured. Texts come from a
+// TextCache, and must not be changed.
+typedef struct {
+    char *markup;                   // The text.
+    PangoFontDescription *font;     // The default font.
+    PangoAlignment align;           // The alignment of the lines.
+    PangoLayout *layout;            // The text, laid out.
+    PangoRectangle ink;             // The pixel extents of the layout.
+    PangoRectangle logical;         //
+    int nlines;                     // The number of lines.
+    int *baselines;                 // The baseline of each line (pixels).
+} Text;
+
+// A TextCache keeps the most recently used Texts, so text that repeats from
+// frame to frame is only laid out once.
+typedef struct TextCache TextCache;
+
+// Creates a new TextCache that keeps up to size Texts laid out for context.
+TextCache * text_cache_new(PangoContext *context, guint size);
+
+// Frees the cache. Texts still referenced elsewhere stay valid.
+void text_cache_free(TextCache *cache);
+
+// Drops all the Texts from the cache. Call this when the context changes
+// (e.g. the font options).
+void text_cache_clear(TextCache *cache);
+
+// Returns the Text for markup in the given font and alignment, laying it out
+// if it is not in the cache. Release the result with text_unref().
+Text * text_cache_get(TextCache *cache, const char *markup,
+                      const PangoFontDescription *font, PangoAlignment align);
+
+// Returns the number of text_cache_get() calls that found the Text in the
+// cache (hits), and that had to lay it out (misses).
+void text_cache_get_stats(TextCache *cache, guint64 *hits, guint64 *misses);
+
+// Reference counting. text_ref() returns text.
+Text * text_ref(Text *text);
+void text_unref(Text *text);
+
+// Returns the baseline of line n (0 = first line) of text.
+// n can be negative (-1 = last line, -2 = last before, etc.).
+// Returns 0 if there is no such line.
+int text_get_baseline(const Text *text, int n);
+
+#endif // #ifndef MANITOR_TEXT_H
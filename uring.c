@@ -0,0 +1,217 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ */
+#define _GNU_SOURCE // For syscall() with -std=c99.
+
+#include <glib.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+// The rings are shared with the kernel. The indices it reads are published
+// with release stores, and the ones it writes are read with acquire loads.
+struct Uring {
+    int fd;                     // The io_uring.
+    guint entries;              // The size of the submission queue.
+
+    void *sq_map;               // The submission ring, mapped...
+    gsize sq_map_size;          //
+    unsigned *sq_tail;          // ...and the parts of it we use.
+    unsigned *sq_mask;          //
+    unsigned *sq_array;         //
+    struct io_uring_sqe *sqes;  // The submission entries, mapped.
+    gsize sqes_size;            //
+
+    void *cq_map;               // The completion ring (may be sq_map)...
+    gsize cq_map_size;          //
+    unsigned *cq_head;          // ...and the parts of it we use.
+    unsigned *cq_tail;          //
+    unsigned *cq_mask;          //
+    struct io_uring_cqe *cqes;  //
+
+    gboolean registered;        // Are there registered buffers?
+};
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int
+io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Returns TRUE if the kernel knows IORING_OP_READ (5.6). Older ones do not
+// know how to probe either.
+static gboolean
+supports_read(int fd)
+{
+    gsize size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = g_malloc0(size);
+    gboolean ok = io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                  probe->last_op >= IORING_OP_READ &&
+                  (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    g_free(probe);
+    return ok;
+}
+
+Uring *
+uring_new(guint entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = io_uring_setup(MAX(1, entries), &p);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (!supports_read(fd)) {
+        close(fd);
+        return NULL;
+    }
+
+    Uring *ring = g_new0(Uring, 1);
+    ring->fd = fd;
+    ring->entries = p.sq_entries;
+
+    ring->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_map_size = ring->cq_map_size = MAX(ring->sq_map_size, ring->cq_map_size);
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+        uring_free(ring);
+        return NULL;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            ring->cq_map = NULL;
+            uring_free(ring);
+            return NULL;
+        }
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uring_free(ring);
+        return NULL;
+    }
+
+    char *sq = ring->sq_map;
+    ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+    char *cq = ring->cq_map;
+    ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return ring;
+}
+
+void
+uring_free(Uring *ring)
+{
+    if (!ring) {
+        return;
+    }
+
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map && ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_size);
+    if (ring->sq_map) munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+    g_free(ring);
+}
+
+gboolean
+uring_register_buffers(Uring *ring, const struct iovec *iovs, guint n)
+{
+    if (ring->registered) {
+        io_uring_register(ring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        ring->registered = FALSE;
+    }
+    ring->registered = (n > 0 && io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iovs, n) == 0);
+    return ring->registered;
+}
+
+// Moves the completions that are in to reads. Returns how many there were.
+static guint
+reap(Uring *ring, UringRead *reads)
+{
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    guint n = 0;
+    for (; head != tail; head++, n++) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        reads[cqe->user_data].res = cqe->res;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+gboolean
+uring_read(Uring *ring, UringRead *reads, guint n)
+{
+    g_return_val_if_fail(n <= ring->entries, FALSE);
+
+    unsigned tail = *ring->sq_tail;
+    for (guint i = 0; i < n; i++, tail++) {
+        unsigned index = tail & *ring->sq_mask;
+        struct io_uring_sqe *sqe = &ring->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = (reads[i].buf_index >= 0) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = reads[i].fd;
+        sqe->addr = (guintptr) reads[i].buf;
+        sqe->len = reads[i].len;
+        sqe->off = 0;
+        sqe->buf_index = MAX(0, reads[i].buf_index);
+        sqe->user_data = i;
+        ring->sq_array[index] = index;
+        reads[i].res = -ECANCELED;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    // The kernel only waits once everything is submitted, so a short
+    // submission (e.g. for lack of memory) just takes another round.
+    guint submitted = 0;
+    guint completed = 0;
+    while (completed < n) {
+        int ret = io_uring_enter(ring->fd, n - submitted, n - completed,
+                                 IORING_ENTER_GETEVENTS);
+        if (ret < 0 && errno != EINTR) {
+            // Wait for the reads in flight, as they write to the buffers.
+            while (completed < submitted &&
+                   (io_uring_enter(ring->fd, 0, submitted - completed,
+                                   IORING_ENTER_GETEVENTS) >= 0 || errno == EINTR)) {
+                completed += reap(ring, reads);
+            }
+            return FALSE;
+        }
+        submitted += MAX(ret, 0);
+        completed += reap(ring, reads);
+    }
+    return TRUE;
+}
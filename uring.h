@@ -0,0 +1,46 @@
+/*
+ * manitor -- Display system information on the desktop.
+ * See LICENSE for copyright.
+ */
+#ifndef MANITOR_URING_H
+#define MANITOR_URING_H
+
+#include <sys/uio.h>
+
+// A Uring reads a batch of files with a single system call, using io_uring
+// (Linux 5.6 and later). The reads can go into buffers registered with the
+// kernel beforehand, so that they are not mapped again on every read.
+//
+// io_uring can be missing, or disabled by the kernel.io_uring_disabled sysctl
+// or a seccomp filter (containers often have one). uring_new() then returns
+// NULL, and the files have to be read one at a time.
+typedef struct Uring Uring;
+
+// A read of a file from its start.
+typedef struct {
+    int fd;             // The file.
+    void *buf;          // Where to read to...
+    gsize len;          // ...and how much at most.
+    int buf_index;      // The registered buffer buf is in (-1: none).
+    gpointer data;      // For the caller.
+    gssize res;         // Set to the number of bytes read, or -errno.
+} UringRead;
+
+// Creates a Uring for batches of up to entries reads. Returns NULL if
+// io_uring cannot be used.
+Uring * uring_new(guint entries);
+
+void uring_free(Uring *ring);
+
+// Registers n buffers for the reads to refer to by index, in place of the
+// ones registered before. Returns FALSE if the kernel refuses (the buffers
+// are locked in memory, which RLIMIT_MEMLOCK limits); the reads must then
+// have a buf_index of -1.
+gboolean uring_register_buffers(Uring *ring, const struct iovec *iovs, guint n);
+
+// Submits the n reads (at most entries) and waits for all of them, normally
+// in a single io_uring_enter(). Returns FALSE if the kernel refused them,
+// and the ring must not be used again.
+gboolean uring_read(Uring *ring, UringRead *reads, guint n);
+
+#endif // #ifndef MANITOR_URING_H